@@ -22,3 +22,19 @@ void F77_SUB(lagderiv)(double *T, int *nr, int *N, double *ytau) {
   return;
 }
 
+
+void F77_SUB(lagvalues)(double *T, int *nT, int *nr, int *N, double *ytau) {
+  static void(*fun)(double*, int, int*, int, double*) = NULL;
+  if (fun == NULL)
+    fun =  (void(*)(double*, int, int*, int, double*))R_GetCCallable("deSolve", "lagvalues");
+  fun(T, *nT, nr, *N, ytau);
+  return;
+}
+
+void F77_SUB(lagderivs)(double *T, int *nT, int *nr, int *N, double *ytau) {
+  static void(*fun)(double*, int, int*, int, double*) = NULL;
+  if (fun == NULL)
+    fun =  (void(*)(double*, int, int*, int, double*))R_GetCCallable("deSolve", "lagderivs");
+  fun(T, *nT, nr, *N, ytau);
+  return;
+}
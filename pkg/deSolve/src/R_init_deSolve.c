@@ -9,6 +9,10 @@ void lagvalue(double T, int* nr, int N, double* ytau);
 
 void lagderiv(double T, int* nr, int N, double* ytau);
 
+void lagvalues(double* T, int nT, int* nr, int N, double* ytau);
+
+void lagderivs(double* T, int nT, int* nr, int N, double* ytau);
+
 double glob_timesteps[] = {0, 0};
 
 void R_init_deSolve(DllInfo *info) {
@@ -20,6 +24,8 @@ void R_init_deSolve(DllInfo *info) {
   RREGDEF(get_deSolve_gparms);
   RREGDEF(lagvalue);
   RREGDEF(lagderiv);
+  RREGDEF(lagvalues);
+  RREGDEF(lagderivs);
 
   /* initialize global variables */
   timesteps = glob_timesteps;
@@ -183,9 +183,9 @@ SEXP call_daspk(SEXP y, SEXP yprime, SEXP times, SEXP resfunc, SEXP parms,
 
   int    j, nt, ny, repcount, latol, lrtol, lrw, liw, isDll;
   int    maxit, isForcing, isEvent, islag, istate;
-  double *xytmp,  *xdytmp, tin, tout, *Atol, *Rtol;
+  double *xytmp,  *xdytmp, tin, tout, tend, tstop, tbreak = 0, *Atol, *Rtol;
   double *delta=NULL, cj = 0.;
-  int    *Info,  ninfo, idid, mflag, ires = 0;
+  int    *Info,  ninfo, idid, mflag, ires = 0, info3;
   int    *iwork, it, ntot= 0, nout, funtype;
   double *rwork;
   
@@ -362,16 +362,31 @@ SEXP call_daspk(SEXP y, SEXP yprime, SEXP times, SEXP resfunc, SEXP parms,
       rwork[0] = tout;
     }
 
+     info3 = Info[3];   /* tstop, changed at the breakpoints of delays */
+     tstop = rwork[0];
      repcount = 0;
      do  /* iterations in case maxsteps>500* or in case islag */
 	   {
+      tend = tout;
+      if (islag == 1) {
+        /* do not step over a breakpoint of the delays (see dede) */
+        tbreak = nextlagbreak(tin);
+        if (tbreak <= tout) {
+          tend = tbreak;
+          Info[3] = 1;
+          rwork[0] = tend;
+        } else {
+          Info[3] = info3;
+          rwork[0] = tstop;
+        }
+      }
      	if (Info[11] ==0) {        /*ordinary jac*/
-	       F77_CALL(ddaspk) (res_func, &ny, &tin, xytmp, xdytmp, &tout,
+	       F77_CALL(ddaspk) (res_func, &ny, &tin, xytmp, xdytmp, &tend,
 			   Info, Rtol, Atol, &idid, 
 			   rwork, &lrw, iwork, &liw, out, ipar, daejac_func, psol_func);
 
 	      } else {                /* krylov - not yet used */
-      	 F77_CALL(ddaspk) (res_func, &ny, &tin, xytmp, xdytmp, &tout,
+      	 F77_CALL(ddaspk) (res_func, &ny, &tin, xytmp, xdytmp, &tend,
 			   Info, Rtol, Atol, &idid, 
 			   rwork, &lrw, iwork, &liw, out, ipar, kryljac_func, psol_func);
         }
@@ -379,7 +394,11 @@ SEXP call_daspk(SEXP y, SEXP yprime, SEXP times, SEXP resfunc, SEXP parms,
     timesteps [0] = rwork[10];
     timesteps [1] = rwork[11];
   
-    if (islag == 1) updatehist(tin, xytmp, xdytmp, rwork, iwork);    
+    if (islag == 1) {
+      updatehist(tin, xytmp, xdytmp, rwork, iwork);    
+      /* restart the method at a breakpoint */
+      if (idid > 0 && tin >= tbreak) Info[0] = 0;
+    }
         
 	  repcount ++;
 	  if (idid == -1) 
@@ -95,6 +95,9 @@ void F77_NAME(dvode)(void (*)(int *, double *, double *, double *,
                         int *, double *, int *, double*, int*),
              int *, double *, int *);
 
+void F77_NAME(dintdy)(double *, int *, double *, int *, double *, int *);
+void F77_NAME(dvindy)(double *, int *, double *, int *, double *, int *);
+
 /* wrapper above the derivate function that first estimates the
 values of the forcing functions */
 
@@ -222,7 +225,7 @@ SEXP call_lsoda(SEXP y, SEXP times, SEXP derivfunc, SEXP parms, SEXP rtol,
     SEXP eventfunc, SEXP verbose, SEXP iTask, SEXP rWork, SEXP iWork, SEXP jT, 
     SEXP nOut, SEXP lRw, SEXP lIw, SEXP Solver, SEXP rootfunc, 
     SEXP nRoot, SEXP Rpar, SEXP Ipar, SEXP Type, SEXP flist, SEXP elist,
-    SEXP elag)
+    SEXP elag, SEXP slist)
 
 {
 /******************************************************************************/
@@ -231,13 +234,15 @@ SEXP call_lsoda(SEXP y, SEXP times, SEXP derivfunc, SEXP parms, SEXP rtol,
 
   int  i, j, k, nt, repcount, latol, lrtol, lrw, liw;
   int  maxit, solver, isForcing, isEvent, islag;
-  double *xytmp, tin, tout, *Atol, *Rtol, *dy=NULL, ss, pt;
+  double *xytmp, tin, tout, tend, tbreak = 0, *Atol, *Rtol, *dy=NULL, ss, pt;
   int itol, itask, istate, iopt, jt, mflag,  is, iterm;
   int nroot, *jroot=NULL, isDll, type;
+  int nsens, iflag, izero = 0;
+  double tsens = 0, *sens = NULL;
   
   int    *iwork, it, ntot, nout, iroot, *evals =NULL;   
   double *rwork;
-  SEXP TROOT, NROOT, VROOT; /* IROOT is in deSolve.h*/
+  SEXP TROOT, NROOT, VROOT, SENS = NULL; /* IROOT is in deSolve.h*/
   
   /* pointers to functions passed to FORTRAN */
   C_deriv_func_type *deriv_func;    
@@ -397,6 +402,21 @@ SEXP call_lsoda(SEXP y, SEXP times, SEXP derivfunc, SEXP parms, SEXP rtol,
   if (isEvent && islag) itask = 5;  
   istate = 1;
 
+/* forward sensitivities (lsode, vode): one step at a time, the sensitivities
+   follow each step; maxit counts the steps per output interval  */
+  nsens = initSens(slist, solver, initfunc, isDll, deriv_func,
+                   Rtol, lrtol, Atol, latol);
+  if (nsens > 0) {
+    itask = (itask == 4) ? 5 : 2;
+    maxit = (iwork[5] > 0) ? iwork[5] : 500;
+    tsens = REAL(times)[0];
+    initsenshist(tsens);
+    sens = (double *) R_alloc(n_eq * nsens, sizeof(double));
+    PROTECT(SENS = alloc3DArray(REALSXP, nt, n_eq, nsens)); incr_N_Protect();
+    for (k = 0; k < nt * n_eq * nsens; k++) REAL(SENS)[k] = NA_REAL;
+    for (k = 0; k < n_eq * nsens; k++) REAL(SENS)[k * nt] = 0.;
+  }
+
   iopt = 0;
   ss = 0.;
   is = 0 ;
@@ -436,8 +456,13 @@ SEXP call_lsoda(SEXP y, SEXP times, SEXP derivfunc, SEXP parms, SEXP rtol,
     }
     repcount = 0;
     do  {
-      if (islag)       
-        rwork[0] = tout;
+      tend = tout;
+      if (islag) {
+        /* do not step over a breakpoint of the delays (see dede) */
+        tbreak = nextlagbreak(tin);
+        if (tbreak <= tout) tend = tbreak;
+        rwork[0] = tend;
+      }
        
       /* error control */
         if (istate == -2) {
@@ -448,33 +473,47 @@ SEXP call_lsoda(SEXP y, SEXP times, SEXP derivfunc, SEXP parms, SEXP rtol,
         }
 
       if (solver == 1) {
-          F77_CALL(dlsoda) (deriv_func, &n_eq, xytmp, &tin, &tout,
+          F77_CALL(dlsoda) (deriv_func, &n_eq, xytmp, &tin, &tend,
                &itol, Rtol, Atol, &itask, &istate, &iopt, rwork,
                &lrw, iwork, &liw, jac_func, &jt, out, ipar); 
+      } else if (nsens > 0) {
+        /* a step only if the last one did not pass tout */
+        if (tsens < tout) {
+          if (solver == 5)
+            F77_CALL(dvode) (deriv_func, &n_eq, xytmp, &tsens, &tend,
+               &itol, Rtol, Atol, &itask, &istate, &iopt, rwork,
+               &lrw, iwork, &liw, jac_func, &jt, out, ipar);
+          else
+            F77_CALL(dlsode) (deriv_func, &n_eq, xytmp, &tsens, &tend,
+               &itol, Rtol, Atol, &itask, &istate, &iopt, rwork,
+               &lrw, iwork, &liw, jac_func, &jt, out, ipar);
+          if (istate == 2) updatesens(tsens, xytmp, rwork, iwork);
+        }
+        tin = (tsens < tout) ? tsens : tout;
       } else if (solver == 2) {
-        F77_CALL(dlsode) (deriv_func, &n_eq, xytmp, &tin, &tout,
+        F77_CALL(dlsode) (deriv_func, &n_eq, xytmp, &tin, &tend,
                &itol, Rtol, Atol, &itask, &istate, &iopt, rwork,
                &lrw, iwork, &liw, jac_func, &jt, out, ipar); 
       } else if (solver == 3) {
-        F77_CALL(dlsodes) (deriv_func, &n_eq, xytmp, &tin, &tout,
+        F77_CALL(dlsodes) (deriv_func, &n_eq, xytmp, &tin, &tend,
                &itol, Rtol, Atol, &itask, &istate, &iopt, rwork,
                &lrw, iwork, &liw, rwork, jac_vec, &jt, out, ipar);  /*rwork: iwk in fortran*/
       } else if (solver == 4) {
-        F77_CALL(dlsodar) (deriv_func, &n_eq, xytmp, &tin, &tout,
+        F77_CALL(dlsodar) (deriv_func, &n_eq, xytmp, &tin, &tend,
                &itol, Rtol, Atol,  &itask, &istate, &iopt, rwork,
                &lrw, iwork, &liw, jac_func, &jt, root_func, &nroot, jroot, 
                out, ipar); 
       } else if (solver == 5) {
-          F77_CALL(dvode) (deriv_func, &n_eq, xytmp, &tin, &tout,
+          F77_CALL(dvode) (deriv_func, &n_eq, xytmp, &tin, &tend,
                &itol, Rtol, Atol, &itask, &istate, &iopt, rwork,
                &lrw, iwork, &liw, jac_func, &jt, out, ipar);
       } else if (solver == 6) {
-          F77_CALL(dlsoder) (deriv_func, &n_eq, xytmp, &tin, &tout,
+          F77_CALL(dlsoder) (deriv_func, &n_eq, xytmp, &tin, &tend,
                &itol, Rtol, Atol, &itask, &istate, &iopt, rwork,
                &lrw, iwork, &liw, jac_func, &jt, root_func, &nroot, jroot, 
                out, ipar);
      } else if (solver == 7) {
-        F77_CALL(dlsodesr) (deriv_func, &n_eq, xytmp, &tin, &tout,
+        F77_CALL(dlsodesr) (deriv_func, &n_eq, xytmp, &tin, &tend,
                &itol, Rtol, Atol, &itask, &istate, &iopt, rwork,
                &lrw, iwork, &liw, rwork, jac_vec, &jt, root_func, &nroot, jroot, /*rwork: iwk in fortran*/
                out, ipar);
@@ -539,10 +578,27 @@ SEXP call_lsoda(SEXP y, SEXP times, SEXP derivfunc, SEXP parms, SEXP rtol,
         C_deriv_func (&n_eq, &tin, xytmp, dy, out, ipar);
       updatehist(tin, xytmp, dy, rwork, iwork);    
       repcount = 0;
+      /* restart the method at a breakpoint */
+      if (istate > 0 && tin >= tbreak) istate = 1;
     }
         repcount ++;
     } while (tin < tout && istate >= 0 && repcount < maxit); 
 
+    if (nsens > 0 && istate >= 0) {
+      if (tin < tout)
+        warning("an excessive amount of work (> maxsteps ) was done, but integration was not successful - increase maxsteps");
+      else {
+        /* states and sensitivities at tout, from the last steps */
+        if (solver == 5)
+          F77_CALL(dvindy) (&tout, &izero, rwork + 20, &n_eq, xytmp, &iflag);
+        else
+          F77_CALL(dintdy) (&tout, &izero, rwork + 20, &n_eq, xytmp, &iflag);
+        senstout(tout, sens);
+        for (k = 0; k < n_eq * nsens; k++)
+          REAL(SENS)[(it + 1) + k * nt] = sens[k];
+      }
+    }
+
   if (istate == -3)  {
     error("illegal input detected before taking any integration steps - see written message");
       unprotect_all();
@@ -579,6 +635,14 @@ SEXP call_lsoda(SEXP y, SEXP times, SEXP derivfunc, SEXP parms, SEXP rtol,
   if (isEvent && rootevent && iroot > 0)
     for (j=0; j<3; j++) iwork[10+j] = evals[j];
 
+  /* the function evaluations for the sensitivities are counted too */
+  if (nsens > 0) {
+    sensstats(&iflag, &k);
+    iwork[11] += iflag;
+    if (k > 0)
+      warning("the corrector of the sensitivities did not converge in %i steps", k);
+  }
+
   // thpe-test: reduce ilen from 23 to 21
   terminate(istate, iwork, 21, 0, rwork, 5,10);    /* istate, iwork, rwork */
   
@@ -620,6 +684,12 @@ SEXP call_lsoda(SEXP y, SEXP times, SEXP derivfunc, SEXP parms, SEXP rtol,
       setAttrib(YOUT2, install("indroot"), IROOT);
     }
   }
+  if (nsens > 0) {
+    if (istate > 0)
+      setAttrib(YOUT, install("sensitivities"), SENS);
+    else
+      setAttrib(YOUT2, install("sensitivities"), SENS);
+  }
 /*                       ####   termination   ####                            */    
   restore_N_Protected(old_N_Protect);
   unlock_solver();
@@ -335,7 +335,7 @@ SEXP call_radau(SEXP y, SEXP times, SEXP derivfunc, SEXP masfunc, SEXP jacfunc,
   int  j, nt, latol, lrtol, lrw, liw,
        ijac, mljac, mujac, imas, mlmas, mumas;
   int  isForcing;
-  double *xytmp, tout, *Atol, *Rtol, hini=0;
+  double *xytmp, tout, tend, *Atol, *Rtol, hini=0;
   int itol, iout, idid;
 
   SEXP TROOT, NROOT, VROOT, IROOT;
@@ -493,7 +493,10 @@ SEXP call_radau(SEXP y, SEXP times, SEXP derivfunc, SEXP masfunc, SEXP jacfunc,
   do {
     if (islag == 1) C_saveLag(1, &tin, xytmp, out, ipar, out, ipar);
 
-    F77_CALL(radau5) ( &n_eq, deriv_func, &tin, xytmp, &tout, &hini, 
+    /* restart at the breakpoints of the delays (see dede) */
+    tend = (islag == 1) ? fmin(tout, nextlagbreak(tin)) : tout;
+
+    F77_CALL(radau5) ( &n_eq, deriv_func, &tin, xytmp, &tend, &hini, 
 		     Rtol, Atol, &itol, jac_func, &ijac, &mljac, &mujac, 
          mas_func, &imas, &mlmas, &mumas, solout, &iout,
 		     rwork, &lrw, iwork, &liw, out, ipar, &idid);
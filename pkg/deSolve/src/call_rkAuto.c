@@ -9,7 +9,8 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   SEXP Parms, SEXP eventfunc, SEXP elist, SEXP Nout, SEXP Rho,
   SEXP Rtol, SEXP Atol, SEXP Tcrit, SEXP Verbose,
   SEXP Hmin, SEXP Hmax, SEXP Hini, SEXP Rpar, SEXP Ipar,
-  SEXP Method, SEXP Maxsteps, SEXP Flist) {
+  SEXP Method, SEXP Maxsteps, SEXP Flist, SEXP Rootfunc, SEXP nRoot,
+  SEXP Lags) {
 
   /**  Initialization **/
   long int old_N_Protect = save_N_Protected();
@@ -20,9 +21,10 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   SEXP  R_yout;
   double *y0,  *y1,  *y2,  *dy1,  *dy2, *out, *yout;
 
-  double errold = 0.0, t, dt, tmax;
+  double t, dt, tmax;
+  rk_control ctl;
 
-  SEXP R_FSAL, Alpha, Beta;
+  SEXP R_FSAL;
   int fsal = FALSE;       /* assume no FSAL */
   
   /* Use polynomial interpolation if not disabled by the method
@@ -33,7 +35,9 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   int interpolate = TRUE;
 
   int i = 0, j = 0, it = 0, it_tot = 0, it_ext = 0, nt = 0, neq = 0, it_rej = 0;
-  int isForcing, isEvent;
+  int isForcing, isEvent, isLag;
+  int nroot = INTEGER(nRoot)[0], iroot = 0, *jroot = NULL;
+  double *gold = NULL, *gnew = NULL;
 
   /*------------------------------------------------------------------------*/
   /* Processing of Arguments                                                */
@@ -57,8 +61,9 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
 
   int stage     = (int)REAL(getListElement(Method, "stage"))[0];
 
-  SEXP R_A, R_B1, R_B2, R_C, R_D, R_densetype;
-  double  *A, *bb1, *bb2 = NULL, *cc = NULL, *dd = NULL;
+  SEXP R_A, R_B1, R_B2, R_C, R_D, R_Ad, R_Cd, R_densetype;
+  double  *A, *bb1, *bb2 = NULL, *cc = NULL;
+  rk_dense dn = {0, 0, 5, 0, NULL, NULL, NULL};
 
   PROTECT(R_A = getListElement(Method, "A")); incr_N_Protect();
   A = REAL(R_A);
@@ -72,27 +77,39 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   PROTECT(R_C = getListElement(Method, "c")); incr_N_Protect();
   if (length(R_C)) cc = REAL(R_C);
 
-  PROTECT(R_D = getListElement(Method, "d")); incr_N_Protect();
-  if (length(R_D)) dd = REAL(R_D);
-
   /* dense output Cash-Karp: densetype = 2 */
   int densetype = 0;
   PROTECT(R_densetype = getListElement(Method, "densetype")); incr_N_Protect();
   if (length(R_densetype)) densetype = INTEGER(R_densetype)[0];
 
-  double  qerr = REAL(getListElement(Method, "Qerr"))[0];
-  double  beta = 0;      /* 0.4/qerr; */
+  /* continuous extension (densetype = 1): weights d, one column per
+     coefficient vector, and the additional stages Ad, cd (see rk_dense) */
+  PROTECT(R_D = getListElement(Method, "d")); incr_N_Protect();
+  PROTECT(R_Ad = getListElement(Method, "Ad")); incr_N_Protect();
+  PROTECT(R_Cd = getListElement(Method, "cd")); incr_N_Protect();
+  if (densetype == 1) {
+    if (!length(R_D)) error("densetype = 1 needs the weights 'd'");
+    dn.d      = REAL(R_D);
+    dn.ndense = (isMatrix(R_D)) ? nrows(R_D) : length(R_D);
+    dn.nr     = 4 + length(R_D) / dn.ndense;
+    dn.nextra = length(R_Cd);
+    if (dn.nextra) {
+      dn.Ad = REAL(R_Ad);
+      dn.cd = REAL(R_Cd);
+    }
+  }
 
-  PROTECT(Beta = getListElement(Method, "beta")); incr_N_Protect();
-  if (length(Beta)) beta = REAL(Beta)[0];
+  double  qerr = REAL(getListElement(Method, "Qerr"))[0];
 
-  double  alpha = 1/qerr - 0.75 * beta;
-  PROTECT(Alpha = getListElement(Method, "alpha")); incr_N_Protect();
-  if (length(Alpha)) alpha = REAL(Alpha)[0];
+  /* step size controller and its parameters */
+  rkcontrol_init(&ctl, Method, qerr);
 
   PROTECT(R_FSAL = getListElement(Method, "FSAL")); incr_N_Protect();
   if (length(R_FSAL)) fsal = INTEGER(R_FSAL)[0];
 
+  /* unrolled kernel if the tableau is one of the built-in methods */
+  int kernel = rk_kernelid(Method, TRUE, stage, A, bb1, bb2, cc);
+
   PROTECT(Times = AS_NUMERIC(Times)); incr_N_Protect();
   tt = NUMERIC_POINTER(Times);
   nt = length(Times);
@@ -158,8 +175,9 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   y   =  (double*) R_alloc(neq, sizeof(double));
   Fj  =  (double*) R_alloc(neq, sizeof(double));
   tmp =  (double*) R_alloc(neq, sizeof(double));
-  FF  =  (double*) R_alloc(neq * stage, sizeof(double));
-  rr  =  (double*) R_alloc(neq * 5, sizeof(double));
+  FF  =  (double*) R_alloc(neq * ((dn.ndense > stage) ? dn.ndense : stage),
+                           sizeof(double));
+  rr  =  (double*) R_alloc(neq * dn.nr, sizeof(double));
 
   /* matrix for polynomial interpolation */
   SEXP R_nknots;
@@ -192,24 +210,84 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   /*------------------------------------------------------------------------*/
   PROTECT(Y = allocVector(REALSXP,(neq)));        incr_N_Protect(); 
   
+  /* environment for R event functions */
+  R_envir = (isNull(Rho)) ? R_GlobalEnv : Rho;
+
   initParms(Initfunc, Parms);
   isForcing = initForcings(Flist);
-  isEvent = initEvents(elist, eventfunc, 0);
-  if (isEvent) interpolate = FALSE;
+  isEvent = initEvents(elist, eventfunc, nroot);
+  n_eq = neq;                     /* for events and time lags */
+  ndensecoef = dn.nr;
+  isLag = initLags(Lags, 11, 0);
+
+  /*------------------------------------------------------------------------*/
+  /* automatic switching to a Rosenbrock method in stiff phases             */
+  /*------------------------------------------------------------------------*/
+  rk_switch sw;
+  SEXP R_switch;
+  sw.on = FALSE;
+  PROTECT(R_switch = getListElement(Method, "stiffswitch")); incr_N_Protect();
+  if (length(R_switch) && LOGICAL(R_switch)[0]) {
+    if (cc == NULL || !rk_stiffstages(stage, cc, &sw.ist1, &sw.ist2))
+      warning("stiffness detection needs two stages with equal 'c', no switching");
+    else if (isLag || (interpolate && (densetype == 0 || densetype == 2)))
+      warning("no stiff switching with lags, 'nknots' or densetype = 2");
+    else if ((double) neq * neq * sizeof(double) > 1e9)
+      warning("too many state variables for a full Jacobian, no stiff switching");
+    else
+      sw.on = TRUE;
+  }
+  sw.stiff = FALSE; sw.fstiff = FALSE; sw.jacok = FALSE;
+  sw.nstiff = 0; sw.nonstiff = 0; sw.nswitch = 0;
+  sw.njac = 0; sw.nlu = 0; sw.nfun = 0; sw.nstep = 0;
+  sw.qerr = qerr; sw.hlamb = 0; sw.tswitch = NA_REAL;
+  sw.ros = &ros2; sw.pure = FALSE;
+  sw.Jacfunc = R_NilValue; sw.banded = FALSE; sw.ml = 0; sw.mu = 0;
+  if (sw.on) {
+    sw.bound = rk_stabbound(stage, A, bb2);
+    sw.J    = (double*) R_alloc((size_t) neq * neq, sizeof(double));
+    sw.M    = (double*) R_alloc((size_t) neq * neq, sizeof(double));
+    sw.U    = (double*) R_alloc(neq * sw.ros->stage, sizeof(double));
+    sw.ft   = (double*) R_alloc(neq, sizeof(double));
+    sw.ysti = (double*) R_alloc(neq, sizeof(double));
+    sw.ftmp = (double*) R_alloc(neq, sizeof(double));
+    sw.ipvt = (int*)    R_alloc(neq, sizeof(int));
+  }
 
   /*------------------------------------------------------------------------*/
   /* Initialization of Integration Loop                                     */
   /*------------------------------------------------------------------------*/
   yout[0]   = tt[0];              /* initial time                 */
-  yknots[0] = tt[0];              /* for polynomial interpolation */
   for (i = 0; i < neq; i++) {
     y0[i]        = xs[i];         /* initial values               */
     yout[(i + 1) * nt] = y0[i];   /* output array                 */
-    yknots[iknots + nknots * (i + 1)] = xs[i]; /* for polynomials */
   }
+  t = tt[0];
+  /* an event at the initial time changes the state after the first output;
+     later events are located by rk_auto */
+  if (isEvent && interpolate) updateevent(&t, y0, istate);
+
+  /* root finding: values of the root functions at the start of each step */
+  if (nroot > 0) {
+    jroot = (int *)    R_alloc(nroot, sizeof(int));
+    gold  = (double *) R_alloc(nroot, sizeof(double));
+    gnew  = (double *) R_alloc(nroot, sizeof(double));
+    for (i = 0; i < nroot; i++) jroot[i] = 0;
+    rootvalue(Rootfunc, Rho, tt[0], y0, gold, neq, nroot, isDll);
+  }
+
+  yknots[0] = tt[0];              /* for polynomial interpolation */
+  for (i = 0; i < neq; i++)
+    yknots[iknots + nknots * (i + 1)] = y0[i];
   iknots++;
 
-  t = tt[0];
+  /* history of delay differential equations starts with the initial state */
+  if (isLag) {
+    derivs(Func, tt[0], y0, Parms, Rho, dy1, out, 0, neq, ipar, isDll, 
+           isForcing);
+    updatehistini(tt[0], y0, dy1, NULL, NULL);
+  }
+
   tmax = fmax(tt[nt - 1], tcrit);
   dt   = fmin(hmax, hini);
   hmax = fmin(hmax, tmax - t);
@@ -229,6 +307,7 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   /*------------------------------------------------------------------------*/
   it     = 1; /* step counter; zero element is initial state   */
   it_ext = 0; /* counter for external time step (dense output) */
+  if (isEvent && nt > 1) it_ext = 1; /* keep the state before the event */
   it_tot = 0; /* total number of time steps                    */
   it_rej = 0;
   
@@ -236,14 +315,14 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   /* integrate over the whole time step and interpolate internally */
     rk_auto(
       fsal, neq, stage, isDll, isForcing, verbose, nknots, interpolate, 
-      densetype, maxsteps, nt,
+      densetype, maxsteps, nt, nroot, isEvent, isLag, kernel,
       &iknots, &it, &it_ext, &it_tot, &it_rej,
-      istate, ipar, 
-      t, tmax, hmin, hmax, alpha, beta,
-      &dt, &errold,
+      istate, ipar, &iroot, jroot,
+      t, tmax, hmin, hmax,
+      &dt, &ctl, &sw, &dn,
       tt, y0, y1, y2, dy1, dy2, f, y, Fj, tmp, FF, rr, A,
-      out, bb1, bb2, cc, dd, atol, rtol, yknots, yout,
-      Func, Parms, Rho
+      out, bb1, bb2, cc, atol, rtol, yknots, yout, gold, gnew,
+      Func, Parms, Rho, Rootfunc
     );
   } else {  
      /* integrate separately between external time steps; do not interpolate */
@@ -255,17 +334,19 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
          updateevent(&t, y0, istate);
        }
        if (verbose) Rprintf("\n %d th time interval = %g ... %g", j, t, tmax);
+       it_ext = j + 1; /* output position if a root stops the simulation */
        rk_auto(
           fsal, neq, stage, isDll, isForcing, verbose, nknots, interpolate, 
-          densetype, maxsteps, nt,
+          densetype, maxsteps, nt, nroot, isEvent, isLag, kernel,
           &iknots, &it, &it_ext, &it_tot, &it_rej,
-          istate, ipar,
-          t,  tmax, hmin, hmax, alpha, beta,
-          &dt, &errold,
+          istate, ipar, &iroot, jroot,
+          t,  tmax, hmin, hmax,
+          &dt, &ctl, &sw, &dn,
           tt, y0, y1, y2, dy1, dy2, f, y, Fj, tmp, FF, rr, A,
-          out, bb1, bb2, cc, dd, atol, rtol, yknots, yout,
-          Func, Parms, Rho
+          out, bb1, bb2, cc, atol, rtol, yknots, yout, gold, gnew,
+          Func, Parms, Rho, Rootfunc
       );
+      if (istate[0] <= -20) break;  /* stopped at a root */
       /* in this mode, internal interpolation is skipped,
          so we can simply store the results at the end of each call */
       yout[j + 1] = tmax;
@@ -273,6 +354,22 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
     }
   }
 
+  /*====================================================================*/
+  /* simulation stopped at a root: remove the outputs after the root    */
+  /*====================================================================*/
+  int rootstop = istate[0];
+  if (istate[0] <= -20) {
+    SEXP R_yout2;
+    int nt2 = (it_ext + 1 < nt) ? it_ext + 1 : nt;
+    PROTECT(R_yout2 = allocMatrix(REALSXP, nt2, neq + nout + 1)); incr_N_Protect();
+    for (j = 0; j < neq + nout + 1; j++)
+      for (i = 0; i < nt2; i++) REAL(R_yout2)[i + nt2 * j] = yout[i + nt * j];
+    R_yout = R_yout2;
+    yout = REAL(R_yout);
+    nt = nt2;
+    istate[0] = 3;   /* as in lsodar: a root was found */
+  }
+
   /*====================================================================*/
   /* call derivs again to get global outputs                            */
   /* j = -1 suppresses unnecessary internal copying                     */
@@ -291,6 +388,44 @@ SEXP call_rkAuto(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   /* attach diagnostic information (codes are compatible to lsoda) */
   setIstate(R_yout, R_istate, istate, it_tot, stage, fsal, qerr, it_rej);
   if (densetype == 2)   istate[12] = it_tot * stage + 2; /* number of function evaluations */
+  istate[12] += dn.nfun;  /* additional stages of the dense output */
+  if (sw.on) {
+    /* Jacobians, LU decompositions and methods as in lsoda: 1 = explicit */
+    istate[12] += sw.nfun - sw.nstep * (stage - fsal);
+    istate[3]  = sw.njac;
+    istate[9]  = sw.nlu;
+    istate[16] = (sw.fstiff) ? 2 : 1;
+    istate[17] = (sw.stiff) ? 2 : 1;
+  }
+  rkcontrol_rstate(R_yout, &ctl, dt, tt[0], sw.tswitch);
+  /* stopped at a root: the time reached is the root */
+  if (rootstop <= -20)
+    REAL(getAttrib(R_yout, install("rstate")))[2] = yout[nt - 1];
+
+  /* root information, similar to lsodar */
+  if (rootstop == -20) {
+    SEXP R_iroot, R_troot;
+    PROTECT(R_iroot = allocVector(INTSXP, nroot)); incr_N_Protect();
+    for (i = 0; i < nroot; i++) INTEGER(R_iroot)[i] = jroot[i];
+    setAttrib(R_yout, install("iroot"), R_iroot);
+    PROTECT(R_troot = ScalarReal(yout[nt - 1])); incr_N_Protect();
+    setAttrib(R_yout, install("troot"), R_troot);
+  }
+  if (iroot > 0) {   /* roots that triggered events */
+    SEXP R_nroot, R_troot, R_vroot, R_iroot;
+    PROTECT(R_nroot = ScalarInteger(iroot)); incr_N_Protect();
+    if (iroot > Rootsave) iroot = Rootsave;
+    PROTECT(R_troot = allocVector(REALSXP, iroot)); incr_N_Protect();
+    for (i = 0; i < iroot; i++) REAL(R_troot)[i] = troot[i];
+    PROTECT(R_vroot = allocVector(REALSXP, iroot * neq)); incr_N_Protect();
+    for (i = 0; i < iroot * neq; i++) REAL(R_vroot)[i] = valroot[i];
+    PROTECT(R_iroot = allocVector(INTSXP, iroot)); incr_N_Protect();
+    for (i = 0; i < iroot; i++) INTEGER(R_iroot)[i] = nrroot[i];
+    setAttrib(R_yout, install("troot"), R_troot);
+    setAttrib(R_yout, install("nroot"), R_nroot);
+    setAttrib(R_yout, install("valroot"), R_vroot);
+    setAttrib(R_yout, install("indroot"), R_iroot);
+  }
 
   /* verbose printing in debugging mode*/
   if (verbose) 
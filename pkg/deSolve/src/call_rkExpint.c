@@ -0,0 +1,245 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >=2                  */
+/* Exponential Rosenbrock solver with Krylov phi-functions                  */
+/*==========================================================================*/
+
+#include "rk_util.h"
+#include <string.h>
+
+SEXP call_rkExpint(SEXP Xstart, SEXP Times, SEXP Func, SEXP Linfunc,
+  SEXP Initfunc, SEXP Parms, SEXP eventfunc, SEXP elist, SEXP Nout, SEXP Rho,
+  SEXP Atol, SEXP Rtol, SEXP Tcrit, SEXP Verbose,
+  SEXP Hmin, SEXP Hmax, SEXP Hini, SEXP Rpar, SEXP Ipar,
+  SEXP Method, SEXP Maxsteps, SEXP Flist, SEXP Krylov) {
+
+  /**  Initialization **/
+  long int old_N_Protect = save_N_Protected();
+
+  double *tt = NULL, *xs = NULL;
+
+  SEXP  R_yout;
+  double *y0, *y1, *f0, *f1, *U, *D, *W, *err, *sc;
+  double *out, *yout;
+
+  double t, dt, tmax;
+  rk_control ctl;
+  expint_work ew;
+
+  int i = 0, j = 0, it = 0, it_tot = 0, it_rej = 0, nt = 0, neq = 0;
+  int isForcing, isEvent, ievent = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* Processing of Arguments                                                */
+  /*------------------------------------------------------------------------*/
+  double  tcrit = REAL(Tcrit)[0];
+  double  hmin  = REAL(Hmin)[0];
+  double  hmax  = REAL(Hmax)[0];
+  double  hini  = REAL(Hini)[0];
+  int  maxsteps = INTEGER(Maxsteps)[0];
+  int  nout     = INTEGER(Nout)[0]; /* number of global outputs if func is in a DLL */
+  int  verbose  = INTEGER(Verbose)[0];
+
+  /* method and step size controller; the error estimate is of the
+     embedded method, one order lower                                     */
+  const char *method = CHAR(STRING_ELT(getListElement(Method, "ID"), 0));
+  if (strcmp(method, "exprb32") == 0)      ew.order = 3;
+  else if (strcmp(method, "exprb43") == 0) ew.order = 4;
+  else error("unknown exponential method '%s'", method);
+  double qerr = ew.order - 1;
+  rkcontrol_init(&ctl, Method, qerr);
+
+  ew.mmax = INTEGER(Krylov)[0];
+  if (ew.mmax < 1) error("the dimension of the Krylov space must be positive");
+
+  double *atol = REAL(Atol), *rtol = REAL(Rtol);
+
+  PROTECT(Times = AS_NUMERIC(Times)); incr_N_Protect();
+  tt = NUMERIC_POINTER(Times);
+  nt = length(Times);
+
+  PROTECT(Xstart = AS_NUMERIC(Xstart)); incr_N_Protect();
+  xs  = NUMERIC_POINTER(Xstart);
+  neq = length(Xstart);
+
+  if (LENGTH(Atol) < neq || LENGTH(Rtol) < neq)
+    error("length of atol and rtol must be equal to the number of states");
+
+  /*------------------------------------------------------------------------*/
+  /* timesteps (for advection computation in ReacTran)                      */
+  /*------------------------------------------------------------------------*/
+  for (i = 0; i < 2; i++) timesteps[i] = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* DLL, ipar, rpar (for compatibility with lsoda)                         */
+  /*------------------------------------------------------------------------*/
+  int isDll = FALSE;
+  int lrpar= 0, lipar = 0;
+  int *ipar = NULL;
+
+  if (inherits(Func, "NativeSymbol")) {
+    /* function is a dll */
+    isDll = TRUE;
+    if (nout > 0) isOut = TRUE;
+    lrpar = nout + LENGTH(Rpar);  /* length of rpar; LENGTH(Rpar) is always >0 */
+    lipar = 3    + LENGTH(Ipar);  /* length of ipar */
+  } else {
+    /* function is not a dll */
+    isDll = FALSE;
+    isOut = FALSE;
+    lipar = 3;
+    lrpar = nout;
+  }
+  out   = (double*) R_alloc(lrpar, sizeof(double));
+  ipar  = (int *) R_alloc(lipar, sizeof(int));
+
+  /* first 3 elements of ipar are special */
+  ipar[0] = nout;
+  ipar[1] = lrpar;
+  ipar[2] = lipar;
+  if (isDll == 1) {
+    for (j = 0; j < LENGTH(Ipar); j++) ipar[j+3] = INTEGER(Ipar)[j];
+    for (j = 0; j < nout; j++)         out[j] = 0.0;
+    for (j = 0; j < LENGTH(Rpar); j++) out[nout+j] = REAL(Rpar)[j];
+  }
+
+  /*------------------------------------------------------------------------*/
+  /* Allocation of Workspace: stages, the Krylov basis (at most 4 extra     */
+  /* components and dimensions) and the small projected matrices            */
+  /*------------------------------------------------------------------------*/
+  int mdim = ew.mmax + 5;
+  y0   = (double*) R_alloc(neq, sizeof(double));
+  y1   = (double*) R_alloc(neq, sizeof(double));
+  f0   = (double*) R_alloc(neq, sizeof(double));
+  f1   = (double*) R_alloc(neq, sizeof(double));
+  U    = (double*) R_alloc(neq, sizeof(double));
+  D    = (double*) R_alloc(2 * neq, sizeof(double));
+  W    = (double*) R_alloc(2 * neq, sizeof(double));
+  err  = (double*) R_alloc(neq, sizeof(double));
+  sc   = (double*) R_alloc(neq, sizeof(double));
+
+  ew.neq   = neq;
+  ew.fn    = (double*) R_alloc(neq, sizeof(double));
+  ew.fv    = (double*) R_alloc(neq, sizeof(double));
+  ew.ytmp  = (double*) R_alloc(neq, sizeof(double));
+  ew.ftmp  = (double*) R_alloc(neq, sizeof(double));
+  ew.V     = (double*) R_alloc(mdim * (neq + 4), sizeof(double));
+  ew.x     = (double*) R_alloc(neq + 4, sizeof(double));
+  ew.H     = (double*) R_alloc(mdim * mdim, sizeof(double));
+  ew.E     = (double*) R_alloc(mdim * mdim, sizeof(double));
+  ew.ework = (double*) R_alloc(5 * mdim * mdim, sizeof(double));
+  ew.ipvt  = (int*)    R_alloc(mdim, sizeof(int));
+  ew.nfun = 0; ew.nmv = 0; ew.nkry = 0; ew.nksub = 0;
+
+  /* matrix for holding states and global outputs */
+  PROTECT(R_yout = allocMatrix(REALSXP, nt, neq + nout + 1)); incr_N_Protect();
+  yout = REAL(R_yout);
+  /* initialize outputs with NA first */
+  for (i = 0; i < nt * (neq + nout + 1); i++) yout[i] = NA_REAL;
+
+  /* attribute that stores state information, similar to lsoda */
+  SEXP R_istate;
+  int *istate;
+  PROTECT(R_istate = allocVector(INTSXP, 22)); incr_N_Protect();
+  istate = INTEGER(R_istate);
+  for (i = 0; i < 22; i++) istate[i] = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* Initialization of Parameters (for DLL functions)                       */
+  /*------------------------------------------------------------------------*/
+  PROTECT(Y = allocVector(REALSXP,(neq)));        incr_N_Protect();
+
+  /* environment for R event functions */
+  R_envir = (isNull(Rho)) ? R_GlobalEnv : Rho;
+
+  initParms(Initfunc, Parms);
+  isForcing = initForcings(Flist);
+  isEvent = initEvents(elist, eventfunc, 0);
+  n_eq = neq;                     /* for events */
+
+  ew.Func = Func; ew.Linfunc = Linfunc; ew.Parms = Parms; ew.Rho = Rho;
+  ew.islin = !isNull(Linfunc);
+  ew.isDll = isDll; ew.isForcing = isForcing;
+  ew.ipar = ipar; ew.out = out;
+
+  /*------------------------------------------------------------------------*/
+  /* Initialization of Integration Loop                                     */
+  /*------------------------------------------------------------------------*/
+  yout[0]   = tt[0];              /* initial time                 */
+  for (i = 0; i < neq; i++) {
+    y0[i]        = xs[i];         /* initial values               */
+    yout[(i + 1) * nt] = y0[i];   /* output array                 */
+  }
+  t = tt[0];
+  /* an event at the initial time changes the state after the first output */
+  if (isEvent) updateevent(&t, y0, &ievent);
+
+  tmax = fmin(tt[nt - 1], tcrit);
+  hmax = fmin(hmax, tmax - t);
+
+  /* initial step size from the scaled norms of y and f(y), as in
+     rosenbrock; too large steps are rejected                              */
+  if (hini <= 0) {
+    double d0 = 0, d1 = 0, s;
+    derivs(Func, t, y0, Parms, Rho, f0, out, 0, neq, ipar, isDll, isForcing);
+    ew.nfun++;
+    if (ew.islin) {
+      derivs(Linfunc, t, y0, Parms, Rho, f1, out, 0, neq, ipar, isDll,
+             isForcing);
+      ew.nfun++;
+      for (i = 0; i < neq; i++) f0[i] += f1[i];
+    }
+    for (i = 0; i < neq; i++) {
+      s = atol[i] + rtol[i] * fabs(y0[i]);
+      d0 += (y0[i] / s) * (y0[i] / s);
+      d1 += (f0[i] / s) * (f0[i] / s);
+    }
+    hini = (d0 < 1e-10 || d1 < 1e-10) ? 1e-6 : 0.01 * sqrt(d0 / d1);
+  }
+  dt = fmax(fmin(hmax, hini), hmin);
+
+  /*------------------------------------------------------------------------*/
+  /* Main Loop                                                              */
+  /*------------------------------------------------------------------------*/
+  it     = 1; /* output counter; zero element is initial state */
+  it_tot = 0; /* total number of time steps                    */
+
+  rk_expint(verbose, maxsteps, nt, isEvent,
+    &it, &it_tot, &it_rej, istate,
+    t, tmax, hmin, hmax, &dt, &ctl, &ew,
+    tt, y0, y1, f0, f1, U, D, W, err, sc,
+    atol, rtol, yout);
+
+  /*====================================================================*/
+  /* call derivs again to get global outputs (from func)                */
+  /* j = -1 suppresses unnecessary internal copying                     */
+  /*====================================================================*/
+  if (nout > 0) {
+    for (int j = 0; j < it; j++) {
+      t = yout[j];
+      for (i = 0; i < neq; i++) y1[i] = yout[j + nt * (1 + i)];
+      derivs(Func, t, y1, Parms, Rho, f0, out, -1, neq, ipar, isDll, isForcing);
+      for (i = 0; i < nout; i++) {
+        yout[j + nt * (1 + neq + i)] = out[i];
+      }
+    }
+  }
+
+  /* attach diagnostic information (codes are compatible to lsoda) */
+  setIstate(R_yout, R_istate, istate, it_tot, 0, 0, ew.order, it_rej);
+  istate[12] = ew.nfun;     /* evaluations of func and linfunc */
+  istate[18] = ew.nksub;    /* additional Krylov substeps */
+  istate[19] = ew.nmv;      /* Jacobian-vector products */
+  rkcontrol_rstate(R_yout, &ctl, dt, tt[0], NA_REAL);
+
+  /* verbose printing in debugging mode*/
+  if (verbose)
+    Rprintf("\nNumber of time steps it = %d, it_tot = %d it_rej %d\n",
+      it, it_tot, it_rej);
+
+  /* release R resources */
+  timesteps[0] = 0;
+  timesteps[1] = 0;
+
+  restore_N_Protected(old_N_Protect);
+  return(R_yout);
+}
@@ -0,0 +1,228 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >=2                  */
+/* Extrapolation (Gragg-Bulirsch-Stoer) solver with dense output            */
+/*==========================================================================*/
+
+#include "rk_util.h"
+
+SEXP call_rkExtrapol(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
+  SEXP Parms, SEXP eventfunc, SEXP elist, SEXP Nout, SEXP Rho,
+  SEXP Atol, SEXP Rtol, SEXP Tcrit, SEXP Verbose,
+  SEXP Hmin, SEXP Hmax, SEXP Hini, SEXP Rpar, SEXP Ipar,
+  SEXP Method, SEXP Maxsteps, SEXP Flist) {
+
+  /**  Initialization **/
+  long int old_N_Protect = save_N_Protected();
+
+  double *tt = NULL, *xs = NULL;
+
+  SEXP  R_yout;
+  double *y0, *y1, *f0, *f1, *wt, *ytmp, *out, *yout;
+
+  double t, tmax, dt;
+
+  int i = 0, j = 0, it = 0, it_tot = 0, it_rej = 0, nt = 0, neq = 0;
+  int isForcing, isEvent, ievent = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* Processing of Arguments                                                */
+  /*------------------------------------------------------------------------*/
+  double  tcrit = REAL(Tcrit)[0];
+  double  hmin  = REAL(Hmin)[0];
+  double  hmax  = REAL(Hmax)[0];
+  double  hini  = REAL(Hini)[0];
+  int  maxsteps = INTEGER(Maxsteps)[0];
+  int  nout     = INTEGER(Nout)[0]; /* number of global outputs if func is in a DLL */
+  int  verbose  = INTEGER(Verbose)[0];
+
+  gbs_work g;
+  g.kmax     = INTEGER(getListElement(Method, "kmax"))[0];
+  g.nthreads = INTEGER(getListElement(Method, "nthreads"))[0];
+  if (g.kmax < 3) error("extrapolation method needs 'kmax' >= 3");
+
+  int lAtol = LENGTH(Atol), lRtol = LENGTH(Rtol);
+  double *atol = REAL(Atol), *rtol = REAL(Rtol);
+
+  PROTECT(Times = AS_NUMERIC(Times)); incr_N_Protect();
+  tt = NUMERIC_POINTER(Times);
+  nt = length(Times);
+
+  PROTECT(Xstart = AS_NUMERIC(Xstart)); incr_N_Protect();
+  xs  = NUMERIC_POINTER(Xstart);
+  neq = length(Xstart);
+
+  if (lAtol < neq || lRtol < neq)
+    error("length of atol and rtol must be equal to the number of states");
+
+  /*------------------------------------------------------------------------*/
+  /* timesteps (for advection computation in ReacTran)                      */
+  /*------------------------------------------------------------------------*/
+  for (i = 0; i < 2; i++) timesteps[i] = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* DLL, ipar, rpar (for compatibility with lsoda)                         */
+  /*------------------------------------------------------------------------*/
+  int isDll = FALSE;
+  int lrpar= 0, lipar = 0;
+  int *ipar = NULL;
+
+  if (inherits(Func, "NativeSymbol")) {
+    /* function is a dll */
+    isDll = TRUE;
+    if (nout > 0) isOut = TRUE;
+    lrpar = nout + LENGTH(Rpar);  /* length of rpar; LENGTH(Rpar) is always >0 */
+    lipar = 3    + LENGTH(Ipar);  /* length of ipar */
+  } else {
+    /* function is not a dll */
+    isDll = FALSE;
+    isOut = FALSE;
+    lipar = 3;
+    lrpar = nout;
+  }
+  out   = (double*) R_alloc(lrpar, sizeof(double));
+  ipar  = (int *) R_alloc(lipar, sizeof(int));
+
+  /* first 3 elements of ipar are special */
+  ipar[0] = nout;
+  ipar[1] = lrpar;
+  ipar[2] = lipar;
+  if (isDll == 1) {
+    for (j = 0; j < LENGTH(Ipar); j++) ipar[j+3] = INTEGER(Ipar)[j];
+    for (j = 0; j < nout; j++)         out[j] = 0.0;
+    for (j = 0; j < LENGTH(Rpar); j++) out[nout+j] = REAL(Rpar)[j];
+  }
+
+  /*------------------------------------------------------------------------*/
+  /* Allocation of Workspace: step numbers, work and table of the columns,  */
+  /* the derivatives of all internal steps for dense output and the work    */
+  /* space of each thread with a copy of out/rpar                           */
+  /*------------------------------------------------------------------------*/
+  int km = g.kmax;
+  g.nj     = (int*) R_alloc(km + 2, sizeof(int));
+  g.ipt    = (int*) R_alloc(km + 2, sizeof(int));
+  g.ncol   = (int*) R_alloc(km + 2, sizeof(int));
+  g.done   = (int*) R_alloc(km + 2, sizeof(int));
+  g.stable = (int*) R_alloc(km + 2, sizeof(int));
+  g.aw     = (double*) R_alloc(km + 2, sizeof(double));
+  g.hh     = (double*) R_alloc(km + 2, sizeof(double));
+  g.w      = (double*) R_alloc(km + 2, sizeof(double));
+  g.ipt[1] = 0;
+  for (j = 1; j <= km; j++) {
+    g.nj[j]      = 4 * j - 2;
+    g.ipt[j + 1] = g.ipt[j] + g.nj[j] + 1;
+    g.aw[j]      = (j == 1) ? g.nj[1] + 1 : g.aw[j - 1] + g.nj[j];
+    g.hh[j]      = 0;
+    g.w[j]       = 0;
+    g.ncol[j]    = 0;
+  }
+  g.T     = (double*) R_alloc(km * neq, sizeof(double));
+  g.ysafe = (double*) R_alloc(km * neq, sizeof(double));
+  g.fsafe = (double*) R_alloc(g.ipt[km + 1] * neq, sizeof(double));
+  g.dens  = (double*) R_alloc((2 * km + 2) * neq, sizeof(double));
+
+  g.kc = 2; g.mu = 1; g.nfun = 0;
+
+  y0   = (double*) R_alloc(neq, sizeof(double));
+  y1   = (double*) R_alloc(neq, sizeof(double));
+  f0   = (double*) R_alloc(neq, sizeof(double));
+  f1   = (double*) R_alloc(neq, sizeof(double));
+  wt   = (double*) R_alloc(neq, sizeof(double));
+  ytmp = (double*) R_alloc(neq, sizeof(double));
+
+  /* matrix for holding states and global outputs */
+  PROTECT(R_yout = allocMatrix(REALSXP, nt, neq + nout + 1)); incr_N_Protect();
+  yout = REAL(R_yout);
+  /* initialize outputs with NA first */
+  for (i = 0; i < nt * (neq + nout + 1); i++) yout[i] = NA_REAL;
+
+  /* attribute that stores state information, similar to lsoda */
+  SEXP R_istate;
+  int *istate;
+  PROTECT(R_istate = allocVector(INTSXP, 22)); incr_N_Protect();
+  istate = INTEGER(R_istate);
+  for (i = 0; i < 22; i++) istate[i] = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* Initialization of Parameters (for DLL functions)                       */
+  /*------------------------------------------------------------------------*/
+  PROTECT(Y = allocVector(REALSXP,(neq)));        incr_N_Protect();
+
+  /* environment for R event functions */
+  R_envir = (isNull(Rho)) ? R_GlobalEnv : Rho;
+
+  initParms(Initfunc, Parms);
+  isForcing = initForcings(Flist);
+  isEvent = initEvents(elist, eventfunc, 0);
+  n_eq = neq;                     /* for events */
+
+  /* R functions and forcings (global values of the time) are never
+     evaluated in several threads */
+  if (!isDll || isForcing || g.nthreads < 1) g.nthreads = 1;
+#ifndef _OPENMP
+  g.nthreads = 1;
+#endif
+  if (g.nthreads > km) g.nthreads = km;
+  g.lwork = 3 * neq + lrpar;
+  g.work  = (double*) R_alloc(g.nthreads * g.lwork, sizeof(double));
+  for (j = 1; j < g.nthreads; j++)
+    for (i = 0; i < lrpar; i++) g.work[j * g.lwork + 3 * neq + i] = out[i];
+
+  /*------------------------------------------------------------------------*/
+  /* Initialization of Integration Loop                                     */
+  /*------------------------------------------------------------------------*/
+  yout[0]   = tt[0];              /* initial time                 */
+  for (i = 0; i < neq; i++) {
+    y0[i]        = xs[i];         /* initial values               */
+    yout[(i + 1) * nt] = y0[i];   /* output array                 */
+  }
+  t = tt[0];
+  /* an event at the initial time changes the state after the first output */
+  if (isEvent) updateevent(&t, y0, &ievent);
+
+  tmax = fmin(tt[nt - 1], tcrit);
+  dt   = hini;
+
+  /*------------------------------------------------------------------------*/
+  /* Main Loop                                                              */
+  /*------------------------------------------------------------------------*/
+  it     = 1; /* output counter; zero element is initial state */
+  it_tot = 0; /* total number of time steps                    */
+
+  rk_extrapol(neq, isDll, isForcing, verbose, maxsteps, nt, isEvent,
+    &it, &it_tot, &it_rej, istate, ipar,
+    t, tmax, hmin, hmax, &dt, &g,
+    tt, y0, y1, f0, f1, wt, ytmp, out, atol, rtol, yout,
+    Func, Parms, Rho);
+
+  /*====================================================================*/
+  /* call derivs again to get global outputs                            */
+  /* j = -1 suppresses unnecessary internal copying                     */
+  /*====================================================================*/
+  if (nout > 0) {
+    for (int j = 0; j < it; j++) {
+      t = yout[j];
+      for (i = 0; i < neq; i++) ytmp[i] = yout[j + nt * (1 + i)];
+      derivs(Func, t, ytmp, Parms, Rho, f0, out, -1, neq, ipar, isDll, isForcing);
+      for (i = 0; i < nout; i++) {
+        yout[j + nt * (1 + neq + i)] = out[i];
+      }
+    }
+  }
+
+  /* attach diagnostic information (codes are compatible to lsoda);
+     the order is that of the last accepted step                         */
+  setIstate(R_yout, R_istate, istate, it_tot, 0, 0, 2 * g.kc, it_rej);
+  istate[12] = g.nfun;
+
+  /* verbose printing in debugging mode*/
+  if (verbose)
+    Rprintf("\nNumber of time steps it = %d, it_tot = %d it_rej %d\n",
+      it, it_tot, it_rej);
+
+  /* release R resources */
+  timesteps[0] = 0;
+  timesteps[1] = 0;
+
+  restore_N_Protected(old_N_Protect);
+  return(R_yout);
+}
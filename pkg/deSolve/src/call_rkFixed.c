@@ -38,17 +38,37 @@ SEXP call_rkFixed(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
 
   int stage     = (int)REAL(getListElement(Method, "stage"))[0];
 
-  SEXP R_A, R_B1, R_C;
-  double  *A, *bb1, *cc=NULL;
+  SEXP R_A, R_B1, R_C, R_symp;
+  double  *A = NULL, *bb1 = NULL, *cc=NULL;
+  int kernel = 0;
+
+  /* symplectic composition methods: drift (a) and kick (b) coefficients
+     of a model with positions and velocities instead of a Butcher table */
+  int symplectic = FALSE, velocity = FALSE, nfun = 0;
+  PROTECT(R_symp = getListElement(Method, "symplectic")); incr_N_Protect();
+  if (length(R_symp) && LOGICAL(R_symp)[0]) {
+    symplectic = TRUE;
+    PROTECT(R_A = getListElement(Method, "a")); incr_N_Protect();
+    A = REAL(R_A);
+    PROTECT(R_B1 = getListElement(Method, "b")); incr_N_Protect();
+    bb1 = REAL(R_B1);
+    if (length(R_A) != stage || length(R_B1) != stage + 1)
+      error("symplectic method needs 'stage' drifts 'a' and 'stage' + 1 kicks 'b'");
+    PROTECT(R_symp = getListElement(Method, "velocity")); incr_N_Protect();
+    velocity = length(R_symp) && LOGICAL(R_symp)[0];
+  } else {
+    PROTECT(R_A = getListElement(Method, "A")); incr_N_Protect();
+    A = REAL(R_A);
 
-  PROTECT(R_A = getListElement(Method, "A")); incr_N_Protect();
-  A = REAL(R_A);
+    PROTECT(R_B1 = getListElement(Method, "b1")); incr_N_Protect();
+    bb1 = REAL(R_B1);
 
-  PROTECT(R_B1 = getListElement(Method, "b1")); incr_N_Protect();
-  bb1 = REAL(R_B1);
+    PROTECT(R_C = getListElement(Method, "c")); incr_N_Protect();
+    if (length(R_C)) cc = REAL(R_C);
 
-  PROTECT(R_C = getListElement(Method, "c")); incr_N_Protect();
-  if (length(R_C)) cc = REAL(R_C);
+    /* unrolled kernel if the tableau is one of the built-in methods */
+    kernel = rk_kernelid(Method, FALSE, stage, A, bb1, NULL, cc);
+  }
   
   double  qerr  = REAL(getListElement(Method, "Qerr"))[0];
 
@@ -59,6 +79,8 @@ SEXP call_rkFixed(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   PROTECT(Xstart = AS_NUMERIC(Xstart)); incr_N_Protect();
   xs  = NUMERIC_POINTER(Xstart);
   neq = length(Xstart);
+  if (symplectic && neq % 2)
+    error("symplectic methods need positions and velocities, an even number of states");
 
   /*------------------------------------------------------------------------*/
   /* timesteps (for advection computation in ReacTran)                      */
@@ -151,7 +173,7 @@ SEXP call_rkFixed(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   initParms(Initfunc, Parms);
   isForcing = initForcings(Flist);
   isEvent = initEvents(elist, eventfunc, 0);
-  if (isEvent) interpolate = FALSE;
+  if (isEvent || symplectic) interpolate = FALSE;
   
   /*------------------------------------------------------------------------*/
   /* Initialization of Integration Loop                                     */
@@ -184,11 +206,27 @@ SEXP call_rkFixed(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   it_ext = 0; /* counter for external time step (dense output) */
   it_tot = 0; /* total number of time steps                    */
 
-  if (interpolate) {
+  if (symplectic) {
+  /* constant steps hini, exactly to the output times */
+   for (int j = 0; j < nt - 1; j++) {
+       t = tt[j];
+       tmax = fmin(tt[j + 1], tcrit);
+       if (isEvent) {
+         updateevent(&t, y0, istate);
+       }
+       /* the last row holds the time reached if maxsteps was exceeded;
+          the rows after it remain NA */
+       yout[j + 1] = rk_symplectic(neq, stage, velocity, isDll, isForcing,
+         verbose, maxsteps, &it_tot, &nfun, istate, ipar, t, tmax, hini,
+         y0, f, A, bb1, out, Func, Parms, Rho);
+       for (i = 0; i < neq; i++) yout[j + 1 + nt * (1 + i)] = y0[i];
+       if (istate[0] == -1) break;
+    }
+  } else if (interpolate) {
   /* integrate over the whole time step and interpolate internally */
     rk_fixed(
          fsal, neq, stage, isDll, isForcing, verbose, nknots, interpolate, 
-         maxsteps, nt,
+         maxsteps, nt, kernel,
          &iknots, &it, &it_ext, &it_tot,
          istate, ipar,
          t, tmax, hini,
@@ -208,7 +246,7 @@ SEXP call_rkFixed(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
        }
        rk_fixed(
          fsal, neq, stage, isDll, isForcing, verbose, nknots, interpolate, 
-         maxsteps, nt,
+         maxsteps, nt, kernel,
          &iknots, &it, &it_ext, &it_tot,
          istate, ipar,
          t, tmax, fmin(hini, fabs(dt)) * sign(dt),      // <----- hini for backward steps (still experimental)
@@ -231,6 +269,7 @@ SEXP call_rkFixed(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   if(nout > 0) {
     for (int j = 0; j < nt; j++) {
       t = yout[j];
+      if (ISNAN(t)) break;  /* stopped early */
       for (i = 0; i < neq; i++) tmp[i] = yout[j + nt * (1 + i)];
       derivs(Func, t, tmp, Parms, Rho, FF, out, -1, neq, ipar, isDll, isForcing);
       for (i = 0; i < nout; i++) {
@@ -241,6 +280,7 @@ SEXP call_rkFixed(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
 
   /* attach diagnostic information (codes are compatible to lsoda) */
   setIstate(R_yout, R_istate, istate, it_tot, stage, fsal, qerr, 0);
+  if (symplectic) istate[12] = nfun;
 
   /* verbose printing in debugging mode*/
   if (verbose) {
@@ -56,6 +56,13 @@ SEXP call_rkImplicit(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
   
     double  qerr  = REAL(getListElement(Method, "Qerr"))[0];
 
+  /* tolerance of the Newton iteration; Gauss methods need a solution to
+     round-off to be symplectic */
+  double tol = 1e-8;
+  SEXP R_tol;
+  PROTECT(R_tol = getListElement(Method, "tol")); incr_N_Protect();
+  if (length(R_tol)) tol = REAL(R_tol)[0];
+
   PROTECT(Times = AS_NUMERIC(Times)); incr_N_Protect();
   tt = NUMERIC_POINTER(Times);
   nt = length(Times);
@@ -202,7 +209,7 @@ SEXP call_rkImplicit(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
          maxsteps, nt,
   	     &iknots, &it, &it_ext, &it_tot,
          istate, ipar,
-  	     t, tmax, hini,
+  	     t, tmax, hini, tol,
   	     &dt,
   	     tt, y0, y1, dy1, f, y, Fj, tmp, tmp2, tmp3, FF, rr, A,
   	     out, bb1, cc, yknots,  yout,
@@ -221,7 +228,7 @@ SEXP call_rkImplicit(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
          maxsteps, nt,
   	     &iknots, &it, &it_ext, &it_tot,
          istate, ipar,
-  	     t, tmax, hini,
+  	     t, tmax, hini, tol,
   	     &dt,
   	     tt, y0, y1, dy1, f, y, Fj, tmp, tmp2, tmp3, FF, rr, A,
   	     out, bb1, cc, yknots,  yout,
@@ -0,0 +1,238 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >=2                  */
+/* Low-storage (2N) RK Solver for large systems                             */
+/*==========================================================================*/
+
+#include "rk_util.h"
+
+SEXP call_rkLowStorage(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
+  SEXP Parms, SEXP eventfunc, SEXP elist, SEXP Nout, SEXP Rho,
+  SEXP Atol, SEXP Rtol, SEXP Tcrit, SEXP Verbose,
+  SEXP Hmin, SEXP Hmax, SEXP Hini, SEXP Rpar, SEXP Ipar,
+  SEXP Method, SEXP Maxsteps, SEXP Flist) {
+
+  /**  Initialization **/
+  long int old_N_Protect = save_N_Protected();
+
+  double *tt = NULL, *xs = NULL;
+
+  SEXP  R_yout;
+  double *y, *dq, *f, *err = NULL, *out, *yout;
+
+  double t, tmax;
+
+  int i = 0, j = 0, it = 0, it_tot = 0, it_rej = 0, nt = 0, neq = 0;
+  int isForcing, isEvent, ievent = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* Processing of Arguments                                                */
+  /*------------------------------------------------------------------------*/
+  double  tcrit = REAL(Tcrit)[0];
+  double  hmin  = REAL(Hmin)[0];
+  double  hmax  = REAL(Hmax)[0];
+  double  hini  = REAL(Hini)[0];
+  int  maxsteps = INTEGER(Maxsteps)[0];
+  int  nout     = INTEGER(Nout)[0]; /* number of global outputs if func is in a DLL */
+  int  verbose  = INTEGER(Verbose)[0];
+
+  int stage     = (int)REAL(getListElement(Method, "stage"))[0];
+  int varstep   = INTEGER(getListElement(Method, "varstep"))[0];
+
+  /* A and b1 are the coefficients of the 2N form, b2 the weights
+     of the embedded method in Butcher form */
+  SEXP R_A, R_B1, R_B2, R_C;
+  double  *A, *bb1, *bb2 = NULL, *cc;
+
+  PROTECT(R_A = getListElement(Method, "A")); incr_N_Protect();
+  A = REAL(R_A);
+
+  PROTECT(R_B1 = getListElement(Method, "b1")); incr_N_Protect();
+  bb1 = REAL(R_B1);
+
+  PROTECT(R_B2 = getListElement(Method, "b2")); incr_N_Protect();
+  if (length(R_B2)) bb2 = REAL(R_B2);
+
+  PROTECT(R_C = getListElement(Method, "c")); incr_N_Protect();
+  cc = REAL(R_C);
+
+  if (A[0] != 0) error("low-storage method needs A[1] = 0");
+  if (varstep && bb2 == NULL)
+    error("low-storage method with variable time step needs b2");
+  /* rejected steps are undone stage by stage, see rk_lowstorage.c */
+  for (j = 1; varstep && j < stage; j++)
+    if (A[j] == 0)
+      error("low-storage method with variable time step needs A[j] != 0 for j > 1");
+
+  double  qerr = REAL(getListElement(Method, "Qerr"))[0];
+
+  /* step size controller and its parameters */
+  rk_control ctl;
+  rkcontrol_init(&ctl, Method, qerr);
+
+  /*------------------------------------------------------------------------*/
+  /* weights of the error estimate: err = sum_j ww[j] * dq_j                */
+  /* with e = b - b2 and b the weights of the method in Butcher form        */
+  /*------------------------------------------------------------------------*/
+  double *bb = (double*) R_alloc(stage, sizeof(double));
+  double *ww = (double*) R_alloc(stage, sizeof(double));
+  for (j = 0; j < stage; j++) {
+    double p = 1.0;
+    bb[j] = 0;
+    for (int k = j; k < stage; k++) {
+      if (k > j) p *= A[k];
+      bb[j] += bb1[k] * p;
+    }
+  }
+  for (j = 0; j < stage; j++) {
+    ww[j] = 0;
+    if (!varstep) continue;
+    ww[j] = bb[j] - bb2[j];
+    if (j < stage - 1) ww[j] -= (bb[j + 1] - bb2[j + 1]) * A[j + 1];
+  }
+
+  int lAtol = LENGTH(Atol), lRtol = LENGTH(Rtol);
+  double *atol = REAL(Atol), *rtol = REAL(Rtol);
+
+  PROTECT(Times = AS_NUMERIC(Times)); incr_N_Protect();
+  tt = NUMERIC_POINTER(Times);
+  nt = length(Times);
+
+  PROTECT(Xstart = AS_NUMERIC(Xstart)); incr_N_Protect();
+  xs  = NUMERIC_POINTER(Xstart);
+  neq = length(Xstart);
+
+  if (varstep && (lAtol < neq || lRtol < neq))
+    error("length of atol and rtol must be equal to the number of states");
+
+  /*------------------------------------------------------------------------*/
+  /* timesteps (for advection computation in ReacTran)                      */
+  /*------------------------------------------------------------------------*/
+  for (i = 0; i < 2; i++) timesteps[i] = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* DLL, ipar, rpar (for compatibility with lsoda)                         */
+  /*------------------------------------------------------------------------*/
+  int isDll = FALSE;
+  int lrpar= 0, lipar = 0;
+  int *ipar = NULL;
+
+  if (inherits(Func, "NativeSymbol")) {
+    /* function is a dll */
+    isDll = TRUE;
+    if (nout > 0) isOut = TRUE;
+    lrpar = nout + LENGTH(Rpar);  /* length of rpar; LENGTH(Rpar) is always >0 */
+    lipar = 3    + LENGTH(Ipar);  /* length of ipar */
+  } else {
+    /* function is not a dll */
+    isDll = FALSE;
+    isOut = FALSE;
+    lipar = 3;
+    lrpar = nout;
+  }
+  out   = (double*) R_alloc(lrpar, sizeof(double));
+  ipar  = (int *) R_alloc(lipar, sizeof(int));
+
+  /* first 3 elements of ipar are special */
+  ipar[0] = nout;
+  ipar[1] = lrpar;
+  ipar[2] = lipar;
+  if (isDll == 1) {
+    for (j = 0; j < LENGTH(Ipar); j++) ipar[j+3] = INTEGER(Ipar)[j];
+    for (j = 0; j < nout; j++)         out[j] = 0.0;
+    for (j = 0; j < LENGTH(Rpar); j++) out[nout+j] = REAL(Rpar)[j];
+  }
+
+  /*------------------------------------------------------------------------*/
+  /* Allocation of Workspace: three state vectors, one more for            */
+  /* error control                                                          */
+  /*------------------------------------------------------------------------*/
+  y   =  (double*) R_alloc(neq, sizeof(double));
+  dq  =  (double*) R_alloc(neq, sizeof(double));
+  f   =  (double*) R_alloc(neq, sizeof(double));
+  if (varstep) err = (double*) R_alloc(neq, sizeof(double));
+
+  /* matrix for holding states and global outputs */
+  PROTECT(R_yout = allocMatrix(REALSXP, nt, neq + nout + 1)); incr_N_Protect();
+  yout = REAL(R_yout);
+  /* initialize outputs with NA first */
+  for (i = 0; i < nt * (neq + nout + 1); i++) yout[i] = NA_REAL;
+
+  /* attribute that stores state information, similar to lsoda */
+  SEXP R_istate;
+  int *istate;
+  PROTECT(R_istate = allocVector(INTSXP, 22)); incr_N_Protect();
+  istate = INTEGER(R_istate);
+  for (i = 0; i < 22; i++) istate[i] = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* Initialization of Parameters (for DLL functions)                       */
+  /*------------------------------------------------------------------------*/
+  PROTECT(Y = allocVector(REALSXP,(neq)));        incr_N_Protect();
+
+  /* environment for R event functions */
+  R_envir = (isNull(Rho)) ? R_GlobalEnv : Rho;
+
+  initParms(Initfunc, Parms);
+  isForcing = initForcings(Flist);
+  isEvent = initEvents(elist, eventfunc, 0);
+  n_eq = neq;                     /* for events */
+
+  /*------------------------------------------------------------------------*/
+  /* Initialization of Integration Loop                                     */
+  /*------------------------------------------------------------------------*/
+  yout[0]   = tt[0];              /* initial time                 */
+  for (i = 0; i < neq; i++) {
+    y[i]        = xs[i];          /* initial values               */
+    dq[i]       = 0;
+    yout[(i + 1) * nt] = y[i];    /* output array                 */
+  }
+  t = tt[0];
+  /* an event at the initial time changes the state after the first output */
+  if (isEvent) updateevent(&t, y, &ievent);
+
+  tmax = fmin(tt[nt - 1], tcrit);
+
+  /*------------------------------------------------------------------------*/
+  /* Main Loop                                                              */
+  /*------------------------------------------------------------------------*/
+  it     = 1; /* output counter; zero element is initial state */
+  it_tot = 0; /* total number of time steps                    */
+
+  rk_lowstorage(neq, stage, isDll, isForcing, verbose, varstep, maxsteps,
+    nt, isEvent,
+    &it, &it_tot, &it_rej, istate, ipar,
+    t, tmax, hmin, hmax, hini, &ctl,
+    tt, y, dq, f, err, A, bb1, cc, ww, out, atol, rtol, yout,
+    Func, Parms, Rho);
+
+  /*====================================================================*/
+  /* call derivs again to get global outputs                            */
+  /* j = -1 suppresses unnecessary internal copying                     */
+  /*====================================================================*/
+  if (nout > 0) {
+    for (int j = 0; j < it; j++) {
+      t = yout[j];
+      for (i = 0; i < neq; i++) y[i] = yout[j + nt * (1 + i)];
+      derivs(Func, t, y, Parms, Rho, f, out, -1, neq, ipar, isDll, isForcing);
+      for (i = 0; i < nout; i++) {
+        yout[j + nt * (1 + neq + i)] = out[i];
+      }
+    }
+  }
+
+  /* attach diagnostic information (codes are compatible to lsoda) */
+  setIstate(R_yout, R_istate, istate, it_tot, stage, 0, qerr, it_rej);
+  if (varstep) rkcontrol_rstate(R_yout, &ctl, ctl.hlast * ctl.rho1, tt[0], NA_REAL);
+
+  /* verbose printing in debugging mode*/
+  if (verbose)
+    Rprintf("\nNumber of time steps it = %d, it_tot = %d it_rej %d\n",
+      it, it_tot, it_rej);
+
+  /* release R resources */
+  timesteps[0] = 0;
+  timesteps[1] = 0;
+
+  restore_N_Protected(old_N_Protect);
+  return(R_yout);
+}
@@ -0,0 +1,160 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >=2                  */
+/* Multirate (MRI-GARK) solver for models with slow and fast parts          */
+/*==========================================================================*/
+
+#include "rk_util.h"
+
+SEXP call_rkMultirate(SEXP Xstart, SEXP Times, SEXP Func, SEXP Funcfast,
+  SEXP Initfunc, SEXP Parms, SEXP Nout, SEXP Rho, SEXP Verbose,
+  SEXP Hslow, SEXP Hfast, SEXP Rpar, SEXP Ipar, SEXP Method, SEXP Flist) {
+
+  /**  Initialization **/
+  long int old_N_Protect = save_N_Protected();
+
+  double *tt = NULL, *xs = NULL;
+
+  SEXP  R_yout;
+  double *y, *FS, *ga, *gb, *ytmp, *K, *out, *yout;
+
+  int i = 0, j = 0, it_tot = 0, nt = 0, neq = 0;
+  int nslow = 0, nfast = 0, nfstep = 0, isForcing;
+
+  /*------------------------------------------------------------------------*/
+  /* Processing of Arguments                                                */
+  /*------------------------------------------------------------------------*/
+  double  hslow = REAL(Hslow)[0];
+  double  hfast = REAL(Hfast)[0];
+  int  nout     = INTEGER(Nout)[0]; /* number of global outputs if func is in a DLL */
+  int  verbose  = INTEGER(Verbose)[0];
+
+  const mri_table *mri =
+    mritable(CHAR(STRING_ELT(getListElement(Method, "ID"), 0)));
+  int stage = mri->stage;
+
+  PROTECT(Times = AS_NUMERIC(Times)); incr_N_Protect();
+  tt = NUMERIC_POINTER(Times);
+  nt = length(Times);
+
+  PROTECT(Xstart = AS_NUMERIC(Xstart)); incr_N_Protect();
+  xs  = NUMERIC_POINTER(Xstart);
+  neq = length(Xstart);
+
+  if (hslow <= 0 || hfast <= 0)
+    error("step sizes 'hslow' and 'hfast' must be positive");
+
+  /*------------------------------------------------------------------------*/
+  /* timesteps (for advection computation in ReacTran)                      */
+  /*------------------------------------------------------------------------*/
+  for (i = 0; i < 2; i++) timesteps[i] = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* DLL, ipar, rpar (for compatibility with lsoda); the slow and the fast  */
+  /* part can be R functions or compiled code independently                 */
+  /*------------------------------------------------------------------------*/
+  int isDll     = inherits(Func, "NativeSymbol");
+  int isDllfast = inherits(Funcfast, "NativeSymbol");
+  int lrpar= 0, lipar = 0;
+  int *ipar = NULL;
+
+  if (isDll || isDllfast) {
+    if (isDll && nout > 0) isOut = TRUE;
+    lrpar = nout + LENGTH(Rpar);  /* length of rpar; LENGTH(Rpar) is always >0 */
+    lipar = 3    + LENGTH(Ipar);  /* length of ipar */
+  } else {
+    isOut = FALSE;
+    lipar = 3;
+    lrpar = nout;
+  }
+  out   = (double*) R_alloc(lrpar, sizeof(double));
+  ipar  = (int *) R_alloc(lipar, sizeof(int));
+
+  /* first 3 elements of ipar are special */
+  ipar[0] = nout;
+  ipar[1] = lrpar;
+  ipar[2] = lipar;
+  if (isDll || isDllfast) {
+    for (j = 0; j < LENGTH(Ipar); j++) ipar[j+3] = INTEGER(Ipar)[j];
+    for (j = 0; j < nout; j++)         out[j] = 0.0;
+    for (j = 0; j < LENGTH(Rpar); j++) out[nout+j] = REAL(Rpar)[j];
+  }
+
+  /*------------------------------------------------------------------------*/
+  /* Allocation of Workspace: slow part of all stages, the slow forcing of  */
+  /* the fast problems and the stages of the fast (classical RK) method     */
+  /*------------------------------------------------------------------------*/
+  y    = (double*) R_alloc(neq, sizeof(double));
+  FS   = (double*) R_alloc(neq * stage, sizeof(double));
+  ga   = (double*) R_alloc(neq, sizeof(double));
+  gb   = (double*) R_alloc(neq, sizeof(double));
+  ytmp = (double*) R_alloc(neq, sizeof(double));
+  K    = (double*) R_alloc(neq * 4, sizeof(double));
+
+  /* matrix for holding states and global outputs */
+  PROTECT(R_yout = allocMatrix(REALSXP, nt, neq + nout + 1)); incr_N_Protect();
+  yout = REAL(R_yout);
+  /* initialize outputs with NA first */
+  for (i = 0; i < nt * (neq + nout + 1); i++) yout[i] = NA_REAL;
+
+  /* attribute that stores state information, similar to lsoda */
+  SEXP R_istate;
+  int *istate;
+  PROTECT(R_istate = allocVector(INTSXP, 22)); incr_N_Protect();
+  istate = INTEGER(R_istate);
+  for (i = 0; i < 22; i++) istate[i] = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* Initialization of Parameters (for DLL functions)                       */
+  /*------------------------------------------------------------------------*/
+  PROTECT(Y = allocVector(REALSXP,(neq)));        incr_N_Protect();
+
+  initParms(Initfunc, Parms);
+  isForcing = initForcings(Flist);
+
+  /*------------------------------------------------------------------------*/
+  /* Main Loop                                                              */
+  /*------------------------------------------------------------------------*/
+  yout[0]   = tt[0];              /* initial time                 */
+  for (i = 0; i < neq; i++) {
+    y[i]        = xs[i];          /* initial values               */
+    yout[(i + 1) * nt] = y[i];    /* output array                 */
+  }
+
+  rk_mri(mri, neq, nt, isDll, isDllfast, isForcing,
+    &it_tot, &nslow, &nfast, &nfstep, ipar, hslow, hfast,
+    tt, y, FS, ga, gb, ytmp, K, out, yout,
+    Func, Funcfast, Parms, Rho);
+
+  /*====================================================================*/
+  /* call derivs again to get global outputs (from the slow part)       */
+  /* j = -1 suppresses unnecessary internal copying                     */
+  /*====================================================================*/
+  if (nout > 0) {
+    for (int j = 0; j < nt; j++) {
+      double t = yout[j];
+      for (i = 0; i < neq; i++) ytmp[i] = yout[j + nt * (1 + i)];
+      derivs(Func, t, ytmp, Parms, Rho, FS, out, -1, neq, ipar, isDll, isForcing);
+      for (i = 0; i < nout; i++) {
+        yout[j + nt * (1 + neq + i)] = out[i];
+      }
+    }
+  }
+
+  /* attach diagnostic information (codes are compatible to lsoda) */
+  setIstate(R_yout, R_istate, istate, it_tot, stage, 0, mri->order, 0);
+  istate[12] = nslow;      /* evaluations of the slow part */
+  istate[18] = nfast;      /* evaluations and steps of the fast part */
+  istate[19] = nfstep;
+
+  /* verbose printing in debugging mode*/
+  if (verbose)
+    Rprintf("\nNumber of slow steps it_tot = %d, fast steps %d\n",
+      it_tot, nfstep);
+
+  /* release R resources */
+  timesteps[0] = 0;
+  timesteps[1] = 0;
+
+  restore_N_Protected(old_N_Protect);
+  return(R_yout);
+}
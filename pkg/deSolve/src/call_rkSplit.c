@@ -0,0 +1,100 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >=2                  */
+/* Reaction step of operator splitting (ode.split), all cells over [t, tend]*/
+/*==========================================================================*/
+
+#include "rk_util.h"
+
+SEXP call_rkSplit(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
+  SEXP Parms, SEXP Rho, SEXP Atol, SEXP Rtol, SEXP Hcell, SEXP Rpar,
+  SEXP Ipar, SEXP Method, SEXP Maxsteps, SEXP Nspec, SEXP Nthreads) {
+
+  /**  Initialization **/
+  long int old_N_Protect = save_N_Protected();
+
+  SEXP R_y, R_h, R_stat, R_code, R_out, R_names;
+  double *y, *hcell, *out;
+  int i, j, neq, ncell, *code, *ipar, lrpar, lipar, isDll;
+
+  int nspec    = INTEGER(Nspec)[0];
+  int nthreads = INTEGER(Nthreads)[0];
+  int maxsteps = INTEGER(Maxsteps)[0];
+  double t     = REAL(Times)[0];
+  double tend  = REAL(Times)[1];
+  const ros_table *ros =
+    rostable(CHAR(STRING_ELT(getListElement(Method, "ID"), 0)));
+
+  neq = LENGTH(Xstart);
+  if (nspec < 1 || neq % nspec != 0)
+    error("the number of states must be a multiple of nspec");
+  ncell = neq / nspec;
+  if (LENGTH(Hcell) != ncell)
+    error("length of 'hcell' must be equal to the number of cells");
+  if (LENGTH(Atol) < nspec || LENGTH(Rtol) < nspec)
+    error("length of atol and rtol must be equal to nspec");
+
+  /* the state and the step sizes are updated in copies */
+  PROTECT(R_y = allocVector(REALSXP, neq));   incr_N_Protect();
+  PROTECT(R_h = allocVector(REALSXP, ncell)); incr_N_Protect();
+  PROTECT(R_stat = allocVector(INTSXP, 5));   incr_N_Protect();
+  PROTECT(R_code = allocVector(INTSXP, 2));   incr_N_Protect();
+  y     = REAL(R_y);
+  hcell = REAL(R_h);
+  for (i = 0; i < neq; i++)   y[i] = REAL(Xstart)[i];
+  for (i = 0; i < ncell; i++) hcell[i] = REAL(Hcell)[i];
+  for (i = 0; i < 5; i++)     INTEGER(R_stat)[i] = 0;
+  code = (int*) R_alloc(ncell, sizeof(int));
+
+  /*------------------------------------------------------------------------*/
+  /* DLL, ipar, rpar (for compatibility with lsoda); no global outputs      */
+  /*------------------------------------------------------------------------*/
+  if (inherits(Func, "NativeSymbol")) {
+    isDll = TRUE;
+    lrpar = LENGTH(Rpar);
+    lipar = 3 + LENGTH(Ipar);
+  } else {
+    isDll = FALSE;
+    lrpar = 0;
+    lipar = 3;
+  }
+  out  = (double*) R_alloc(lrpar + 1, sizeof(double));
+  ipar = (int *)   R_alloc(lipar, sizeof(int));
+  ipar[0] = 0;
+  ipar[1] = lrpar;
+  ipar[2] = lipar;
+  if (isDll) {
+    for (j = 0; j < LENGTH(Ipar); j++) ipar[j+3] = INTEGER(Ipar)[j];
+    for (j = 0; j < LENGTH(Rpar); j++) out[j] = REAL(Rpar)[j];
+  }
+
+  initParms(Initfunc, Parms);
+
+  rk_split(nspec, ncell, nthreads, maxsteps, ros, t, tend, y, hcell,
+    REAL(Atol), REAL(Rtol), code, INTEGER(R_stat), out, lrpar,
+    Func, Parms, Rho, ipar, isDll);
+
+  /* first cell that failed (1-based) and its return code */
+  INTEGER(R_code)[0] = 0;
+  INTEGER(R_code)[1] = 0;
+  for (i = 0; i < ncell; i++)
+    if (code[i] != 0) {
+      INTEGER(R_code)[0] = code[i];
+      INTEGER(R_code)[1] = i + 1;
+      break;
+    }
+
+  PROTECT(R_out = allocVector(VECSXP, 4));     incr_N_Protect();
+  PROTECT(R_names = allocVector(STRSXP, 4));   incr_N_Protect();
+  SET_VECTOR_ELT(R_out, 0, R_y);
+  SET_VECTOR_ELT(R_out, 1, R_h);
+  SET_VECTOR_ELT(R_out, 2, R_stat);
+  SET_VECTOR_ELT(R_out, 3, R_code);
+  SET_STRING_ELT(R_names, 0, mkChar("y"));
+  SET_STRING_ELT(R_names, 1, mkChar("hcell"));
+  SET_STRING_ELT(R_names, 2, mkChar("stat"));
+  SET_STRING_ELT(R_names, 3, mkChar("flag"));
+  setAttrib(R_out, R_NamesSymbol, R_names);
+
+  restore_N_Protected(old_N_Protect);
+  return(R_out);
+}
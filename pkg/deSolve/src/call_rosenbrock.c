@@ -0,0 +1,309 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >=2                  */
+/* Rosenbrock (linearly implicit) solvers with adaptive step size           */
+/*==========================================================================*/
+/*
+  The Rosenbrock methods use the main loop of the explicit solvers
+  (rk_auto) in its stiff mode, i.e. with step size control, Hermite
+  dense output, root finding and events, but without switching.
+*/
+
+#include "rk_util.h"
+
+SEXP call_rosenbrock(SEXP Xstart, SEXP Times, SEXP Func, SEXP Initfunc,
+  SEXP Parms, SEXP eventfunc, SEXP elist, SEXP Nout, SEXP Rho,
+  SEXP Atol, SEXP Rtol, SEXP Tcrit, SEXP Verbose,
+  SEXP Hmin, SEXP Hmax, SEXP Hini, SEXP Rpar, SEXP Ipar,
+  SEXP Method, SEXP Maxsteps, SEXP Flist, SEXP Rootfunc, SEXP nRoot,
+  SEXP Jacfunc, SEXP Nrjac) {
+
+  /**  Initialization **/
+  long int old_N_Protect = save_N_Protected();
+
+  double *tt = NULL, *xs = NULL;
+
+  double *y,  *f,  *Fj, *tmp, *FF, *rr;
+  SEXP  R_yout;
+  double *y0,  *y1,  *y2,  *dy1,  *dy2, *out, *yout;
+
+  double t, dt, tmax;
+  rk_control ctl;
+  rk_switch sw;
+
+  int i = 0, j = 0, it = 0, it_tot = 0, it_ext = 0, nt = 0, neq = 0, it_rej = 0;
+  int iknots = 0, isForcing, isEvent;
+  int nroot = INTEGER(nRoot)[0], iroot = 0, *jroot = NULL;
+  double *gold = NULL, *gnew = NULL;
+
+  /*------------------------------------------------------------------------*/
+  /* Processing of Arguments                                                */
+  /*------------------------------------------------------------------------*/
+  int lAtol = LENGTH(Atol);
+  double *atol = (double*) R_alloc((int) lAtol, sizeof(double));
+
+  int lRtol = LENGTH(Rtol);
+  double *rtol = (double*) R_alloc((int) lRtol, sizeof(double));
+
+  for (j = 0; j < lRtol; j++) rtol[j] = REAL(Rtol)[j];
+  for (j = 0; j < lAtol; j++) atol[j] = REAL(Atol)[j];
+
+  double  tcrit = REAL(Tcrit)[0];
+  double  hmin  = REAL(Hmin)[0];
+  double  hmax  = REAL(Hmax)[0];
+  double  hini  = REAL(Hini)[0];
+  int  maxsteps = INTEGER(Maxsteps)[0];
+  int  nout     = INTEGER(Nout)[0]; /* number of global outputs is func is in a DLL */
+  int  verbose  = INTEGER(Verbose)[0];
+
+  /* coefficients of the method, step size controller */
+  sw.ros = rostable(CHAR(STRING_ELT(getListElement(Method, "ID"), 0)));
+  double qerr = sw.ros->qerr;
+  rkcontrol_init(&ctl, Method, qerr);
+
+  PROTECT(Times = AS_NUMERIC(Times)); incr_N_Protect();
+  tt = NUMERIC_POINTER(Times);
+  nt = length(Times);
+
+  PROTECT(Xstart = AS_NUMERIC(Xstart)); incr_N_Protect();
+  xs  = NUMERIC_POINTER(Xstart);
+  neq = length(Xstart);
+
+  /* Jacobian: user defined or internal, full or banded */
+  sw.Jacfunc = Jacfunc;
+  sw.ml = INTEGER(Nrjac)[1];
+  sw.mu = INTEGER(Nrjac)[2];
+  sw.banded = INTEGER(Nrjac)[3];
+  int ldj = (sw.banded) ? sw.ml + sw.mu + 1 : neq;
+  int lda = (sw.banded) ? 2 * sw.ml + sw.mu + 1 : neq;
+
+  /*------------------------------------------------------------------------*/
+  /* timesteps (for advection computation in ReacTran)                      */
+  /*------------------------------------------------------------------------*/
+  for (i = 0; i < 2; i++) timesteps[i] = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* DLL, ipar, rpar (for compatibility with lsoda)                         */
+  /*------------------------------------------------------------------------*/
+  int isDll = FALSE;
+  int lrpar= 0, lipar = 0;
+  int *ipar = NULL;
+
+  if (inherits(Func, "NativeSymbol")) {
+    /* function is a dll */
+    isDll = TRUE;
+    if (nout > 0) isOut = TRUE;
+    lrpar = nout + LENGTH(Rpar);  /* length of rpar; LENGTH(Rpar) is always >0 */
+    lipar = 3    + LENGTH(Ipar);  /* length of ipar */
+  } else {
+    /* function is not a dll */
+    isDll = FALSE;
+    isOut = FALSE;
+    lipar = 3;
+    lrpar = nout;
+  }
+  out   = (double*) R_alloc(lrpar, sizeof(double));
+  ipar  = (int *) R_alloc(lipar, sizeof(int));
+
+  /* first 3 elements of ipar are special */
+  ipar[0] = nout;
+  ipar[1] = lrpar;
+  ipar[2] = lipar;
+  if (isDll == 1) {
+    for (j = 0; j < LENGTH(Ipar); j++) ipar[j+3] = INTEGER(Ipar)[j];
+    for (j = 0; j < nout; j++)         out[j] = 0.0;
+    for (j = 0; j < LENGTH(Rpar); j++) out[nout+j] = REAL(Rpar)[j];
+  }
+
+  /*------------------------------------------------------------------------*/
+  /* Allocation of Workspace                                                */
+  /*------------------------------------------------------------------------*/
+  y0  =  (double*) R_alloc(neq, sizeof(double));
+  y1  =  (double*) R_alloc(neq, sizeof(double));
+  y2  =  (double*) R_alloc(neq, sizeof(double));
+  dy1 =  (double*) R_alloc(neq, sizeof(double));
+  dy2 =  (double*) R_alloc(neq, sizeof(double));
+  f   =  (double*) R_alloc(neq, sizeof(double));
+  y   =  (double*) R_alloc(neq, sizeof(double));
+  Fj  =  (double*) R_alloc(neq, sizeof(double));
+  tmp =  (double*) R_alloc(neq, sizeof(double));
+  FF  =  (double*) R_alloc(neq, sizeof(double));
+  rr  =  (double*) R_alloc(neq * 5, sizeof(double));
+
+  sw.J    = (double*) R_alloc(ldj * neq, sizeof(double));
+  sw.M    = (double*) R_alloc(lda * neq, sizeof(double));
+  sw.U    = (double*) R_alloc(neq * sw.ros->stage, sizeof(double));
+  sw.ft   = (double*) R_alloc(neq, sizeof(double));
+  sw.ftmp = (double*) R_alloc(neq, sizeof(double));
+  sw.ysti = NULL;
+  sw.ipvt = (int*)    R_alloc(neq, sizeof(int));
+
+  /* always stiff, no switching */
+  sw.on = TRUE; sw.pure = TRUE; sw.stiff = TRUE;
+  sw.fstiff = FALSE; sw.jacok = FALSE;
+  sw.nstiff = 0; sw.nonstiff = 0; sw.nswitch = 0;
+  sw.njac = 0; sw.nlu = 0; sw.nfun = 0; sw.nstep = 0;
+  sw.qerr = qerr; sw.bound = 0; sw.hlamb = 0; sw.tswitch = NA_REAL;
+
+  /* matrix for holding states and global outputs */
+  PROTECT(R_yout = allocMatrix(REALSXP, nt, neq + nout + 1)); incr_N_Protect();
+  yout = REAL(R_yout);
+  /* initialize outputs with NA first */
+  for (i = 0; i < nt * (neq + nout + 1); i++) yout[i] = NA_REAL;
+
+  /* attribute that stores state information, similar to lsoda */
+  SEXP R_istate;
+  int *istate;
+  PROTECT(R_istate = allocVector(INTSXP, 22)); incr_N_Protect();
+  istate = INTEGER(R_istate);
+  for (i = 0; i < 22; i++) istate[i] = 0;
+
+  /*------------------------------------------------------------------------*/
+  /* Initialization of Parameters (for DLL functions)                       */
+  /*------------------------------------------------------------------------*/
+  PROTECT(Y = allocVector(REALSXP,(neq)));        incr_N_Protect();
+
+  /* environment for R event functions */
+  R_envir = (isNull(Rho)) ? R_GlobalEnv : Rho;
+
+  initParms(Initfunc, Parms);
+  isForcing = initForcings(Flist);
+  isEvent = initEvents(elist, eventfunc, nroot);
+  n_eq = neq;                     /* for events */
+
+  /*------------------------------------------------------------------------*/
+  /* Initialization of Integration Loop                                     */
+  /*------------------------------------------------------------------------*/
+  yout[0]   = tt[0];              /* initial time                 */
+  for (i = 0; i < neq; i++) {
+    y0[i]        = xs[i];         /* initial values               */
+    yout[(i + 1) * nt] = y0[i];   /* output array                 */
+  }
+  t = tt[0];
+  /* an event at the initial time changes the state after the first output;
+     later events are located by rk_auto */
+  if (isEvent) updateevent(&t, y0, istate);
+
+  /* root finding: values of the root functions at the start of each step */
+  if (nroot > 0) {
+    jroot = (int *)    R_alloc(nroot, sizeof(int));
+    gold  = (double *) R_alloc(nroot, sizeof(double));
+    gnew  = (double *) R_alloc(nroot, sizeof(double));
+    for (i = 0; i < nroot; i++) jroot[i] = 0;
+    rootvalue(Rootfunc, Rho, tt[0], y0, gold, neq, nroot, isDll);
+  }
+
+  tmax = fmax(tt[nt - 1], tcrit);
+  hmax = fmin(hmax, tmax - t);
+
+  /* initial step size from the scaled norms of y and f(y),
+     as in Hairer and Wanner's codes; too large steps are rejected */
+  if (hini <= 0) {
+    double d0 = 0, d1 = 0, sc;
+    derivs(Func, t, y0, Parms, Rho, FF, out, 0, neq, ipar, isDll, isForcing);
+    sw.nfun++;
+    for (i = 0; i < neq; i++) {
+      sc = atol[i] + rtol[i] * fabs(y0[i]);
+      d0 += (y0[i] / sc) * (y0[i] / sc);
+      d1 += (FF[i] / sc) * (FF[i] / sc);
+    }
+    hini = (d0 < 1e-10 || d1 < 1e-10) ? 1e-6 : 0.01 * sqrt(d0 / d1);
+  }
+  dt = fmax(fmin(hmax, hini), hmin);
+
+  /*------------------------------------------------------------------------*/
+  /* Main Loop                                                              */
+  /*------------------------------------------------------------------------*/
+  it     = 1; /* step counter; zero element is initial state   */
+  it_ext = 0; /* counter for external time step (dense output) */
+  if (isEvent && nt > 1) it_ext = 1; /* keep the state before the event */
+  it_tot = 0; /* total number of time steps                    */
+  it_rej = 0;
+
+  rk_dense dn = {0, 0, 4, 0, NULL, NULL, NULL};  /* Hermite dense output */
+  rk_auto(
+    FALSE, neq, 1, isDll, isForcing, verbose, 1, TRUE,
+    3, maxsteps, nt, nroot, isEvent, FALSE, 0,
+    &iknots, &it, &it_ext, &it_tot, &it_rej,
+    istate, ipar, &iroot, jroot,
+    t, tmax, hmin, hmax,
+    &dt, &ctl, &sw, &dn,
+    tt, y0, y1, y2, dy1, dy2, f, y, Fj, tmp, FF, rr, NULL,
+    out, NULL, NULL, NULL, atol, rtol, NULL, yout, gold, gnew,
+    Func, Parms, Rho, Rootfunc
+  );
+
+  /*====================================================================*/
+  /* simulation stopped at a root: remove the outputs after the root    */
+  /*====================================================================*/
+  int rootstop = istate[0];
+  if (istate[0] <= -20) {
+    SEXP R_yout2;
+    int nt2 = (it_ext + 1 < nt) ? it_ext + 1 : nt;
+    PROTECT(R_yout2 = allocMatrix(REALSXP, nt2, neq + nout + 1)); incr_N_Protect();
+    for (j = 0; j < neq + nout + 1; j++)
+      for (i = 0; i < nt2; i++) REAL(R_yout2)[i + nt2 * j] = yout[i + nt * j];
+    R_yout = R_yout2;
+    yout = REAL(R_yout);
+    nt = nt2;
+    istate[0] = 3;   /* as in lsodar: a root was found */
+  }
+
+  /*====================================================================*/
+  /* call derivs again to get global outputs                            */
+  /* j = -1 suppresses unnecessary internal copying                     */
+  /*====================================================================*/
+  if (nout > 0) {
+    for (int j = 0; j < nt; j++) {
+      t = yout[j];
+      for (i = 0; i < neq; i++) tmp[i] = yout[j + nt * (1 + i)];
+      derivs(Func, t, tmp, Parms, Rho, FF, out, -1, neq, ipar, isDll, isForcing);
+      for (i = 0; i < nout; i++) {
+        yout[j + nt * (1 + neq + i)] = out[i];
+      }
+    }
+  }
+
+  /* attach diagnostic information (codes are compatible to lsoda) */
+  setIstate(R_yout, R_istate, istate, it_tot, 1, 0, qerr, it_rej);
+  istate[12] = sw.nfun;   /* function evaluations, Jacobians, LU */
+  istate[3]  = sw.njac;
+  istate[9]  = sw.nlu;
+  rkcontrol_rstate(R_yout, &ctl, dt, tt[0], NA_REAL);
+
+  /* root information, similar to lsodar */
+  if (rootstop == -20) {
+    SEXP R_iroot, R_troot;
+    PROTECT(R_iroot = allocVector(INTSXP, nroot)); incr_N_Protect();
+    for (i = 0; i < nroot; i++) INTEGER(R_iroot)[i] = jroot[i];
+    setAttrib(R_yout, install("iroot"), R_iroot);
+    PROTECT(R_troot = ScalarReal(yout[nt - 1])); incr_N_Protect();
+    setAttrib(R_yout, install("troot"), R_troot);
+  }
+  if (iroot > 0) {   /* roots that triggered events */
+    SEXP R_nroot, R_troot, R_vroot, R_iroot;
+    PROTECT(R_nroot = ScalarInteger(iroot)); incr_N_Protect();
+    if (iroot > Rootsave) iroot = Rootsave;
+    PROTECT(R_troot = allocVector(REALSXP, iroot)); incr_N_Protect();
+    for (i = 0; i < iroot; i++) REAL(R_troot)[i] = troot[i];
+    PROTECT(R_vroot = allocVector(REALSXP, iroot * neq)); incr_N_Protect();
+    for (i = 0; i < iroot * neq; i++) REAL(R_vroot)[i] = valroot[i];
+    PROTECT(R_iroot = allocVector(INTSXP, iroot)); incr_N_Protect();
+    for (i = 0; i < iroot; i++) INTEGER(R_iroot)[i] = nrroot[i];
+    setAttrib(R_yout, install("troot"), R_troot);
+    setAttrib(R_yout, install("nroot"), R_nroot);
+    setAttrib(R_yout, install("valroot"), R_vroot);
+    setAttrib(R_yout, install("indroot"), R_iroot);
+  }
+
+  /* verbose printing in debugging mode*/
+  if (verbose)
+    Rprintf("\nNumber of time steps it = %d, it_ext = %d, it_tot = %d it_rej %d\n",
+      it, it_ext, it_tot, it_rej);
+
+  /* release R resources */
+  timesteps[0] = 0;
+  timesteps[1] = 0;
+
+  restore_N_Protected(old_N_Protect);
+  return(R_yout);
+}
@@ -27,6 +27,12 @@ double *fvec;
 int    *ivec;
 int    fmethod;
 
+/* field forcings: a series with one time axis and several values (cells) */
+int    nfser;    /* the number of forcing series */
+int    *fwidth;  /* number of values per series */
+int    *fstart;  /* start of each series in fvec */
+int    *foffset; /* position of first value of each series in forcings */
+
 int    *findex;
 double *intpol;
 int    *maxindex;
@@ -43,7 +49,9 @@ double *timeevent, *valueevent;
 int *svarevent, *methodevent;
 
 /* time delays */
-int interpolMethod;  /* for time-delays : 1 = hermite; 2=dense */
+int interpolMethod;  /* for time-delays : 1 = hermite; 2=dense; 4=rk dense */
+int ndensecoef;      /* rk dense: coefficient vectors per step, see denspar */
+int ndensecoef;      /* rk dense: coefficient vectors per step, see denspar */
 
 /*============================================================================
  type definitions for C functions
@@ -116,9 +124,21 @@ void initdaeglobals(int, int);
 /* the forcings and event functions */
 void updatedeforc(double*);
 int initForcings(SEXP list);
+void mapForcings(SEXP Buffer);
+void initFieldIndex(void);
+SEXP call_mapForcings(SEXP File);
 int initEvents(SEXP list, SEXP, int);
 void updateevent(double*, double*, int*);
 
+/* forward sensitivities (lsode) */
+int initSens(SEXP slist, int solver, SEXP initfunc, int isDll,
+             C_deriv_func_type *deriv_func, double *rtol, int lrtol,
+             double *atol, int latol);
+void initsenshist(double t);
+void updatesens(double t, double *y, double *rwork, int *iwork);
+void senstout(double t, double *res);
+void sensstats(int *nfun, int *ncnv);
+
 
 /* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
                          DECLARATIONS for time lags
@@ -153,6 +173,14 @@ int nexthist(int i);
 double interpolate(int i, int k, double t0, double t1, double t, 
   double *Yh, int nq); 
 
+int findHistInt(double t);
+double nextlagbreak(double t);
+double past(int i, int interval, double t, int val);
+void pastvec(int *nr, int ishift, int N, int interval, double t, int val,
+  double *res);
+void pastmulti(double *T, int nT, int *nr, int ishift, int N, int val,
+  double *res);
+
 
 /*==========================================
   Global variables for history arrays
@@ -163,4 +191,9 @@ double *histvar, *histdvar, *histtime, *histhh, *histsave;
 int    *histord;
 int    histsize, offset;
 int    initialisehist, lyh, lhh, lo;
+int    nhvar, *histvarmap, *histvarind; /* variables with history (lagvars) */
+int    nhist, histgrow;     /* nr of values in history, grow when full    */
+double histtaumax;          /* maximal delay; older values are dropped    */
+double *lagbreaks;          /* breakpoints of the delays                  */
+int    nlagbreaks, ilagbreak;
 
@@ -1,6 +1,13 @@
 /* deals with forcing functions and events;  Karline Soetaert */
 
 #include "deSolve.h"
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 /* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
    Forcing functions (compiled code) from deSolve version 1.5
    Events (R- and compiled code) from deSolve version 1.6
@@ -8,13 +15,19 @@
    **FORCING FUNCTIONS**, or external variables need to be interpolated 
    at each time step. This is done in this part of C-code.
 
-   "initForcings" creates forcing function vectors passed from an R-list 
+   "initForcings" creates forcing function vectors passed from an R-list,
+     or from a prepared forcing buffer (version 1.13), which are read in place
    "initforcings" puts a pointer to the vector that contains the 
      forcing functions in the DLL. This is done by calling "Initdeforc"; 
    here the C-globals are initialised .  
 
    Each time-step, before entering the compiled code, the forcing function 
    variables are interpolated to the current time (function ("updateforc").
+
+   A forcing series can be a "field" (version 1.13): one time axis and
+   several values per time (e.g. one per grid cell), stored time-major in
+   fvec. It fills consecutive elements of forcings, and is interpolated 
+   with one search for the time interval and one blend over all values.
    
    
    
@@ -37,6 +50,9 @@
 
 int    finit = 0;
 
+static void setintpol(int i, int ii, int zerograd);
+static void interpolforc(int i, double time);
+
 /*=========================================================================== 
          -----     Check for presence of forcing functions     -----       
    function "initForcings" checks if forcing functions are present and if so,
@@ -48,29 +64,38 @@ int    finit = 0;
 
 int initForcings(SEXP flist) {
 
-    SEXP Tvec, Fvec, Ivec, initforc;
+    SEXP Tvec, Fvec, Ivec, Wvec, Buffer, initforc;
     int i, j, isForcing = 0;
     init_func_type  *initforcings;
  
     initforc = getListElement(flist, "ModelForc");
     if (!isNull(initforc)) {
-      Tvec = getListElement(flist, "tmat");
-      Fvec = getListElement(flist, "fmat");
-      Ivec = getListElement(flist, "imat");
-      nforc = LENGTH(Ivec)-2; /* nforc, fvec, ivec = globals */
+      Buffer = getListElement(flist, "Buffer");
+      if (!isNull(Buffer)) {
+        /* prepared forcing buffer (memory-mapped file): read in place */
+        mapForcings(Buffer);
+      } else {
+        Tvec = getListElement(flist, "tmat");
+        Fvec = getListElement(flist, "fmat");
+        Ivec = getListElement(flist, "imat");
+        Wvec = getListElement(flist, "wmat");
+        nfser = LENGTH(Ivec)-2; /* nfser, fvec, ivec = globals */
 
-      i = LENGTH(Fvec);
-      fvec = (double *) R_alloc((int) i, sizeof(double));
-      for (j = 0; j < i; j++) fvec[j] = REAL(Fvec)[j];
+        /* the R vectors stay alive during the solver call: no copy needed */
+        fvec = REAL(Fvec);
+        tvec = REAL(Tvec);
 
-      tvec = (double *) R_alloc((int) i, sizeof(double));
-      for (j = 0; j < i; j++) tvec[j] = REAL(Tvec)[j];
+        i = LENGTH (Ivec)-1; /* last element: the interpolation method...*/
+        ivec = (int *) R_alloc(i, sizeof(int));
+        for (j = 0; j < i; j++) ivec[j] = INTEGER(Ivec)[j];
 
-      i = LENGTH (Ivec)-1; /* last element: the interpolation method...*/
-      ivec = (int *) R_alloc(i, sizeof(int));
-      for (j = 0; j < i; j++) ivec[j] = INTEGER(Ivec)[j];
+        fmethod = INTEGER(Ivec)[i];
 
-      fmethod = INTEGER(Ivec)[i];
+        fwidth = (int *) R_alloc(nfser, sizeof(int));
+        for (j = 0; j < nfser; j++)
+          fwidth[j] = (isNull(Wvec)) ? 1 : INTEGER(Wvec)[j];
+      }
+      initFieldIndex();
       initforcings = (init_func_type *) R_ExternalPtrAddr(initforc);
       initforcings(Initdeforc);
       isForcing = 1;
@@ -78,6 +103,189 @@ int initForcings(SEXP flist) {
     return(isForcing);
 }
 
+/*=========================================================================== 
+         -----     Forcing buffers backed by a binary file     -----
+   A forcing data set, prepared once by R function "forcingBuffer", can be
+   written to a binary file of doubles with layout
+
+     magic, nser, ntot, method, imat[nser+1], wmat[nser], tmat[ntot], fmat
+
+   where wmat contains the number of values per time of each series and
+   fmat has sum(rows * wmat) elements.
+
+   "call_mapForcings" maps this file read-only into memory (on Windows it is
+   read into a buffer); the mapping is released by the finalizer of the
+   external pointer. Solvers then read times and values in place, without
+   copying, and the pages are shared by all R processes that map the file.
+  =========================================================================== */
+
+#define FORCBUF_MAGIC 20140101.0
+
+typedef struct {
+  double *data;
+  size_t  size;    /* number of bytes */
+} forcbuf_type;
+
+static void forcbuf_free(SEXP ptr) {
+  forcbuf_type *fb = (forcbuf_type *) R_ExternalPtrAddr(ptr);
+  if (fb == NULL) return;
+#ifdef _WIN32
+  Free(fb->data);
+#else
+  munmap((void *) fb->data, fb->size);
+#endif
+  Free(fb);
+  R_ClearExternalPtr(ptr);
+}
+
+/* a count read from a forcing buffer file: a whole number in [0, max] */
+static int badcount(double x, double max) {
+  return (!(x >= 0) || x != floor(x) || x > max);
+}
+
+SEXP call_mapForcings(SEXP File) {
+  SEXP ptr, ans, nms, Imat, Wmat, Trange;
+  forcbuf_type *fb;
+  size_t size, nhead, nval = 0;
+  const char *fname = CHAR(STRING_ELT(File, 0));
+  double *data, *tmat, head[4], tt, fsize;
+  int nf, i;
+  FILE *fp;
+
+  /* read and check the header first */
+  fp = fopen(fname, "rb");
+  if (fp == NULL) error("cannot open forcing buffer file '%s'", fname);
+  {
+    /* the file size bounds all counts in the header */
+#ifdef _WIN32
+    struct _stati64 sb;
+    if (_fstati64(fileno(fp), &sb) != 0) {
+#else
+    struct stat sb;
+    if (fstat(fileno(fp), &sb) != 0) {
+#endif
+      fclose(fp);
+      error("cannot open forcing buffer file '%s'", fname);
+    }
+    fsize = (double) sb.st_size / sizeof(double);
+  }
+  if (fread(head, sizeof(double), 4, fp) != 4 || head[0] != FORCBUF_MAGIC ||
+      badcount(head[1], (fsize - 5) / 2) || badcount(head[2], fsize)) {
+    fclose(fp);
+    error("'%s' is not a valid forcing buffer file", fname);
+  }
+  {
+    /* read imat and wmat to get the number of forcing values */
+    int nser = (int) head[1], j;
+    double *iw = (double *) R_alloc(2 * nser + 1, sizeof(double)), nv = 0;
+    if (fread(iw, sizeof(double), 2 * nser + 1, fp) != (size_t)(2 * nser + 1)) {
+      fclose(fp);
+      error("forcing buffer file '%s' is truncated", fname);
+    }
+    for (j = 0; j < nser; j++) {
+      if (badcount(iw[j + 1] - iw[j], fsize) || badcount(iw[nser + 1 + j], fsize)) {
+        fclose(fp);
+        error("'%s' is not a valid forcing buffer file", fname);
+      }
+      nv += (iw[j + 1] - iw[j]) * iw[nser + 1 + j];
+    }
+    nhead = 4 + 2 * (size_t) nser + 1;
+    if (nhead + head[2] + nv > fsize) {
+      fclose(fp);
+      error("forcing buffer file '%s' is truncated", fname);
+    }
+    nval = (size_t) nv;
+  }
+  size  = (nhead + (size_t) head[2] + nval) * sizeof(double);
+
+#ifdef _WIN32
+  /* no mmap: read the complete file into memory once */
+  data = Calloc(size / sizeof(double), double);
+  rewind(fp);
+  if (fread(data, 1, size, fp) != size) {
+    fclose(fp);
+    Free(data);
+    error("forcing buffer file '%s' is truncated", fname);
+  }
+  fclose(fp);
+#else
+  data = (double *) mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+  fclose(fp);  /* the mapping remains valid */
+  if (data == MAP_FAILED) error("cannot map forcing buffer file '%s'", fname);
+#endif
+
+  fb = Calloc(1, forcbuf_type);
+  fb->data = data;
+  fb->size = size;
+
+  PROTECT(ptr = R_MakeExternalPtr(fb, install("forcingBuffer"), R_NilValue));
+  R_RegisterCFinalizerEx(ptr, forcbuf_free, TRUE);
+
+  /* index (plus method), width and common time range of the forcings,
+     from the mapped header, so that R need not read the file again */
+  nf = (int) data[1];
+  tmat = data + nhead;
+  PROTECT(Imat = allocVector(INTSXP, nf + 2));
+  PROTECT(Wmat = allocVector(INTSXP, nf));
+  PROTECT(Trange = allocVector(REALSXP, 2));
+  for (i = 0; i <= nf; i++) INTEGER(Imat)[i] = (int) data[4 + i];
+  INTEGER(Imat)[nf + 1] = (int) data[3];
+  for (i = 0; i < nf; i++) INTEGER(Wmat)[i] = (int) data[5 + nf + i];
+  for (i = 0; i < nf; i++) {
+    tt = tmat[INTEGER(Imat)[i] - 1];
+    if (i == 0 || tt > REAL(Trange)[0]) REAL(Trange)[0] = tt;
+    tt = tmat[INTEGER(Imat)[i + 1] - 2];
+    if (i == 0 || tt < REAL(Trange)[1]) REAL(Trange)[1] = tt;
+  }
+
+  PROTECT(ans = allocVector(VECSXP, 4));
+  PROTECT(nms = allocVector(STRSXP, 4));
+  SET_VECTOR_ELT(ans, 0, ptr);    SET_STRING_ELT(nms, 0, mkChar("Buffer"));
+  SET_VECTOR_ELT(ans, 1, Imat);   SET_STRING_ELT(nms, 1, mkChar("imat"));
+  SET_VECTOR_ELT(ans, 2, Wmat);   SET_STRING_ELT(nms, 2, mkChar("wmat"));
+  SET_VECTOR_ELT(ans, 3, Trange); SET_STRING_ELT(nms, 3, mkChar("trange"));
+  setAttrib(ans, R_NamesSymbol, nms);
+  UNPROTECT(6);
+  return(ans);
+}
+
+/* set the forcing globals to point into a mapped buffer */
+void mapForcings(SEXP Buffer) {
+  forcbuf_type *fb = (forcbuf_type *) R_ExternalPtrAddr(Buffer);
+  double *data;
+  long int ntot;
+  int j;
+
+  if (fb == NULL) error("forcing buffer has been released");
+  data  = fb->data;
+  nfser = (int) data[1];
+  ntot  = (long int) data[2];
+  fmethod = (int) data[3];
+
+  ivec = (int *) R_alloc(nfser + 1, sizeof(int));
+  for (j = 0; j <= nfser; j++) ivec[j] = (int) data[4 + j];
+
+  fwidth = (int *) R_alloc(nfser, sizeof(int));
+  for (j = 0; j < nfser; j++) fwidth[j] = (int) data[5 + nfser + j];
+
+  tvec = data + 4 + 2 * nfser + 1;
+  fvec = tvec + ntot;
+}
+
+/* start of each series in fvec and forcings; total number of forcings */
+void initFieldIndex(void) {
+  int i;
+  fstart  = (int *) R_alloc(nfser, sizeof(int));
+  foffset = (int *) R_alloc(nfser, sizeof(int));
+  nforc = 0;
+  for (i = 0; i < nfser; i++) {
+    fstart[i]  = (i == 0) ? 0 : 
+      fstart[i-1] + (ivec[i] - ivec[i-1]) * fwidth[i-1];
+    foffset[i] = nforc;
+    nforc += fwidth[i];
+  }
+}
+
 /*=========================================================================== 
          -----     INITIALISATION  called from compiled code   -----
    1. Check the length of forcing functions in solver call and code in DLL
@@ -86,36 +294,57 @@ int initForcings(SEXP flist) {
   =========================================================================== */
 
 void Initdeforc(int *N, double *forc) {
-  int i, ii;
+  int i;
   if ((*N) != nforc) {
     warning("Number of forcings passed to solver, %i; number in DLL, %i\n",nforc, *N);
     PROBLEM "Confusion over the length of forc"
     ERROR;
   }
 
-  /* for each forcing function: index to current position of data,
-     current value, interpolation factor, 
-     current forcing time, next forcing time,..
+  /* for each forcing series: index to current position of data,
+     interpolation factor (inverse of the current time interval),
+     last position of data
   */
   finit = 1;
-  findex   = (int    *) R_alloc(nforc, sizeof(int));
-  intpol   = (double *) R_alloc(nforc, sizeof(double));
-  maxindex = (int    *) R_alloc(nforc, sizeof(int));
-
-  /* Input is in three vectors:
-     tvec, fvec: time and value;
-     ivec : index to each forcing in tvec and fvec
+  findex   = (int    *) R_alloc(nfser, sizeof(int));
+  intpol   = (double *) R_alloc(nfser, sizeof(double));
+  maxindex = (int    *) R_alloc(nfser, sizeof(int));
+
+  /* Input is in four vectors:
+     tvec, fvec: time and value(s);
+     ivec : index to each forcing series in tvec
+     fwidth: number of values per time of each series
   */
-  for (i = 0; i<nforc; i++) {
-    ii = ivec[i]-1;
-    findex[i] = ii;
+  forcings = forc;      /* set pointer to C globals or FORTRAN common block */
+  for (i = 0; i < nfser; i++) {
+    findex[i] = ivec[i]-1;
     maxindex[i] = ivec[i+1]-2;
-    if (fmethod == 1) {
-      intpol[i] = (fvec[ii+1]-fvec[ii])/(tvec[ii+1]-tvec[ii]);
-    } else  intpol[i] = 0;
-    forc[i] = fvec[ii];
+    setintpol(i, findex[i], 0);
+    interpolforc(i, tvec[findex[i]]);
   }
-  forcings = forc;      /* set pointer to C globals or FORTRAN common block */
+}
+
+/* inverse time interval for linear interpolation, 0 = constant value */
+static void setintpol(int i, int ii, int zerograd) {
+  if ((zerograd == 0) & (fmethod == 1))   /* fmethod 1=linear */
+    intpol[i] = 1.0/(tvec[ii+1]-tvec[ii]);
+  else
+    intpol[i] = 0;
+}
+
+/* blend all values of series i between rows findex and findex+1 */
+static void interpolforc(int i, double time) {
+  int j, w = fwidth[i];
+  int ii = findex[i];
+  double *f  = forcings + foffset[i];
+  double *v0 = fvec + fstart[i] + (ii - (ivec[i]-1)) * w;
+  double *v1 = v0 + w;
+  double wgt = (time - tvec[ii]) * intpol[i];
+
+  if (wgt == 0)
+    for (j = 0; j < w; j++) f[j] = v0[j];
+  else
+    for (j = 0; j < w; j++) f[j] = v0[j] + wgt * (v1[j] - v0[j]);
 }
 
 void updatedeforc(double *time) {
@@ -125,7 +354,7 @@ void updatedeforc(double *time) {
   if (finit == 0)
     error ("error in forcing function: not initialised");
 
-  for (i=0; i<nforc; i++) {
+  for (i=0; i<nfser; i++) {
     ii = findex[i];
     zerograd=0;
     while (*time > tvec[ii+1]){
@@ -140,13 +369,9 @@ void updatedeforc(double *time) {
     }
     if (ii != findex[i]) {
       findex[i] = ii;
-      if ((zerograd == 0) & (fmethod == 1)) {  /* fmethod 1=linear */
-        intpol[i] = (fvec[ii+1]-fvec[ii])/(tvec[ii+1]-tvec[ii]); 
-      } else {
-        intpol[i] = 0;
-      }
+      setintpol(i, ii, zerograd);
     }
-    forcings[i]=fvec[ii]+intpol[i]*(*time-tvec[ii]);
+    interpolforc(i, *time);
   }
 }
 
@@ -14,6 +14,10 @@
    When the end of the history vectors is reached, new values are stored at the 
    start (it is a ringbuffer); 
    function "nexthist" finds the next position in this ringbuffer.
+   If a maximal delay "taumax" is given, or "grow" is set, the ringbuffer
+   is never overwritten while its values are still needed: values older 
+   than t - taumax are dropped, and the buffer is doubled when it is full
+   ("growhist").
    
    The history buffers can be interrogated in the R-code, via R-functions
    "lagvalue(t,nr)" and "lagderiv(t,nr)", where nr can be one index or a vector
@@ -25,8 +29,11 @@
    to the requested time (functions "Hermite" and "dHermite" for values and 
    derivatives), or use the Nordsieck history array. 
    
-   Note: findHistInt finds interval by bisectioning; only marginally
-   more/less efficient than straightforward findHistInt2...
+   Note: findHistInt starts from a lookup cursor: delays are mostly constant
+   or slowly varying, so successive queries of one delay hit the same or the
+   next interval. A few cursors are kept (about one per delay); a bounded
+   walk from the nearest cursor is tried first, bisectioning is the fallback.
+   "pastvec" then interpolates all requested variables in one pass.
    
    
    to do: make lags callable from external C/Fortran function 
@@ -53,10 +60,10 @@ double interpolate(int i, int k, double t0, double hh, double t,
   if (k > nq)
     error("illegal k %i, nq in interpolate, %i, at time %g", k, nq, t);
                 
-  if (i > n_eq || i <1)
-    error("illegal i %i, n_eq %i, at time %g", i, n_eq, t);
+  if (i > nhvar || i <1)
+    error("illegal i %i, nhvar %i, at time %g", i, nhvar, t);
 
-  F77_CALL(interpoly) (&t, &k, &i, Yh, &n_eq, &res, &nq, &t0, &hh); 
+  F77_CALL(interpoly) (&t, &k, &i, Yh, &nhvar, &res, &nq, &t0, &hh); 
   return(res);
 }  
 
@@ -114,18 +121,45 @@ double dHermite (double t0, double t1, double y0, double y1, double dy0,
   initialise history arrays + indices at start integration 
   =========================================================================== */
 
+/* lookup cursors: last interval found, and the time it was asked for */
+#define MAXCURSOR 16  /* max number of cursors (about one per delay)  */
+#define MAXWALK    8  /* max number of intervals walked from a cursor */
+
+static int    histcursor[MAXCURSOR], ncursor = 0;
+static double histcurtime[MAXCURSOR];
+
+/* sort buffer of pastmulti; heap memory that lives across calls and only
+   grows, so repeated lagvalue calls from compiled code do not pile up */
+static double *multits = NULL;
+static int    *multiindex = NULL, multisize = 0;
+
+/* variable index buffers of pastvec and pastmulti; grown the same way */
+static int    *pastivar = NULL, *pastkvar = NULL, pastsize = 0;
+
+static void growpastvars(int N) {
+  if (N + 1 > pastsize) {
+    pastivar = Realloc(pastivar, N + 1, int);
+    pastkvar = Realloc(pastkvar, N + 1, int);
+    pastsize = N + 1;
+  }
+}
+
 void inithist(int max, int maxlags, int solver, int nroot) {
   int maxord;  
   
   histsize = max;
   initialisehist = 1;
+  ncursor    = 0;  /* forget the cursors of a previous simulation      */
   indexhist  = -1; /* indexhist+1 = next time in circular buffer.  */
   starthist  = 0;  /* start time in circular buffer.               */
   endreached = 0;  /* if end of buffer reached and new values added at start  */
+  nhist      = 0;  /* number of values in the buffer                   */
   
+  /* only the nhvar variables in histvarind are stored (see initLags) */
+
   /* interpolMethod = Hermite */
   if (interpolMethod == 1) {
-    offset   = n_eq; /* size needed for saving one time-step in histvar*/
+    offset   = nhvar; /* size needed for saving one time-step in histvar*/
 
   /* interpolMethod = HigherOrder, Livermore solvers */
   } else if (interpolMethod == 2) {
@@ -143,19 +177,24 @@ void inithist(int max, int maxlags, int solver, int nroot) {
     if (solver == 4 || solver == 6 || solver == 7)  /* lsodar or lsoder */
       lyh = 20+3*nroot;
 
-    offset  = n_eq*(maxord+1);       
+    offset  = nhvar*(maxord+1);  /* compact slice of the Nordsieck array */
     histord = (int *) R_alloc (histsize, sizeof(int));
     histhh  = (double *) R_alloc (histsize, sizeof(double));
 
   /* interpolMethod = 3; HigherOrder, radau */
-  } else {
-    offset  = n_eq * 4 + 2;
+  } else if (interpolMethod == 3) {
+    offset  = nhvar * 4 + 2;
     histsave = (double *) R_alloc (2, sizeof(double));
+
+  /* interpolMethod = 4; dense output of Runge-Kutta: y, ndensecoef
+     coefficients, dt */
+  } else {
+    offset  = nhvar * (ndensecoef + 1) + 1;
   }
 
   histtime = (double *) R_alloc (histsize, sizeof(double));
   histvar  = (double *) R_alloc (offset * histsize, sizeof(double));
-  histdvar = (double *) R_alloc (n_eq * histsize, sizeof(double));
+  histdvar = (double *) R_alloc (nhvar * histsize, sizeof(double));
 }
 
 /*=========================================================================== 
@@ -171,6 +210,41 @@ int nexthist(int i) {
   }  
 }
 
+/*=========================================================================== 
+  double the size of the history arrays; the values are stored from the
+  oldest (index 0) to the newest (index nhist-1)
+  =========================================================================== */
+
+static double *growarray(double *x, int n, int size) {
+  int i, j, k = 0;
+  double *xnew = (double *) R_alloc (2 * size * n, sizeof(double));
+
+  for (i = 0, j = starthist; i < nhist; i++, j = nexthist(j))
+    for (k = 0; k < n; k++)
+      xnew[i * n + k] = x[j * n + k];
+  return(xnew);
+}
+
+void growhist(void) {
+  int i, j, *ord;
+
+  if (interpolMethod == 2) {
+    ord = (int *) R_alloc (2 * histsize, sizeof(int));
+    for (i = 0, j = starthist; i < nhist; i++, j = nexthist(j))
+      ord[i] = histord[j];
+    histord = ord;
+    histhh  = growarray(histhh, 1, histsize);
+  }
+  histtime  = growarray(histtime, 1, histsize);
+  histvar   = growarray(histvar, offset, histsize);
+  histdvar  = growarray(histdvar, nhvar, histsize);
+  histsize  = 2 * histsize;
+  starthist = 0;
+  indexhist = nhist - 1;
+  endreached = 0;
+  ncursor   = 0;   /* positions have changed */
+}
+
 /*=========================================================================== 
   update history arrays each time step
   =========================================================================== */
@@ -190,42 +264,65 @@ void updatehistini(double t, double *y, double *dY, double *rwork, int *iwork){
 }
 
 void updatehist(double t, double *y, double *dY, double *rwork, int *iwork) {
-  int j, ii;
+  int j, k, ii;
   double ss[2];
   
+  if (histgrow) {
+    /* drop values that are not needed for delays up to taumax */
+    if (histtaumax > 0)
+      while (nhist > 1 && histtime[nexthist(starthist)] <= t - histtaumax) {
+        starthist = nexthist(starthist);
+        nhist--;
+      }
+    if (nhist == histsize) growhist();
+  }
   indexhist = nexthist(indexhist);
   ii = indexhist * offset;     
 
   /* interpolMethod = Hermite */
   if (interpolMethod == 1) {
-    for (j = 0; j < n_eq; j++)  
-      histvar [ii  + j ] = y[j];
+    for (j = 0; j < nhvar; j++)  
+      histvar [ii  + j ] = y[histvarind[j]];
 
-  /* higherOrder, livermores */
+  /* higherOrder, livermores: rows of the stored variables in yh(n_eq, 13) */
   } else if (interpolMethod == 2) {
     histord[indexhist] = iwork[lo];    
 
-    for (j = 0; j < offset; j++)
-      histvar[ii + j] = rwork[lyh + j];
+    for (k = 0; k < offset / nhvar; k++)
+      for (j = 0; j < nhvar; j++)
+        histvar[ii + k * nhvar + j] = rwork[lyh + k * n_eq + histvarind[j]];
     histhh [indexhist] = rwork[lhh];   
 
-  /* higherOrder, radau */
+  /* higherOrder, radau: rows of the stored variables in cont(n_eq, 4) */
   }  else if (interpolMethod == 3) {
-    for (j = 0; j < 4 * n_eq; j++)
-      histvar[ii + j] = rwork[j];
+    for (k = 0; k < 4; k++)
+      for (j = 0; j < nhvar; j++)
+        histvar[ii + k * nhvar + j] = rwork[k * n_eq + histvarind[j]];
     F77_CALL(getconra) (ss);
     for (j = 0; j < 2; j++)
-      histvar[ii + 4*n_eq + j] = ss[j];
+      histvar[ii + 4*nhvar + j] = ss[j];
+
+  /* dense output of Runge-Kutta: rwork = coefficients of the step ending 
+     at t (see denspar), its step size is in timesteps[1] */
+  }  else if (interpolMethod == 4) {
+    for (j = 0; j < nhvar; j++)  
+      histvar [ii  + j ] = y[histvarind[j]];
+    for (k = 0; k < ndensecoef; k++)
+      for (j = 0; j < nhvar; j++)
+        histvar[ii + (k + 1) * nhvar + j] = rwork[k * n_eq + histvarind[j]];
+    histvar[ii + (ndensecoef + 1) * nhvar] = timesteps[1];
   }
 
-  ii = indexhist * n_eq;     
+  ii = indexhist * nhvar;     
  
-  for (j = 0; j < n_eq; j++)
-      histdvar[ii + j] = dY[j];
+  for (j = 0; j < nhvar; j++)
+      histdvar[ii + j] = dY[histvarind[j]];
 
   histtime [indexhist] = t;
 
-  if (endreached == 1)       /* starthist stays 0 until end reached... */
+  if (nhist < histsize)      /* starthist stays until the buffer is full... */
+    nhist++;
+  else
     starthist = nexthist(starthist);
 }
 
@@ -239,29 +336,34 @@ double past(int i, int interval, double t, int val)
 
 { int j, jn, nq, ip;
   double t0, t1, y0, y1, dy0, dy1, res, hh;
+  double s, s1, v, dv;
   double *Yh;
 
   /* error checking */
   if ( i >= n_eq)
     error("illegal input in lagvalue - var nr too high, %i", i+1);
+  if (histvarmap[i] < 0)
+    error("illegal input in lagvalue - history of var %i not stored (see 'lagvars')", i+1);
+  i = histvarmap[i];   /* position in the history arrays */
   
   /* equal to current value... */   
   if ( interval == indexhist && t == histtime[interval]) {   
     if (val == 1)
       res = histvar [interval * offset  + i ];
     else 
-      res = histdvar [interval * offset  + i ];   
+      res = histdvar [interval * nhvar  + i ];   
   
   /* within last interval - for now: just extrapolate last value */
-  } else if ( interval == indexhist && interpolMethod == 1) {
+  } else if ( interval == indexhist && 
+             (interpolMethod == 1 || interpolMethod == 4)) {
     if (val == 1) {
       t0  = histtime[interval];
       y0  = histvar [interval * offset  + i ];
-      dy0 = histdvar [interval * n_eq  + i ];
+      dy0 = histdvar [interval * nhvar  + i ];
       res = y0 + dy0*(t-t0);
     }
     else 
-      res = histdvar [interval * n_eq  + i ];
+      res = histdvar [interval * nhvar  + i ];
 
   /* Hermite interpolation */
   }  else if (interpolMethod == 1) {
@@ -270,10 +372,10 @@ double past(int i, int interval, double t, int val)
 
     t0  = histtime[j];
     t1  = histtime[jn];
-    y0  = histvar [j * n_eq  + i ];
-    y1  = histvar [jn * n_eq  + i ];
-    dy0 = histdvar [j * n_eq  + i ];
-    dy1 = histdvar [jn * n_eq  + i ];
+    y0  = histvar [j * nhvar  + i ];
+    y1  = histvar [jn * nhvar  + i ];
+    dy0 = histdvar [j * nhvar  + i ];
+    dy1 = histdvar [jn * nhvar  + i ];
     if (val == 1)
       res = Hermite (t0, t1, y0, y1, dy0, dy1, t);
     else
@@ -290,8 +392,8 @@ double past(int i, int interval, double t, int val)
     if (nq == 0) {
       y0  = histvar [j  * offset  + i ];
       y1  = histvar [jn * offset  + i ];
-      dy0 = histdvar [j  * n_eq  + i ];
-      dy1 = histdvar [jn * n_eq  + i ];
+      dy0 = histdvar [j  * nhvar  + i ];
+      dy1 = histdvar [jn * nhvar  + i ];
       if (val == 1)
         res = Hermite (t0, t1, y0, y1, dy0, dy1, t);
       else
@@ -301,15 +403,43 @@ double past(int i, int interval, double t, int val)
       hh = histhh[j];
       res = interpolate(i+1, val-1, t0, hh, t, Yh, nq); 
     }  
+  /* dense output of Runge-Kutta methods, stored with the end of the step */
+  } else if (interpolMethod == 4) {
+    j  = interval;
+    jn = nexthist(j);
+
+    Yh = &histvar [jn * offset];
+    hh = Yh[(ndensecoef + 1) * nhvar];
+    if (histtime[jn] == histtime[j] || hh == 0) {  /* e.g. before an event */
+      if (val == 1)
+        res = histvar [j * offset + i];
+      else
+        res = histdvar [j * nhvar + i];
+    } else {
+      /* nested polynomial of densout and its derivative (Horner) */
+      s  = (t - histtime[j]) / hh;
+      s1 = 1.0 - s;
+      v  = Yh[ndensecoef * nhvar + i];
+      dv = 0;
+      for (ip = ndensecoef - 2; ip >= 0; ip--) {
+        dv = ((ip % 2) ? s1 * dv - v : s * dv + v);
+        v  = Yh[(ip + 1) * nhvar + i] + ((ip % 2) ? s1 : s) * v;
+      }
+      if (val == 1)
+        res = v;
+      else                            /* derivative of the polynomial */
+        res = dv / hh;
+    }
+
   /* dense interpolation - radau - gets all values (i not used) */
   } else {
  //   if (val == 2)
  //     error("radau interpol = 2 does not work for lagderiv");
     j  = interval;
     Yh  = &histvar [j * offset];
-    histsave  = &histvar [j * offset + 4*n_eq];
+    histsave  = &histvar [j * offset + 4*nhvar];
     ip = i+1;
-    F77_CALL(contr5alone) (&ip, &n_eq, &t, Yh, &offset, histsave, &res, &val);
+    F77_CALL(contr5alone) (&ip, &nhvar, &t, Yh, &offset, histsave, &res, &val);
   }
   return(res);
 }
@@ -340,14 +470,8 @@ int findHistInt2 (double t) {
 }
 /* alternative: bisectioning... */
 
-int findHistInt (double t) {
+int findHistBisect (double t) {
   int ilo, ihi, imid, ii, n;
-  
-  if ( t >= histtime[indexhist]) 
-    return(indexhist);
-  if ( t < histtime[starthist])
-    error("illegal input in lagvalue - lag, %g, too large, at time = %g\n",
-      t, histtime[indexhist]);
 
   if (endreached == 0) {  /* still filling buffer; not yet wrapped */
     ilo = 0;
@@ -363,7 +487,7 @@ int findHistInt (double t) {
   }
   n = histsize -1;
   ilo = 0;
-  ihi = n;
+  ihi = nhist -1;
   for(;;) {
      imid = (ilo + ihi) / 2;
   
@@ -379,13 +503,204 @@ int findHistInt (double t) {
   }
 }
 
+/* bounded walk from interval j to the interval embracing t; -1 if too far */
+
+static int walkhist (int j, double t) {
+  int k;
+  
+  for (k = 0; k < MAXWALK; k++) {
+    if (t < histtime[j]) {           /* backward */
+      if (j == starthist) return(-1);
+      j = (j > 0) ? j - 1 : histsize - 1;
+    } else if (j == indexhist || t < histtime[nexthist(j)]) {
+      return(j);
+    } else {                         /* forward */
+      j = nexthist(j);
+    }
+  }
+  return(-1);
+}
+
+/* cursor-cached search: walk from the nearest cursor, else bisection */
+
+int findHistInt (double t) {
+  int j, k, kmin = -1;
+  double d, dmin = 0;
+  
+  if ( t >= histtime[indexhist]) 
+    return(indexhist);
+  if ( t < histtime[starthist])
+    error("illegal input in lagvalue - lag, %g, too large, at time = %g\n",
+      t, histtime[indexhist]);
+
+  for (k = 0; k < ncursor; k++) {
+    d = fabs(t - histcurtime[k]);
+    if (kmin < 0 || d < dmin) {
+      kmin = k;
+      dmin = d;
+    }
+  }
+  j = (kmin >= 0) ? walkhist(histcursor[kmin], t) : -1;
+  if (j < 0) {
+    j = findHistBisect(t);
+    if (ncursor < MAXCURSOR) kmin = ncursor++; /* probably a new delay */
+  }
+  histcursor[kmin]  = j;
+  histcurtime[kmin] = t;
+  return(j);
+}
+
+/*=========================================================================== 
+  variables nr[] (C-indices after subtracting ishift; all variables if
+  nr = NULL): position in the history arrays (ivar) and in the result (kvar);
+  if all variables are requested, those without history (lagvars) are NA
+  =========================================================================== */
+
+static int pastvars(int *nr, int ishift, int N, int *ivar, int *kvar) {
+  int i, k, nvar = 0;
+  
+  for (k = 0; k < N; k++) {
+    i = (nr == NULL) ? k : nr[k] - ishift;
+    if (i >= n_eq || i < 0)
+      error("illegal input in lagvalue - var nr too high, %i", i+1);
+    if (histvarmap[i] < 0) {
+      if (nr != NULL)
+        error("illegal input in lagvalue - history of var %i not stored (see 'lagvars')", i+1);
+    } else {
+      ivar[nvar] = histvarmap[i];
+      kvar[nvar++] = k;
+    }
+  }
+  return(nvar);
+}
+
+/*=========================================================================== 
+  past values (val=1) or past derivatives (val=2) of the nvar variables 
+  found by pastvars, at time t, in one pass; stored in res[kvar[k] * stride]
+  =========================================================================== */
+
+static void pastinterp(int nvar, int *ivar, int *kvar, int interval, double t,
+  int val, double *res, int stride) {
+  int i, k, j, jn;
+  double t0, t1, tt0, tt1, tt02, tt12, hh, w0, w1, wd0, wd1;
+  double *y0, *y1, *dy0, *dy1;
+
+  /* other interpolation methods: one variable at a time */
+  if (interpolMethod != 1) {
+    for (k = 0; k < nvar; k++)
+      res[kvar[k] * stride] = past(histvarind[ivar[k]], interval, t, val);
+    return;
+  }
+  
+  j   = interval;
+  t0  = histtime[j];
+  y0  = &histvar [j * nhvar];
+  dy0 = &histdvar [j * nhvar];
+
+  /* within last interval - for now: just extrapolate last value */
+  if (interval == indexhist) {
+    for (k = 0; k < nvar; k++) {
+      i = ivar[k];
+      res[kvar[k] * stride] = (val == 1) ? y0[i] + dy0[i] * (t - t0) : dy0[i];
+    }
+    return;
+  }
+
+  /* Hermite interpolation; the weights are the same for all variables */
+  jn  = nexthist(j);
+  t1  = histtime[jn];
+  y1  = &histvar [jn * nhvar];
+  dy1 = &histdvar [jn * nhvar];
+  hh  = t1 - t0;
+  if (hh == 0) {
+    for (k = 0; k < nvar; k++) {
+      i = ivar[k];
+      res[kvar[k] * stride] = (val == 1) ? y0[i] : dy0[i];
+    }
+    return;
+  }
+  tt0  = t - t0;
+  tt1  = t - t1;
+  tt12 = tt1 * tt1;
+  tt02 = tt0 * tt0;
+  if (val == 1) {
+    wd0 = tt0 * tt12 / (hh * hh);
+    wd1 = tt1 * tt02 / (hh * hh);
+    w0  =  (2.0 * tt0 + hh) * tt12 / (hh * hh * hh);
+    w1  = -(2.0 * tt1 - hh) * tt02 / (hh * hh * hh);
+  } else {
+    wd0 = (tt12 + 2.0 * tt0 * tt1) / (hh * hh);
+    wd1 = (tt02 + 2.0 * tt0 * tt1) / (hh * hh);
+    w0  =  2.0 * tt1 * (2.0 * tt0 + hh + tt1) / (hh * hh * hh);
+    w1  = -2.0 * tt0 * (2.0 * tt1 - hh + tt0) / (hh * hh * hh);
+  }
+  for (k = 0; k < nvar; k++) {
+    i = ivar[k];
+    res[kvar[k] * stride] = w0 * y0[i] + w1 * y1[i] + wd0 * dy0[i] + wd1 * dy1[i];
+  }
+}
+
+/*=========================================================================== 
+  past values or derivatives of N variables at one time, in one pass
+  =========================================================================== */
+
+void pastvec(int *nr, int ishift, int N, int interval, double t, int val,
+  double *res) {
+  int k, nvar, *ivar, *kvar;
+
+  growpastvars(N);
+  ivar = pastivar;
+  kvar = pastkvar;
+  nvar = pastvars(nr, ishift, N, ivar, kvar);
+  if (nvar < N) for (k = 0; k < N; k++) res[k] = NA_REAL;
+  pastinterp(nvar, ivar, kvar, interval, t, val, res, 1);
+}
+
+/*=========================================================================== 
+  past values or derivatives of N variables at nT times T[]; the result is 
+  a matrix with nT rows (times) and N columns (variables), res[k + nT * i].
+  The times are sorted, and their intervals in the history are found by 
+  walking forward from the previous one
+  =========================================================================== */
+
+void pastmulti(double *T, int nT, int *nr, int ishift, int N, int val,
+  double *res) {
+  int k, l, interval = -1, nvar, *ivar, *kvar, *index;
+  double *ts;
+
+  growpastvars(N);
+  ivar = pastivar;
+  kvar = pastkvar;
+  nvar = pastvars(nr, ishift, N, ivar, kvar);
+  if (nvar < N) for (k = 0; k < nT * N; k++) res[k] = NA_REAL;
+
+  if (nT > multisize) {
+    multits    = Realloc(multits, nT, double);
+    multiindex = Realloc(multiindex, nT, int);
+    multisize  = nT;
+  }
+  ts    = multits;
+  index = multiindex;
+  for (k = 0; k < nT; k++) {
+    ts[k] = T[k];
+    index[k] = k;
+  }
+  rsort_with_index(ts, index, nT);
+
+  for (l = 0; l < nT; l++) {
+    if (interval >= 0) interval = walkhist(interval, ts[l]);
+    if (interval < 0) interval = findHistInt(ts[l]);
+    pastinterp(nvar, ivar, kvar, interval, ts[l], val, &res[index[l]], nT);
+  }
+}
+
 /*=========================================================================== 
   C-equivalent of R-function lagvalue
   =========================================================================== */
 SEXP getLagValue(SEXP T, SEXP nr)
 {
   SEXP value;
-  int i, ilen, interval;
+  int ilen, interval;
   double t;
 
   ilen = LENGTH(nr);
@@ -393,19 +708,29 @@ SEXP getLagValue(SEXP T, SEXP nr)
     error("pastvalue can only be called from 'func' or 'res' when triggered by appropriate integrator.");
   if (!isNumeric(T)) error("t should be numeric");
 
+  /* several times: a matrix with one row per time */
+  if (LENGTH(T) > 1) {
+    PROTECT(T = coerceVector(T, REALSXP));
+    if ((ilen ==1) && (INTEGER(nr)[0] == 0)) {
+      PROTECT(value = allocMatrix(REALSXP, LENGTH(T), n_eq));
+      pastmulti(REAL(T), LENGTH(T), NULL, 0, n_eq, 1, REAL(value));
+    } else {
+      PROTECT(value = allocMatrix(REALSXP, LENGTH(T), ilen));
+      pastmulti(REAL(T), LENGTH(T), INTEGER(nr), 1, ilen, 1, REAL(value));
+    }
+    UNPROTECT(2);
+    return(value);
+  }
+
   t = *NUMERIC_POINTER(T);
   interval = findHistInt (t);
 
   if ((ilen ==1) && (INTEGER(nr)[0] == 0)) {
     PROTECT(value=NEW_NUMERIC(n_eq));
-    for(i=0; i<n_eq; i++) {
-      NUMERIC_POINTER(value)[i] = past(i, interval, t, 1);
-    }
+    pastvec(NULL, 0, n_eq, interval, t, 1, NUMERIC_POINTER(value));
   } else {
     PROTECT(value=NEW_NUMERIC(ilen));
-    for(i=0; i<ilen; i++) {
-    NUMERIC_POINTER(value)[i] = past(INTEGER(nr)[i]-1, interval, t, 1);
-    }
+    pastvec(INTEGER(nr), 1, ilen, interval, t, 1, NUMERIC_POINTER(value));
   }
   
   UNPROTECT(1);
@@ -418,7 +743,7 @@ SEXP getLagValue(SEXP T, SEXP nr)
 SEXP getLagDeriv(SEXP T, SEXP nr)
 {
   SEXP value;
-  int i, ilen, interval;
+  int ilen, interval;
   double t;
 
   ilen = LENGTH(nr);
@@ -426,33 +751,53 @@ SEXP getLagDeriv(SEXP T, SEXP nr)
     error("pastgradient can only be called from 'func' or 'res' when triggered by appropriate integrator.");
   if (!isNumeric(T)) error("'t' should be numeric");
 
+  /* several times: a matrix with one row per time */
+  if (LENGTH(T) > 1) {
+    PROTECT(T = coerceVector(T, REALSXP));
+    if ((ilen ==1) && (INTEGER(nr)[0] == 0)) {
+      PROTECT(value = allocMatrix(REALSXP, LENGTH(T), n_eq));
+      pastmulti(REAL(T), LENGTH(T), NULL, 0, n_eq, 2, REAL(value));
+    } else {
+      PROTECT(value = allocMatrix(REALSXP, LENGTH(T), ilen));
+      pastmulti(REAL(T), LENGTH(T), INTEGER(nr), 1, ilen, 2, REAL(value));
+    }
+    UNPROTECT(2);
+    return(value);
+  }
+
   t = *NUMERIC_POINTER(T);
   interval = findHistInt (t);
 
   if ((ilen ==1) && (INTEGER(nr)[0] == 0)) {
     PROTECT(value=NEW_NUMERIC(n_eq));
-    for(i=0; i<n_eq; i++) {
-      NUMERIC_POINTER(value)[i] = past(i, interval, t, 2);
-    }
+    pastvec(NULL, 0, n_eq, interval, t, 2, NUMERIC_POINTER(value));
   } else {
     PROTECT(value=NEW_NUMERIC(ilen));
-    for(i=0; i<ilen; i++) {                                              
-      NUMERIC_POINTER(value)[i] = past(INTEGER(nr)[i]-1, interval, t, 2);
-    }
+    pastvec(INTEGER(nr), 1, ilen, interval, t, 2, NUMERIC_POINTER(value));
   }
   UNPROTECT(1);
   return(value);
 }
 
 
+/* ============================================================================
+  Breakpoints of the delays (lags$breaks, sorted): derivative discontinuities
+  propagated from the initial time; solvers do not step over them
+   ==========================================================================*/
+
+double nextlagbreak(double t) {
+  while (ilagbreak < nlagbreaks && lagbreaks[ilagbreak] <= t) ilagbreak++;
+  return((ilagbreak < nlagbreaks) ? lagbreaks[ilagbreak] : DBL_MAX);
+}
+
 /* ============================================================================
   Interrogate the lag settings as in an R-list   
    ==========================================================================*/
 
 int initLags(SEXP elag, int solver, int nroot) {
 
-  SEXP Mxhist, Islag, Interpol ;       
-  int mxhist, islag;
+  SEXP Mxhist, Islag, Interpol, Lagvars, Taumax, Grow, Breaks;       
+  int mxhist, islag, i, j;
     
   Islag = getListElement(elag, "islag");
   islag = INTEGER(Islag)[0];
@@ -466,7 +811,41 @@ int initLags(SEXP elag, int solver, int nroot) {
    if ((interpolMethod == 2) && (solver == 10)) interpolMethod = 3; /* radau */
 //   if((solver == 7 || solver == 3) && interpolMethod == 2)
 //     error("cannot combine lags in lsodes, with interpol=2");
+
+   /* variables with history: all, or only those in lags$lagvars */
+   histvarmap = (int *) R_alloc (n_eq, sizeof(int));
+   histvarind = (int *) R_alloc (n_eq, sizeof(int));
+   Lagvars = getListElement(elag, "lagvars");
+   if (isNull(Lagvars)) {
+     nhvar = n_eq;
+     for (i = 0; i < n_eq; i++) histvarmap[i] = histvarind[i] = i;
+   } else {
+     for (i = 0; i < n_eq; i++) histvarmap[i] = -1;
+     nhvar = 0;
+     for (j = 0; j < LENGTH(Lagvars); j++) {
+       i = INTEGER(Lagvars)[j] - 1;
+       if (i < 0 || i >= n_eq)
+         error("illegal input in lags - 'lagvars' %i not in 1 ... %i", i+1, n_eq);
+       if (histvarmap[i] < 0) {
+         histvarmap[i] = nhvar;
+         histvarind[nhvar++] = i;
+       }
+     }
+     if (nhvar == 0) error("illegal input in lags - 'lagvars' is empty");
+   }
+
+   /* bounded horizon (taumax) and/or growing history buffer */
+   Taumax = getListElement(elag, "taumax");
+   histtaumax = (isNull(Taumax)) ? 0 : REAL(Taumax)[0];
+   Grow = getListElement(elag, "grow");
+   histgrow = (histtaumax > 0 || (!isNull(Grow) && INTEGER(Grow)[0]));
    inithist(mxhist, 1, solver, nroot);
+
+   /* breakpoints */
+   Breaks = getListElement(elag, "breaks");
+   nlagbreaks = (isNull(Breaks)) ? 0 : LENGTH(Breaks);
+   lagbreaks = (nlagbreaks > 0) ? REAL(Breaks) : NULL;
+   ilagbreak = 0;
   } else {
     mxhist = 0;
     interpolMethod = 1;
@@ -482,23 +861,37 @@ int initLags(SEXP elag, int solver, int nroot) {
   =========================================================================== */
 
 void lagvalue(double T, int *nr, int N, double *ytau) {
-  int i, interval;
+  int interval;
 
   if (initialisehist == 0)
     error("pastvalue can only be called from 'func' or 'res' when triggered by appropriate integrator.");
 
   interval = findHistInt(T);
-  for(i = 0; i < N; i++)  ytau[i] = past(nr[i], interval, T, 1);
+  pastvec(nr, 0, N, interval, T, 1, ytau);
 }
 
 void lagderiv(double T, int *nr, int N, double *ytau) {
-  int i, interval;
+  int interval;
 
   if (initialisehist == 0)
     error("pastvalue can only be called from 'func' or 'res' when triggered by appropriate integrator.");
 
   interval = findHistInt(T);
+  pastvec(nr, 0, N, interval, T, 2, ytau);
+}
+
+/* several times T[nT] at once; ytau[k + nT * i] is variable nr[i] at T[k] */
 
-  for(i = 0; i < N; i++)  ytau[i] = past(nr[i], interval, T, 2);
+void lagvalues(double *T, int nT, int *nr, int N, double *ytau) {
+  if (initialisehist == 0)
+    error("pastvalue can only be called from 'func' or 'res' when triggered by appropriate integrator.");
+
+  pastmulti(T, nT, nr, 0, N, 1, ytau);
 }
 
+void lagderivs(double *T, int nT, int *nr, int N, double *ytau) {
+  if (initialisehist == 0)
+    error("pastvalue can only be called from 'func' or 'res' when triggered by appropriate integrator.");
+
+  pastmulti(T, nT, nr, 0, N, 2, ytau);
+}
@@ -13,102 +13,158 @@ void rk_auto(
        int fsal, int neq, int stage,
        int isDll, int isForcing, int verbose,
        int nknots, int interpolate, int densetype, int maxsteps, int nt,
+       int nroot, int isEvent, int isLag, int kernel,
        /* int pointers */
        int* _iknots, int* _it, int* _it_ext, int* _it_tot, int* _it_rej,
-       int* istate,  int* ipar,
+       int* istate,  int* ipar, int* _iroot, int* jroot,
        /* double */
        double t, double tmax, double hmin, double hmax, 
-       double alpha, double beta,
-       /* double pointers */
-       double* _dt, double* _errold,
+       /* pointers */
+       double* _dt, rk_control* ctl, rk_switch* sw, rk_dense* dn,
        /* arrays */
        double* tt, double* y0, double* y1, double* y2, double* dy1, double* dy2,
        double* f, double* y, double* Fj, double* tmp,
        double* FF, double* rr, double* A, double* out, 
-       double* bb1, double* bb2, double* cc, double* dd, 
+       double* bb1, double* bb2, double* cc,
        double* atol, double* rtol, double* yknots, double* yout,
+       double* gold, double* gnew,
        /* SEXPs */
-       SEXP Func, SEXP Parms, SEXP Rho
+       SEXP Func, SEXP Parms, SEXP Rho, SEXP Rootfunc
   ) 
 {
 
-  int i = 0, j = 0, j1 = 0, k = 0, accept = FALSE, nreject = *_it_rej, one = 1; 
+  int i = 0, j = 0, j1 = 0, accept = FALSE, nreject = *_it_rej;
   int iknots = *_iknots, it = *_it, it_ext = *_it_ext, it_tot = *_it_tot;
-  double err, dtnew, t_ext;
-  double dt = *_dt, errold = *_errold;
-
-  /* todo: make this user adjustable */
-  static const double minscale = 0.2, maxscale = 10.0, safe = 0.9;
+  int iroot = *_iroot, isroot = FALSE, restart = FALSE, iterm, ievent;
+  int evstep = FALSE, lagstep = FALSE, dtype = densetype, stiff = FALSE;
+  int hasf1 = FALSE, densok = FALSE;
+  double err, dtnew, t_ext, tend, pt, tbreak = 0;
+  /* f(t + dt, y2): a stage of the continuous extension, or the last one */
+  double *f1 = (dn->ndense > stage) ? dy2 : FF + neq * (stage - 1);
+  double dt = *_dt;
 
   /*------------------------------------------------------------------------*/
   /* Main Loop                                                              */
   /*------------------------------------------------------------------------*/
   do {
+    /* events at fixed times are breakpoints: the step ends exactly there */
+    evstep = FALSE;
+    if (isEvent && !rootevent && iEvent < nEvent && 
+        tEvent > t && tEvent <= t + dt) {
+      dt = tEvent - t;
+      evstep = TRUE;
+    }
+    /* the same for the breakpoints of the delays (see dede) */
+    lagstep = FALSE;
+    if (isLag) {
+      tbreak = nextlagbreak(t);
+      if (tbreak <= t + dt) {
+        if (evstep && tbreak < tEvent) evstep = FALSE;
+        dt = tbreak - t;
+        lagstep = TRUE;
+      }
+    }
     if (accept) timesteps[0] = timesteps[1];
     timesteps[1] = dt;
 
+    /* explicit or (after automatic switching) linearly implicit step;
+       the latter uses the Hermite polynomial for dense output */
+    stiff = sw->on && sw->stiff;
+    dtype = (stiff) ? 3 : densetype;
+    /* f(t + dt, y2) is needed for the dense output (and stiff steps) */
+    hasf1 = stiff || (interpolate && (dtype == 3 || 
+                      (dtype == 1 && dn->ndense > stage)));
+
     /*  save former results of last step if the method allows this
        (first same as last)                                             */
     /* Karline: improve by saving "accepted" FF, use this when rejected */
-    if (fsal && accept){
+    if (fsal && accept && !restart && !sw->fstiff){
       j1 = 1;
       for (i = 0; i < neq; i++) FF[i] = FF[i + neq * (stage - 1)];
+    } else if (((interpolate && (densetype == 3 || dn->ndense > stage)) 
+                || sw->fstiff) && accept && !restart) {
+      /* f(t, y0) was already needed for the dense output */
+      j1 = 1;
+      for (i = 0; i < neq; i++) FF[i] = dy2[i];
+    } else if (stiff && !accept && sw->jacok && !restart) {
+      /* rejected Rosenbrock step: f(t, y0) and J are still valid */
+      j1 = 1;
     } else {
       j1 = 0;
     }
-    /******  Prepare Coefficients from Butcher table ******/
-    for (j = j1; j < stage; j++) {
-      for(i = 0; i < neq; i++) Fj[i] = 0;
-        k = 0;
-        while(k < j) {
-          for(i = 0; i < neq; i++)
-            Fj[i] = Fj[i] + A[j + stage * k] * FF[i + neq * k] * dt;
-          k++;
+    restart = FALSE;
+
+    if (stiff) {
+      /* Rosenbrock step; J and df/dt are kept for rejected steps */
+      if (j1 == 0)
+        derivs(Func, t, y0, Parms, Rho, FF, out, 0, neq, 
+               ipar, isDll, isForcing);
+      if (!sw->jacok) {
+        rosjac(sw, Func, Parms, Rho, t, y0, FF, tmp, out, neq, 
+               ipar, isDll, isForcing);
+        sw->njac++;
+        sw->jacok = TRUE;
+      }
+      err = rosstep(sw, neq, t, dt, y0, FF, tmp, y2, atol, rtol, out,
+        Func, Parms, Rho, ipar, isDll, isForcing);
+      sw->nlu++;
+      sw->nstep++;
+      sw->nfun += sw->ros->stage - 1 + (j1 == 0);
+      if (err < 0) 
+        err = 1e10;  /* singular matrix: reduce step size */
+      else if (err > 0) /* error scaled to the order of the explicit method */
+        err = pow(err, sw->qerr / sw->ros->qerr);
+    } else {
+      /******  Prepare Coefficients from Butcher table ******/
+      for (j = j1; j < stage; j++) {
+        if (kernel) {
+          /* unrolled stage of a built-in method */
+          rk_kernelstage(kernel, j, neq, dt, y0, FF, tmp);
+        } else {
+          rkstage(j, stage, neq, dt, A, FF, y0, tmp);
         }
-        for (int i = 0; i < neq; i++) {
-          tmp[i] = Fj[i] + y0[i];
+          /******  Compute Derivatives ******/
+          /* pass option to avoid unnecessary copying in derivs */
+          derivs(Func, t + dt * cc[j], tmp, Parms, Rho, FF, out, j, neq, 
+                 ipar, isDll, isForcing);
+        /* stiffness: dt * |lambda| from two stages at the same time */
+        if (sw->on && j == sw->ist1)
+          for (i = 0; i < neq; i++) sw->ysti[i] = tmp[i];
+        if (sw->on && j == sw->ist2) {
+          double num = 0, den = 0, *F1 = FF + neq * sw->ist1, *F2 = FF + neq * j;
+          for (i = 0; i < neq; i++) {
+            num += (F2[i] - F1[i]) * (F2[i] - F1[i]);
+            den += (tmp[i] - sw->ysti[i]) * (tmp[i] - sw->ysti[i]);
+          }
+          sw->hlamb = (den > 0) ? dt * sqrt(num/den) : 0;
         }
-        /******  Compute Derivatives ******/
-        /* pass option to avoid unnecessary copying in derivs */
-        derivs(Func, t + dt * cc[j], tmp, Parms, Rho, FF, out, j, neq, 
-               ipar, isDll, isForcing);
-    }
-
-    /*====================================================================*/
-    /* Estimation of new values                                           */
-    /*====================================================================*/
+      }
 
-    /* use BLAS wrapper with reduced error checking */
-    blas_matprod1(FF, neq, stage, bb1, stage, one, dy1);
-    blas_matprod1(FF, neq, stage, bb2, stage, one, dy2);
+      /*==================================================================*/
+      /* Estimation of new values                                         */
+      /*==================================================================*/
 
+      if (kernel) {
+        /* y1, y2 and error norm in one pass */
+        err = rk_kernelstep(kernel, neq, dt, y0, FF, y1, y2, atol, rtol);
+      } else {
+        /* y1, y2 and error norm in one blocked sweep over the state */
+        err = rkstep(stage, neq, dt, bb1, bb2, FF, y0, y1, y2, atol, rtol);
+      }
+    } /* end of explicit step */
     it_tot++; /* count total number of time steps */
-    for (i = 0; i < neq; i++) {
-      y1[i] = y0[i] + dt * dy1[i];
-      y2[i] = y0[i] + dt * dy2[i];
-    }
 
     /*====================================================================*/
     /*      stepsize adjustment                                           */
     /*====================================================================*/
     
-    err = maxerr(y0, y1, y2, atol, rtol, neq);
-    dtnew = dt;
-    if (err == 0) {  /* use max scale if all tolerances are zero */
-      dtnew  = fmin(dt * 10, hmax);
-      errold = fmax(err, 1e-4); /* 1e-4 taken from Press et al. */
-      accept = TRUE;
-    } else if (err < 1.0) {
-      /* increase step size only if last one was accepted */
-      if (accept) 
-        dtnew = fmin(hmax, dt * 
-          fmin(safe * pow(err, -alpha) * pow(errold, beta), maxscale));
-      errold = fmax(err, 1e-4); /* 1e-4 taken from Press et al. */
+    dtnew = dt * rkcontrol(ctl, err, accept);
+    if (err < 1.0) {
+      dtnew  = fmin(dtnew, hmax);
       accept = TRUE;
     } else if (err > 1.0) {
       nreject++;    /* count total number of rejected steps */
       accept = FALSE;
-      dtnew = dt * fmax(safe * pow(err, -alpha), minscale);
     }
 
     if (dtnew < hmin) {
@@ -117,20 +173,69 @@ void rk_auto(
       istate[0] = -2;
       dtnew = hmin;
     }
+    rkcontrol_update(ctl, dt, dtnew, accept);
     /*====================================================================*/
     /*      Interpolation and Data Storage                                */
     /*====================================================================*/
     if (accept) {
+      tend = (evstep) ? tEvent : t + dt;  /* end of the valid part of this step */
+      /* dense output of Cash-Karp and Hermite polynomials need f(t+dt, y2) */
+      if (interpolate && dtype == 2) 
+        derivs(Func, t + dt, y2, Parms, Rho, dy2, out, 0, neq, 
+               ipar, isDll, isForcing);
+      if (hasf1) {
+        if (fsal && !stiff)
+          for (i = 0; i < neq; i++) dy2[i] = FF[i + neq * (stage - 1)];
+        else
+          derivs(Func, t + dt, y2, Parms, Rho, dy2, out, 0, neq, 
+                 ipar, isDll, isForcing);
+        if (stiff) sw->nfun++;
+      }
+      /* continuous extension of the step; its additional stages are only
+         computed for outputs, roots and the history of delays */
+      densok = FALSE;
+      if (interpolate && dtype == 1 && (isLag || tt[it_ext] <= tend)) {
+        densstages(dn, Func, Parms, Rho, t, dt, y0, FF, f1, tmp, out, neq,
+                   stage, ipar, isDll, isForcing);
+        denspar(FF, y0, y2, f1, dt, dn, neq, rr);
+        densok = TRUE;
+      }
+
+      /*--------------------------------------------------------------------*/
+      /* root finding on the continuous extension of the step               */
+      /*--------------------------------------------------------------------*/
+      isroot = FALSE;
+      if (nroot > 0) {
+        rootvalue(Rootfunc, Rho, t + dt, y2, gnew, neq, nroot, isDll);
+        if (rootchange(gold, gnew, nroot)) {
+          if ((!interpolate || dtype == 0) && !stiff)
+            derivs(Func, t + dt, y2, Parms, Rho, dy2, out, 0, neq, 
+                   ipar, isDll, isForcing);
+          if (interpolate && dtype == 1 && !densok) {
+            densstages(dn, Func, Parms, Rho, t, dt, y0, FF, f1, tmp, out, neq,
+                       stage, ipar, isDll, isForcing);
+            denspar(FF, y0, y2, f1, dt, dn, neq, rr);
+            densok = TRUE;
+          }
+          tend = rootlocate((interpolate) ? dtype : 0, neq, nroot, isDll,
+            t, dt, rr, dn->nr, y0, y2, FF, dy2, gold, gnew, jroot, tmp,
+            Rootfunc, Rho);
+          isroot = TRUE;
+          if (tend < t + dt) evstep = FALSE; /* root before the event */
+        }
+      }
+
       if (interpolate) {
       /*--------------------------------------------------------------------*/
       /* case A1) "dense output type 1": built-in polynomial interpolation  */
       /* available for certain rk formulae, e.g. for rk45dp7                */
+      /* or type 3: cubic Hermite polynomial from y and f at both ends      */
       /*--------------------------------------------------------------------*/
-      if (densetype == 1) {
-        denspar(FF, y0, y2, dt, dd, neq, stage, rr);
+      if (dtype == 1 || dtype == 3) {
         t_ext = tt[it_ext];
-        while (t_ext <= t + dt) {
-          densout(rr, t, t_ext, dt, tmp, neq);
+        while (t_ext <= tend) {
+          densevalue(dtype, t, t_ext, dt, rr, dn->nr, y0, y2, FF, dy2, tmp,
+                     neq);
           /* store outputs */
           if (it_ext < nt) {
             yout[it_ext] = t_ext;
@@ -143,13 +248,10 @@ void rk_auto(
         /*--------------------------------------------------------------------*/
         /* case A2) dense output type 2: the Cash-Karp method                 */
         /*--------------------------------------------------------------------*/
-      } else if (densetype == 2)  {   /* dense output method 2 = Cash-Karp */
-        derivs(Func, t + dt, y2, Parms, Rho, dy2, out, 0, neq, 
-               ipar, isDll, isForcing);
-        
+      } else if (dtype == 2)  {   /* dense output method 2 = Cash-Karp */
         t_ext = tt[it_ext];
 
-        while (t_ext <= t + dt) {
+        while (t_ext <= tend) {
           densoutck(t, t_ext, dt, y0, FF, dy2, tmp, neq);
           /* store outputs */
           if (it_ext < nt) {
@@ -195,11 +297,115 @@ void rk_auto(
         /*--------------------------------------------------------------------*/
       }
       /*--------------------------------------------------------------------*/
+      /* step ends at a root: state at the root from the continuous         */
+      /* extension; it has already been used for all outputs before         */
+      /*--------------------------------------------------------------------*/
+      if (isroot) {
+        densevalue((interpolate) ? dtype : 0, t, tend, dt, rr, dn->nr, y0, y2,
+          FF, dy2, tmp, neq);
+        for (i = 0; i < neq; i++) y2[i] = tmp[i];
+        ctl->hsum += (tend - t) - dt;  /* the step was shortened */
+        dt = tend - t;
+      }
+      /*--------------------------------------------------------------------*/
       /* next time step                                                     */
       /*--------------------------------------------------------------------*/
-      t = t + dt;
+      if (evstep)
+        t = tEvent;
+      else if (lagstep && !isroot)
+        t = tbreak;
+      else
+        t = t + dt;
       it++;
       for (i=0; i < neq; i++) y0[i] = y2[i];
+
+      /* automatic switching between explicit and stiff method */
+      if (sw->on && !sw->pure) {
+        if (stiff) sw->hlamb = dt * rosradius(neq, sw->J, tmp, sw->ftmp);
+        rkswitch(sw, t, verbose);
+      }
+      sw->fstiff = stiff;
+      sw->jacok = FALSE;
+
+      /* history for delay differential equations (before events) */
+      if (isLag) {
+        if (fsal && !stiff && !isroot)
+          for (i = 0; i < neq; i++) dy2[i] = FF[i + neq * (stage - 1)];
+        else if (!(hasf1 && !isroot))
+          derivs(Func, t, y0, Parms, Rho, dy2, out, 0, neq, 
+                 ipar, isDll, isForcing);
+        updatehist(t, y0, dy2, rr, NULL);
+      }
+
+      /*--------------------------------------------------------------------*/
+      /* event: change the state and restart the method at the event time;  */
+      /* outputs at the event time contain the state before the event       */
+      /*--------------------------------------------------------------------*/
+      if (evstep) {
+        updateevent(&t, y0, &ievent);
+        restart = TRUE;
+        if (interpolate && densetype == 0) {
+          knotsout(yknots, nknots, iknots, neq, t, tt, &it_ext, nt, yout, tmp);
+          yknots[0] = t;
+          for (i = 0; i < neq; i++) yknots[nknots * (1 + i)] = y0[i];
+          iknots = 1;
+        }
+        if (nroot > 0 && !isroot) 
+          rootvalue(Rootfunc, Rho, t, y0, gnew, neq, nroot, isDll);
+      }
+
+      /*--------------------------------------------------------------------*/
+      /* root found: trigger an event, or stop the simulation               */
+      /* (similar to lsodar, see call_lsoda.c)                              */
+      /*--------------------------------------------------------------------*/
+      if (isroot) {
+        if (isEvent && rootevent) {
+          if (iroot < Rootsave) {
+            troot[iroot] = t;
+            for (i = 0; i < nroot; i++)
+              if (jroot[i] == 1) nrroot[iroot] = i + 1;
+            for (i = 0; i < neq; i++)
+              valroot[iroot * neq + i] = y0[i];
+          }
+          iroot++;
+          iterm = 0;      /* check if simulation should be terminated */
+          for (i = 0; i < nroot; i++)
+            if (jroot[i] == 1 && termroot[i] == 1) iterm = 1;
+          if (iterm == 0) {
+            pt = tEvent;
+            tEvent = t;
+            updateevent(&t, y0, &ievent);
+            tEvent = pt;
+            restart = TRUE;   /* derivatives of the last step are invalid */
+            if (verbose) Rprintf("root found at time %g\n", t);
+          } else {
+            istate[0] = -30;
+            if (verbose) Rprintf("TERMINAL root found at time %g\n", t);
+          }
+        } else {
+          istate[0] = -20;
+        }
+        if (istate[0] <= -20) {
+          /* store the state at the root as the last output, unless the
+             root is on an output time and its row is already written */
+          if (it_ext > 0 && yout[it_ext - 1] == t)
+            it_ext--;
+          else if (it_ext < nt && !(it_ext == nt - 1 && yout[it_ext] == tt[it_ext])) {
+            yout[it_ext] = t;
+            for (i = 0; i < neq; i++) yout[it_ext + nt * (1 + i)] = y0[i];
+          }
+          break;
+        }
+        rootvalue(Rootfunc, Rho, t, y0, gold, neq, nroot, isDll);
+      } else if (nroot > 0) {
+        for (i = 0; i < nroot; i++) gold[i] = gnew[i];
+      }
+      /* history restarts with the state after an event */
+      if (isLag && restart) {
+        derivs(Func, t, y0, Parms, Rho, dy2, out, 0, neq, 
+               ipar, isDll, isForcing);
+        updatehist(t, y0, dy2, rr, NULL);
+      }
     } /* else rejected time step */
     dt = fmin(dtnew, tmax - t);
     if (it_ext > nt) {
@@ -216,5 +422,5 @@ void rk_auto(
 
   /* return reference values */
   *_iknots = iknots; *_it = it; *_it_ext = it_ext; *_it_rej = nreject;
-  *_it_tot = it_tot; *_dt = dtnew; *_errold = errold;
+  *_it_tot = it_tot; *_dt = dtnew; *_iroot = iroot;
 }
@@ -0,0 +1,147 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >= 2                 */
+/* Step size controller for the adaptive RK solvers                         */
+/*==========================================================================*/
+/*
+  The new step size is dtnew = rho * dt with the digital filter of
+  Soederlind (2003):
+
+    rho = safe * err^(-k1) * err1^(-k2) * err2^(-k3) * rho1^(-a2) * rho2^(-a3)
+
+  where err, err1, err2 are the error norms of the current and the two
+  previous accepted steps and rho1, rho2 the last two step size ratios.
+  The exponents k1, k2, k3 are the filter coefficients divided by the
+  order Qerr of the method. The classical PI controller of deSolve
+  (alpha, beta) is the special case k1 = alpha, k2 = -beta.
+
+  rho is optionally smoothed with the limiter 1 + kappa * atan((rho-1)/kappa)
+  and bounded by maxscale; a digital filter can also decrease the step
+  size after an accepted step, down to minscale. The default PI controller
+  gives the same steps as the former code in rk_auto. After a rejected
+  step, the step size is never increased, and it is bounded by minscale.
+*/
+
+#include "rk_util.h"
+
+void rkcontrol_init(rk_control *ctl, SEXP Method, double qerr) {
+  SEXP Alpha, Beta, Ctl, R_x;
+  double alpha, beta = 0;    /* 0.4/qerr; */
+
+  PROTECT(Beta = getListElement(Method, "beta"));
+  if (length(Beta)) beta = REAL(Beta)[0];
+
+  alpha = 1/qerr - 0.75 * beta;
+  PROTECT(Alpha = getListElement(Method, "alpha"));
+  if (length(Alpha)) alpha = REAL(Alpha)[0];
+
+  /* default: classical PI controller */
+  ctl->k1 = alpha; ctl->k2 = -beta; ctl->k3 = 0;
+  ctl->a2 = 0;     ctl->a3 = 0;
+  ctl->krej = alpha;
+  ctl->filter = FALSE;
+
+  /* digital filter: c(b1, b2, b3, a2, a3), already checked by rkMethod */
+  PROTECT(Ctl = getListElement(Method, "controller"));
+  if (length(Ctl) == 5) {
+    double *cf = REAL(Ctl);
+    ctl->k1 = cf[0]/qerr; ctl->k2 = cf[1]/qerr; ctl->k3 = cf[2]/qerr;
+    ctl->a2 = cf[3];      ctl->a3 = cf[4];
+    ctl->krej = 1/qerr;
+    ctl->filter = TRUE;
+  }
+
+  ctl->safe = 0.9; ctl->minscale = 0.2; ctl->maxscale = 10.0;
+  ctl->limiter = 0;
+  PROTECT(R_x = getListElement(Method, "safe"));
+  if (length(R_x)) ctl->safe = REAL(R_x)[0];
+  PROTECT(R_x = getListElement(Method, "minscale"));
+  if (length(R_x)) ctl->minscale = REAL(R_x)[0];
+  PROTECT(R_x = getListElement(Method, "maxscale"));
+  if (length(R_x)) ctl->maxscale = REAL(R_x)[0];
+  PROTECT(R_x = getListElement(Method, "limiter"));
+  if (length(R_x)) ctl->limiter = REAL(R_x)[0];
+  UNPROTECT(7);
+
+  if (ctl->safe <= 0 || ctl->safe > 1)
+    error("safety factor 'safe' must be in (0, 1]");
+  if (ctl->minscale <= 0 || ctl->minscale > 1 || ctl->maxscale < 1)
+    error("step size bounds need 0 < minscale <= 1 <= maxscale");
+  if (ctl->limiter < 0)
+    error("'limiter' must be non-negative");
+
+  ctl->err1 = 1.0; ctl->err2 = 1.0;
+  ctl->rho1 = 1.0; ctl->rho2 = 1.0;
+
+  ctl->naccept = 0; ctl->nreject = 0;
+  ctl->nclust  = 0; ctl->maxclust = 0; ctl->run = 0;
+  ctl->hsum = 0; ctl->hmin = 0; ctl->hmax = 0; ctl->hlast = 0;
+}
+
+/* step size ratio for the error norm err of the current step;
+   accept tells if the previous step was accepted */
+double rkcontrol(rk_control *ctl, double err, int accept) {
+  double rho = 1.0, kappa = ctl->limiter;
+
+  if (err == 0) {  /* use max scale if all tolerances are zero */
+    rho = ctl->maxscale;
+  } else if (err < 1.0) {
+    /* increase step size only if last one was accepted */
+    if (accept) {
+      rho = ctl->safe * pow(err, -ctl->k1) * pow(ctl->err1, -ctl->k2)
+        * pow(ctl->err2, -ctl->k3)
+        * pow(ctl->rho1, -ctl->a2) * pow(ctl->rho2, -ctl->a3);
+      if (kappa > 0) rho = 1 + kappa * atan((rho - 1)/kappa);
+      rho = fmin(rho, ctl->maxscale);
+      if (ctl->filter) rho = fmax(rho, ctl->minscale);
+    }
+  } else if (err > 1.0) {
+    rho = fmax(ctl->safe * pow(err, -ctl->krej), ctl->minscale);
+    return(fmin(rho, 1.0));
+  } else {
+    return(rho);   /* err == 1: same step size, error history unchanged */
+  }
+  ctl->err2 = ctl->err1;
+  ctl->err1 = fmax(err, 1e-4); /* 1e-4 taken from Press et al. */
+  return(rho);
+}
+
+/* statistics and step size history after the decision about a step */
+void rkcontrol_update(rk_control *ctl, double dt, double dtnew, int accept) {
+  if (accept) {
+    ctl->hsum += dt;
+    if (ctl->naccept == 0 || dt < ctl->hmin) ctl->hmin = dt;
+    if (ctl->naccept == 0 || dt > ctl->hmax) ctl->hmax = dt;
+    ctl->naccept++;
+    ctl->hlast = dt;
+    ctl->run = 0;
+    ctl->rho2 = ctl->rho1;
+    ctl->rho1 = dtnew/dt;
+  } else {
+    ctl->nreject++;
+    if (ctl->run == 0) ctl->nclust++; /* first of a cluster of rejections */
+    ctl->run++;
+    if (ctl->run > ctl->maxclust) ctl->maxclust = ctl->run;
+    ctl->rho1 *= dtnew/dt; /* h(n) / h(n-1) includes the rejections */
+  }
+}
+
+/* controller statistics as attribute "rstate" of the output */
+void rkcontrol_rstate(SEXP R_yout, rk_control *ctl, double dtnext, double t0,
+  double tswitch) {
+  SEXP R_rstate;
+  double *rstate;
+
+  PROTECT(R_rstate = allocVector(REALSXP, 9));
+  rstate = REAL(R_rstate);
+  rstate[0] = ctl->hlast;                 /* last step size used */
+  rstate[1] = dtnext;                     /* step size to be tried next */
+  rstate[2] = t0 + ctl->hsum;             /* time reached */
+  rstate[3] = (ctl->naccept > 0) ? ctl->hsum / ctl->naccept : 0;
+  rstate[4] = ctl->hmin;                  /* smallest accepted step */
+  rstate[5] = ctl->hmax;                  /* largest accepted step */
+  rstate[6] = ctl->nclust;                /* number of rejection clusters */
+  rstate[7] = ctl->maxclust;              /* longest cluster of rejections */
+  rstate[8] = tswitch;                    /* t of the last method switch */
+  setAttrib(R_yout, install("rstate"), R_rstate);
+  UNPROTECT(1);
+}
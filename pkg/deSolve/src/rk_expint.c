@@ -0,0 +1,496 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >= 2                 */
+/* Exponential Rosenbrock methods with Krylov phi-functions                 */
+/* -- main loop == core function --                                         */
+/*==========================================================================*/
+/*
+  dy/dt = f(t, y) = L y + N(t, y) with a stiff linear part L (e.g.
+  diffusion), either given as an operator (Linfunc returns L v) or
+  contained in N. Exponential Rosenbrock methods (Hochbruck, Ostermann and
+  Schweitzer 2009) linearize at the beginning of each step,
+
+    f(t, y) = f(t0, y0) + J (y - y0) + (t - t0) v + g(t, y),
+
+  and integrate the linear part exactly with the functions
+  phi_k(z) = sum_j z^j / (j + k)! of h J. The remainders g are evaluated
+  at the stages only, so the step size follows the nonlinearity:
+
+  exprb32 (order 3, embedded 2):
+    U2 = y0 + h phi1 f0 + h^2 phi2 v
+    y1 = U2 + 2 h phi3 D2,  D2 = f(t0 + h, U2) - f0 - J (U2 - y0) - h v
+  exprb43 (order 4, embedded 3):
+    U2 = y0 + h/2 phi1(h/2 J) f0 + h^2/4 phi2(h/2 J) v
+    U3 = y0 + h phi1 (f0 + D2) + h^2 phi2 v
+    y1 = y0 + h phi1 f0 + h^2 phi2 v + h (16 phi3 - 48 phi4) D2
+            + h (-2 phi3 + 12 phi4) D3
+
+  J is never formed; its products with vectors are forward differences of
+  N plus L v. The linear combinations of phi-functions are the solutions
+  of one augmented linear ODE each, exp(h A) e_{n+p} with
+  A = [[J, W], [0, K]] (Al-Mohy and Higham 2011), and are approximated in
+  the Krylov space of A (Arnoldi process) with the error estimate of Saad
+  (1992), in substeps if the Krylov space of maximal dimension is not
+  sufficient for the whole step. No large matrix is stored or
+  decomposed.
+
+  Outputs are interpolated with cubic Hermite polynomials; the steps end
+  exactly at the events.
+*/
+
+#include "rk_util.h"
+
+void F77_NAME(dgefa)(double*, int*, int*, int*, int*);
+void F77_NAME(dgesl)(double*, int*, int*, int*, double*, int*);
+
+#define EXPINT_KTOL 0.1     /* scaled error of the Krylov approximations */
+#define EXPINT_MAXSUB 100   /* maximal number of Krylov substeps         */
+
+/*==========================================================================*/
+/* model function, Jacobian-vector products                                 */
+/*==========================================================================*/
+
+/* f = N(t, y) + L y; N is stored in fn if not NULL */
+static void expint_f(expint_work *ew, double t, double *y, double *f,
+  double *fn) {
+  int i, neq = ew->neq;
+
+  derivs(ew->Func, t, y, ew->Parms, ew->Rho, f, ew->out, 0, neq, ew->ipar,
+         ew->isDll, ew->isForcing);
+  ew->nfun++;
+  if (fn) for (i = 0; i < neq; i++) fn[i] = f[i];
+  if (ew->islin) {
+    derivs(ew->Linfunc, t, y, ew->Parms, ew->Rho, ew->ftmp, ew->out, 0, neq,
+           ew->ipar, ew->isDll, ew->isForcing);
+    ew->nfun++;
+    for (i = 0; i < neq; i++) f[i] += ew->ftmp[i];
+  }
+}
+
+/* Jx = (N(t, y + eps x) - N(t, y)) / eps + L x, with N(t, y) in ew->fn */
+static void expint_jv(expint_work *ew, double t, double *y, double *x,
+  double *Jx) {
+  int i, neq = ew->neq;
+  double nx = 0, ny = 0, eps;
+
+  for (i = 0; i < neq; i++) {
+    nx += x[i] * x[i];
+    ny += y[i] * y[i];
+  }
+  if (nx == 0) {
+    for (i = 0; i < neq; i++) Jx[i] = 0;
+    return;
+  }
+  eps = sqrt(DBL_EPSILON) * (1.0 + sqrt(ny)) / sqrt(nx);
+  for (i = 0; i < neq; i++) ew->ytmp[i] = y[i] + eps * x[i];
+  derivs(ew->Func, t, ew->ytmp, ew->Parms, ew->Rho, Jx, ew->out, 0, neq,
+         ew->ipar, ew->isDll, ew->isForcing);
+  ew->nfun++;
+  for (i = 0; i < neq; i++) Jx[i] = (Jx[i] - ew->fn[i]) / eps;
+  if (ew->islin) {
+    derivs(ew->Linfunc, t, x, ew->Parms, ew->Rho, ew->ftmp, ew->out, 0, neq,
+           ew->ipar, ew->isDll, ew->isForcing);
+    ew->nfun++;
+    for (i = 0; i < neq; i++) Jx[i] += ew->ftmp[i];
+  }
+  ew->nmv++;
+}
+
+/*==========================================================================*/
+/* exponential of the small (projected) matrix                              */
+/*==========================================================================*/
+
+static void expint_matmul(int n, double *A, double *B, double *C) {
+  int i, j, k;
+  for (j = 0; j < n; j++) {
+    for (i = 0; i < n; i++) C[i + n * j] = 0;
+    for (k = 0; k < n; k++) {
+      double b = B[k + n * j];
+      if (b != 0) for (i = 0; i < n; i++) C[i + n * j] += A[i + n * k] * b;
+    }
+  }
+}
+
+/* E = exp(A) (n x n, by columns) by scaling and squaring of the (6,6)
+   Pade approximation, as in EXPOKIT (Sidje 1998); A is overwritten,
+   w needs 4 n^2 values                                                  */
+static void expint_expm(int n, double *A, double *E, double *w, int *ipvt) {
+  int i, j, k, s = 0, info = 0, job = 0, n2 = n * n;
+  double *A2 = w, *P = w + n2, *Q = w + 2 * n2, *X = w + 3 * n2;
+  double c[7], anorm = 0, rs, scale;
+
+  c[0] = 1.0;
+  for (k = 1; k <= 6; k++) c[k] = c[k - 1] * (7.0 - k) / (k * (13.0 - k));
+
+  for (i = 0; i < n; i++) {
+    rs = 0;
+    for (j = 0; j < n; j++) rs += fabs(A[i + n * j]);
+    anorm = fmax(anorm, rs);
+  }
+  if (anorm > 0) s = (int)(log(anorm) / log(2.0)) + 2;
+  if (s < 0) s = 0;
+  scale = pow(2.0, -s);
+  for (i = 0; i < n2; i++) A[i] *= scale;
+  expint_matmul(n, A, A, A2);
+
+  /* even part Q = c0 + c2 A^2 + c4 A^4 + c6 A^6 and
+     odd part P = A (c1 + c3 A^2 + c5 A^4), by Horner's scheme            */
+  for (i = 0; i < n2; i++) {
+    Q[i] = c[6] * A2[i];
+    P[i] = c[5] * A2[i];
+  }
+  for (i = 0; i < n; i++) {
+    Q[i + n * i] += c[4];
+    P[i + n * i] += c[3];
+  }
+  expint_matmul(n, A2, Q, X);
+  for (i = 0; i < n2; i++) Q[i] = X[i];
+  expint_matmul(n, A2, P, X);
+  for (i = 0; i < n2; i++) P[i] = X[i];
+  for (i = 0; i < n; i++) {
+    Q[i + n * i] += c[2];
+    P[i + n * i] += c[1];
+  }
+  expint_matmul(n, A2, Q, X);
+  for (i = 0; i < n2; i++) Q[i] = X[i];
+  for (i = 0; i < n; i++) Q[i + n * i] += c[0];
+  expint_matmul(n, A, P, X);
+
+  /* E = (Q - P)^-1 (Q + P) */
+  for (i = 0; i < n2; i++) {
+    E[i] = Q[i] + X[i];
+    A2[i] = Q[i] - X[i];
+  }
+  F77_CALL(dgefa)(A2, &n, &n, ipvt, &info);
+  for (j = 0; j < n; j++)
+    F77_CALL(dgesl)(A2, &n, &n, ipvt, E + n * j, &job);
+
+  for (k = 0; k < s; k++) {
+    expint_matmul(n, E, E, X);
+    for (i = 0; i < n2; i++) E[i] = X[i];
+  }
+}
+
+/*==========================================================================*/
+/* linear combinations of phi-functions in the Krylov space                 */
+/*==========================================================================*/
+
+/* u = sum_{k = 1..p} h^k phi_k(h J) w_k; w[k - 1] is w_k or NULL for zero
+   vectors. This is the top of x(h) = exp(h A) e_{n+p} with the augmented
+   matrix A = [[J, eta W], [0, K]], W = (w_p, ..., w_1) and the shift K;
+   W is scaled with a power of 2 as in Niesen and Wright (2012).
+   x is approximated in the Krylov space of A in substeps tau as in
+   EXPOKIT (Sidje 1998): tau is halved until the error estimate of the
+   space of maximal dimension is below EXPINT_KTOL tau / h.
+   Returns FALSE if more than EXPINT_MAXSUB substeps are needed          */
+static int expint_phiv(expint_work *ew, int p, double h, double **w,
+  double t, double *y, double *sc, double *u) {
+  int i, j, k, l, m, neq = ew->neq, n = neq + p, mmax = ew->mmax + p;
+  int ldh = mmax + 1, next, happy, nsub = 0, done;
+  double *V = ew->V, *H = ew->H, *x = ew->x, *v, *vn, *E = ew->E;
+  double *B = ew->ework, eta = 0, hnorm, nrm = 0, dot, err, wnrm = 0;
+  double beta, tdone = 0, tau = h;
+
+  ew->nkry++;
+  for (l = 0; l < p; l++)
+    if (w[l]) for (i = 0; i < neq; i++) eta = fmax(eta, fabs(w[l][i]));
+  if (eta == 0) {
+    for (i = 0; i < neq; i++) u[i] = 0;
+    return(TRUE);
+  }
+  eta = pow(2.0, -ceil(log(eta) / log(2.0)));
+
+  for (i = 0; i < n; i++) x[i] = 0;
+  x[n - 1] = 1.0;
+
+  while (tdone < h) {
+    if (nsub++ > EXPINT_MAXSUB) return(FALSE);
+    tau = fmin(tau, h - tdone);
+    beta = 0;
+    for (i = 0; i < n; i++) beta += x[i] * x[i];
+    beta = sqrt(beta);
+    for (i = 0; i < n; i++) V[i] = x[i] / beta;
+
+    /* Arnoldi process, checked at increasing dimensions */
+    hnorm = 0;
+    next = p + 2;
+    done = FALSE;
+    for (j = 0; j < mmax && !done; j++) {
+      v  = V + n * j;
+      vn = V + n * (j + 1);
+
+      /* vn = A v */
+      expint_jv(ew, t, y, v, vn);
+      for (l = 0; l < p; l++)
+        if (w[p - 1 - l] && v[neq + l] != 0)
+          for (i = 0; i < neq; i++)
+            vn[i] += eta * v[neq + l] * w[p - 1 - l][i];
+      for (l = 0; l < p - 1; l++) vn[neq + l] = v[neq + l + 1];
+      vn[n - 1] = 0;
+
+      /* modified Gram-Schmidt */
+      for (k = 0; k <= j; k++) {
+        dot = 0;
+        for (i = 0; i < n; i++) dot += V[i + n * k] * vn[i];
+        H[k + ldh * j] = dot;
+        hnorm += dot * dot;
+        for (i = 0; i < n; i++) vn[i] -= dot * V[i + n * k];
+      }
+      nrm = 0;
+      for (i = 0; i < n; i++) nrm += vn[i] * vn[i];
+      nrm = sqrt(nrm);
+      H[j + 1 + ldh * j] = nrm;
+      hnorm += nrm * nrm;
+      m = j + 1;
+      happy = (nrm <= 1e-12 * sqrt(hnorm));
+      if (!happy) {
+        for (i = 0; i < n; i++) vn[i] /= nrm;
+        wnrm = 0;
+        for (i = 0; i < neq; i++) wnrm += (vn[i] / sc[i]) * (vn[i] / sc[i]);
+        wnrm = sqrt(wnrm / neq);
+      }
+
+      if (!happy && m < next && m < mmax) continue;
+      next = m + ((m - p) / 3 > 2 ? (m - p) / 3 : 2);
+
+      /* exp of [[tau H_m, e1], [0, 0]]: the first column approximates
+         the solution, the last one is phi1(tau H_m) e1 of the error
+         estimate; in the largest space, tau is reduced                 */
+      for (;;) {
+        for (k = 0; k < (m + 1) * (m + 1); k++) B[k] = 0;
+        for (k = 0; k < m; k++)
+          for (i = 0; i <= k + 1 && i < m; i++)
+            B[i + (m + 1) * k] = tau * H[i + ldh * k];
+        B[(m + 1) * m] = 1.0;
+        expint_expm(m + 1, B, E, B + (m + 1) * (m + 1), ew->ipvt);
+        err = happy ? 0 :
+          beta * nrm * tau * fabs(E[m - 1 + (m + 1) * m]) * wnrm / eta;
+        if (err <= EXPINT_KTOL * tau / h) {
+          done = TRUE;
+          break;
+        }
+        if (m < mmax || tau <= DBL_EPSILON * h) break;
+        tau *= 0.5;
+      }
+    }
+    if (!done) return(FALSE);
+
+    /* x(tdone + tau) */
+    for (i = 0; i < n; i++) x[i] = 0;
+    for (k = 0; k < m; k++)
+      for (i = 0; i < n; i++) x[i] += beta * E[k] * V[i + n * k];
+    tdone += tau;
+    if (nsub > 1) ew->nksub++;
+    tau *= 2.0;
+  }
+  for (i = 0; i < neq; i++) u[i] = x[i] / eta;
+  return(TRUE);
+}
+
+/*==========================================================================*/
+/* main loop                                                                */
+/*==========================================================================*/
+
+void rk_expint(
+       /* integers */
+       int verbose, int maxsteps, int nt, int isEvent,
+       /* int pointers */
+       int* _it, int* _it_tot, int* _it_rej, int* istate,
+       /* double */
+       double t, double tmax, double hmin, double hmax, double* _dt,
+       rk_control* ctl, expint_work* ew,
+       /* arrays */
+       double* tt, double* y0, double* y1, double* f0, double* f1,
+       double* U, double* D, double* W, double* err, double* sc,
+       double* atol, double* rtol, double* yout
+  )
+{
+  int i, neq = ew->neq, it = *_it, it_tot = *_it_tot, nreject = *_it_rej;
+  int accept = FALSE, clipped, ok, restart = TRUE, ievent = 0;
+  double dt = *_dt, dtnew, dtsave, tbreak, tnew, delta, serr, scal, errnorm;
+  double *D2 = D, *D3 = D + neq, *fv = ew->fv, *w[4];
+
+  /*------------------------------------------------------------------------*/
+  /* Main Loop                                                              */
+  /*------------------------------------------------------------------------*/
+  while (it < nt && t < tmax) {
+    /* the step ends exactly at tmax or at the next event */
+    tbreak = tmax;
+    if (isEvent && iEvent < nEvent && tEvent > t && tEvent < tbreak)
+      tbreak = tEvent;
+    dtsave = dt;
+    clipped = (t + dt >= tbreak - 100.0 * DBL_EPSILON * fabs(tbreak));
+    if (clipped) dt = tbreak - t;
+
+    if (accept) timesteps[0] = timesteps[1];
+    timesteps[1] = dt;
+
+    /* f, its nonlinear part and its time derivative at a new state */
+    if (restart) {
+      expint_f(ew, t, y0, f0, ew->fn);
+      delta = sqrt(DBL_EPSILON) * fmax(fabs(t), fabs(dt));
+      expint_f(ew, t + delta, y0, fv, NULL);
+      for (i = 0; i < neq; i++) fv[i] = (fv[i] - f0[i]) / delta;
+      restart = FALSE;
+    }
+    for (i = 0; i < neq; i++) sc[i] = atol[i] + rtol[i] * fabs(y0[i]);
+
+    /******  stages; err is the difference to the embedded method  *****/
+    w[0] = f0; w[1] = fv; w[2] = NULL; w[3] = NULL;
+    if (ew->order == 3) {
+      ok = expint_phiv(ew, 2, dt, w, t, y0, sc, U);
+      if (ok) {
+        for (i = 0; i < neq; i++) {
+          W[i] = U[i];
+          U[i] += y0[i];
+        }
+        expint_f(ew, t + dt, U, D2, NULL);
+        expint_jv(ew, t, y0, W, y1);
+        for (i = 0; i < neq; i++) {
+          D2[i] -= f0[i] + y1[i] + dt * fv[i];
+          W[i] = 2.0 * D2[i] / (dt * dt);
+        }
+        w[0] = NULL; w[1] = NULL; w[2] = W;
+        ok = expint_phiv(ew, 3, dt, w, t, y0, sc, err);
+        if (ok) for (i = 0; i < neq; i++) y1[i] = U[i] + err[i];
+      }
+    } else {
+      ok = expint_phiv(ew, 2, 0.5 * dt, w, t, y0, sc, U);
+      if (ok) {
+        for (i = 0; i < neq; i++) {
+          W[i] = U[i];
+          U[i] += y0[i];
+        }
+        expint_f(ew, t + 0.5 * dt, U, D2, NULL);
+        expint_jv(ew, t, y0, W, y1);
+        for (i = 0; i < neq; i++) {
+          D2[i] -= f0[i] + y1[i] + 0.5 * dt * fv[i];
+          W[i] = f0[i] + D2[i];
+        }
+        w[0] = W;
+        ok = expint_phiv(ew, 2, dt, w, t, y0, sc, U);
+      }
+      if (ok) {
+        for (i = 0; i < neq; i++) {
+          W[i] = U[i];
+          U[i] += y0[i];
+        }
+        expint_f(ew, t + dt, U, D3, NULL);
+        expint_jv(ew, t, y0, W, y1);
+        for (i = 0; i < neq; i++) {
+          D3[i] -= f0[i] + y1[i] + dt * fv[i];
+          W[i]       = (16.0 * D2[i] - 2.0 * D3[i]) / (dt * dt);
+          W[i + neq] = (-48.0 * D2[i] + 12.0 * D3[i]) / (dt * dt * dt);
+        }
+        w[0] = f0; w[2] = W;
+        ok = expint_phiv(ew, 3, dt, w, t, y0, sc, y1);
+      }
+      if (ok) {
+        w[0] = NULL; w[1] = NULL; w[2] = NULL; w[3] = W + neq;
+        ok = expint_phiv(ew, 4, dt, w, t, y0, sc, err);
+        if (ok) for (i = 0; i < neq; i++) y1[i] += y0[i] + err[i];
+      }
+    }
+    it_tot++; /* count total number of time steps */
+
+    /*----------------------------------------------------------------------*/
+    /* too many Krylov substeps: smaller step                               */
+    /*----------------------------------------------------------------------*/
+    if (!ok) {
+      dt = 0.5 * dt;
+      accept = FALSE;
+      if (dt < hmin || t + dt == t) {
+        if (verbose) Rprintf("warning, Krylov approximation fails with h < Hmin\n");
+        istate[0] = -5;   /* as in lsoda: repeated convergence failures */
+        break;
+      }
+      if (it_tot > maxsteps) {
+        if (verbose) Rprintf("Max. number of steps exceeded\n");
+        istate[0] = -1;
+        break;
+      }
+      continue;
+    }
+
+    /*======================================================================*/
+    /* error estimate and step size adjustment                              */
+    /*======================================================================*/
+    serr = 0;
+    for (i = 0; i < neq; i++) {
+      scal = atol[i] + fmax(fabs(y0[i]), fabs(y1[i])) * rtol[i];
+      if (scal > 0) serr += (err[i]/scal) * (err[i]/scal);
+    }
+    errnorm = sqrt(serr/neq);
+
+    dtnew = dt * rkcontrol(ctl, errnorm, accept);
+    if (errnorm < 1.0) {
+      dtnew  = fmin(dtnew, hmax);
+      accept = TRUE;
+    } else if (errnorm > 1.0) {
+      nreject++;    /* count total number of rejected steps */
+      accept = FALSE;
+    }
+    if (dtnew < hmin) {
+      accept = TRUE;
+      if (verbose) Rprintf("warning, h < Hmin\n");
+      istate[0] = -2;
+      dtnew = hmin;
+    }
+    rkcontrol_update(ctl, dt, dtnew, accept);
+    /* a step shortened to hit a break is no reason to shrink the next */
+    if (accept && clipped) dtnew = fmax(dtnew, fmin(dtsave, hmax));
+
+    if (!accept) {
+      dt = dtnew;
+      if (it_tot > maxsteps) break;
+      continue;
+    }
+
+    /*----------------------------------------------------------------------*/
+    /* accepted: f at the new state is the end point of the Hermite         */
+    /* interpolation and the start of the next step                         */
+    /*----------------------------------------------------------------------*/
+    tnew = clipped ? tbreak : t + dt;
+    expint_f(ew, tnew, y1, f1, ew->fn);
+
+    /* outputs up to, but not at the end of the step */
+    while (it < nt && tt[it] < tnew) {
+      yout[it] = tt[it];
+      densevalue(3, t, tt[it], tnew - t, NULL, 0, y0, y1, f0, f1, U, neq);
+      for (i = 0; i < neq; i++) yout[it + nt * (1 + i)] = U[i];
+      it++;
+    }
+
+    t  = tnew;
+    dt = dtnew;
+    for (i = 0; i < neq; i++) {
+      y0[i] = y1[i];
+      f0[i] = f1[i];
+    }
+    /* the time derivative of f is needed at the new state; f itself is
+       known unless an event changes the state                           */
+    delta = sqrt(DBL_EPSILON) * fmax(fabs(t), fabs(dt));
+    if (isEvent && t == tEvent) {
+      updateevent(&t, y0, &ievent);
+      restart = TRUE;
+    } else {
+      expint_f(ew, t + delta, y0, fv, NULL);
+      for (i = 0; i < neq; i++) fv[i] = (fv[i] - f0[i]) / delta;
+    }
+
+    /* output exactly at the end of the step, after the events */
+    if (it < nt && tt[it] == t) {
+      yout[it] = t;
+      for (i = 0; i < neq; i++) yout[it + nt * (1 + i)] = y0[i];
+      it++;
+    }
+
+    if (it_tot > maxsteps) {
+      if (verbose) Rprintf("Max. number of steps exceeded\n");
+      istate[0] = -1;
+      break;
+    }
+  }
+
+  /* return reference values */
+  *_it = it; *_it_tot = it_tot; *_it_rej = nreject; *_dt = dt;
+}
@@ -0,0 +1,487 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >= 2                 */
+/* Extrapolation method of Gragg, Bulirsch and Stoer with order and step    */
+/* size control and dense output                                            */
+/* -- main loop == core function --                                         */
+/*==========================================================================*/
+/*
+  Column j of the extrapolation table is the explicit midpoint rule with
+  nj[j] = 4 j - 2 steps of size h / nj[j], followed by the smoothing step
+  of Gragg; the columns are extrapolated to h = 0 with the Aitken-Neville
+  scheme. The error estimate of column j is the difference of the last
+  two extrapolated values. Number of columns and step size minimize the
+  work per unit step as in ODEX (Hairer, Norsett and Wanner 1993).
+
+  The dense output polynomial fits the states and derivatives at both ends
+  of the step and the derivatives of order 0 .. 2 kc - 3 at its midpoint,
+  which are extrapolated from the midpoint values and central differences
+  of the derivatives of the internal steps (Hairer and Ostermann 1990).
+  The step numbers 2 mod 4 put the midpoint on the grid of all columns.
+
+  The columns do not depend on each other; for compiled models without
+  forcings they are computed in parallel (OpenMP), each thread in its own
+  work space.
+*/
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "rk_util.h"
+
+#define GBS_FAC1  0.02   /* bounds of the step size change per column   */
+#define GBS_FAC2  4.0
+#define GBS_FAC3  0.8    /* order decrease if the work is smaller by    */
+#define GBS_FAC4  0.9    /* order increase if the work is smaller by    */
+#define GBS_SAFE1 0.65
+#define GBS_SAFE2 0.94
+
+/* raw column j: explicit midpoint rule with nj[j] steps and smoothing;
+   returns FALSE if the stability check of the first step fails          */
+static int gbs_midpoint(gbs_work *g, int j, int neq, double t, double h,
+  double *y0, double *f0, double *wt, double *work, double *out,
+  int *ipar, int isDll, int isForcing, SEXP Func, SEXP Parms, SEXP Rho) {
+
+  int i, m, n = g->nj[j];
+  double hj = h / n, del1, del2, ys, d;
+  double *yh1 = work, *yh2 = work + neq, *dy = work + 2 * neq;
+  double *fs = g->fsafe + g->ipt[j] * neq, *Tj = g->T + (j - 1) * neq;
+
+  g->ncol[j] = 0;
+  for (i = 0; i < neq; i++) {
+    yh1[i] = y0[i];
+    yh2[i] = y0[i] + hj * f0[i];
+    fs[i]  = f0[i];
+  }
+  for (m = 1; m <= n; m++) {
+    /* here, yh2 is the state after m internal steps */
+    if (m == n / 2)
+      for (i = 0; i < neq; i++) g->ysafe[i + (j - 1) * neq] = yh2[i];
+    derivs(Func, t + m * hj, yh2, Parms, Rho, dy, out, 0, neq, ipar, isDll,
+           isForcing);
+    g->ncol[j]++;
+    for (i = 0; i < neq; i++) fs[i + m * neq] = dy[i];
+
+    /* the first steps of the first two columns must not blow up */
+    if (m == 1 && j <= 2) {
+      del1 = 0;
+      del2 = 0;
+      for (i = 0; i < neq; i++) {
+        d = f0[i] * wt[i];
+        del1 += d * d;
+        d = (dy[i] - f0[i]) * wt[i];
+        del2 += d * d;
+      }
+      if (!(del2 <= 4.0 * fmax(del1, DBL_EPSILON))) return(FALSE);
+    }
+    if (m < n) {
+      for (i = 0; i < neq; i++) {
+        ys     = yh1[i];
+        yh1[i] = yh2[i];
+        yh2[i] = ys + 2.0 * hj * dy[i];
+      }
+    }
+  }
+  for (i = 0; i < neq; i++) Tj[i] = 0.5 * (yh1[i] + yh2[i] + hj * dy[i]);
+  return(TRUE);
+}
+
+/* Aitken-Neville scheme for row r of columns b, b + 1, ...: before, D[l]
+   holds the extrapolated values of row r - 1 and D[r] the raw value of
+   row r; afterwards D[0] is the extrapolated value of row r             */
+static void gbs_neville(int *nj, int b, int r, double *D, int neq) {
+  int i, l;
+  double fac;
+
+  for (l = r; l > 0; l--) {
+    fac = (double) nj[b + r] / nj[b + l - 1];
+    fac = fac * fac - 1.0;
+    for (i = 0; i < neq; i++)
+      D[i + (l - 1) * neq] = D[i + l * neq] +
+        (D[i + l * neq] - D[i + (l - 1) * neq]) / fac;
+  }
+}
+
+/* column j, extrapolated; returns FALSE if the internal steps are not
+   stable or the error grows, otherwise the error, the optimal step size
+   and the work per unit step of the column                              */
+static int gbs_column(gbs_work *g, int j, int neq, double t, double h,
+  double hmax, double *err, double *errold, double *y0, double *f0,
+  double *wt, double *atol, double *rtol, double *out, int *ipar,
+  int isDll, int isForcing, SEXP Func, SEXP Parms, SEXP Rho) {
+
+  int i;
+  double sc, d, expo, facmin, fac;
+
+  if (!g->done[j]) {
+    g->stable[j] = gbs_midpoint(g, j, neq, t, h, y0, f0, wt, g->work, out,
+      ipar, isDll, isForcing, Func, Parms, Rho);
+    g->done[j] = TRUE;
+    g->nfun += g->ncol[j];
+  }
+  if (!g->stable[j]) return(FALSE);
+  if (j == 1) return(TRUE);
+
+  gbs_neville(g->nj, 1, j - 1, g->T, neq);
+  *err = 0;
+  for (i = 0; i < neq; i++) {
+    sc = atol[i] + rtol[i] * fmax(fabs(y0[i]), fabs(g->T[i]));
+    d  = g->T[i] - g->T[i + neq];
+    if (sc > 0) *err += (d / sc) * (d / sc);
+  }
+  *err = sqrt(*err / neq);
+  if (!(*err * DBL_EPSILON < 1.0) || (j > 2 && *err >= *errold))
+    return(FALSE);
+  *errold = fmax(4.0 * *err, 1.0);
+
+  expo   = 1.0 / (2 * j - 1);
+  facmin = pow(GBS_FAC1, expo);
+  fac    = fmin(GBS_FAC2 / facmin,
+                fmax(facmin, pow(*err / GBS_SAFE1, expo) / GBS_SAFE2));
+  g->hh[j] = fmin(h / fac, hmax);
+  g->w[j]  = g->aw[j] / g->hh[j];
+  return(TRUE);
+}
+
+/* raw columns 1 .. k at once, the longest first, in parallel threads    */
+static void gbs_parallel(gbs_work *g, int k, int neq, double t, double h,
+  double *y0, double *f0, double *wt, double *out, int *ipar,
+  SEXP Func, SEXP Parms, SEXP Rho) {
+
+  int nth = g->nthreads;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nth) schedule(dynamic, 1)
+#endif
+  for (int jj = 0; jj < k; jj++) {
+    int j = k - jj, id = 0;
+#ifdef _OPENMP
+    id = omp_get_thread_num();
+#endif
+    double *work = g->work + id * g->lwork;
+    g->stable[j] = gbs_midpoint(g, j, neq, t, h, y0, f0, wt, work,
+      (id == 0) ? out : work + 3 * neq, ipar, TRUE, FALSE, Func, Parms, Rho);
+    g->done[j] = TRUE;
+  }
+  for (int j = 1; j <= k; j++) g->nfun += g->ncol[j];
+}
+
+/* coefficients of the dense output polynomial of a step with kc columns:
+   dens[k], k = 0 .. mu are h^k y^(k)(t + h/2) / k! and dens[mu + 1 .. 4]
+   the coefficients of the correction that fits both ends of the step    */
+static void gbs_dense(gbs_work *g, int kc, int neq, double h,
+  double *y0, double *y1, double *f0, double *f1) {
+
+  int i, j, k, l, b, len, mu = 2 * kc - 3, m = mu + 1;
+  double fac, fk = 1.0, *D = g->T, *fs, *dens = g->dens;
+  double qp, qm, dqp, dqm, r0, r1, d0, d1, A, B, C, E, e2, e3, sg, um;
+
+  /* the state at the midpoint */
+  for (i = 0; i < kc * neq; i++) D[i] = g->ysafe[i];
+  for (j = 1; j < kc; j++) gbs_neville(g->nj, 1, j, D, neq);
+  for (i = 0; i < neq; i++) dens[i] = D[i];
+
+  /* derivative k from the (k - 1)-th central differences of f with
+     steps 2 h / nj; these need columns (k + 1) / 2 .. kc              */
+  for (k = 1; k <= mu; k++) {
+    b = (k + 1) / 2;
+    for (j = b; j <= kc; j++) {
+      fac = h * pow(g->nj[j] / 2.0, k - 1);
+      fs  = g->fsafe + (g->ipt[j] + g->nj[j] / 2 - k + 1) * neq;
+      for (i = 0; i < neq; i++) D[i + (j - b) * neq] = fac * fs[i];
+    }
+    for (j = 1; j <= kc - b; j++) gbs_neville(g->nj, b, j, D, neq);
+    fk *= k;
+    for (i = 0; i < neq; i++) dens[i + k * neq] = D[i] / fk;
+
+    /* next differences f[l + 2] - f[l], in place */
+    if (k < mu) {
+      for (j = (k + 2) / 2; j <= kc; j++) {
+        fs  = g->fsafe + g->ipt[j] * neq;
+        len = g->nj[j] + 3 - 2 * k;
+        for (l = 0; l < len - 2; l++)
+          for (i = 0; i < neq; i++)
+            fs[i + l * neq] = fs[i + (l + 2) * neq] - fs[i + l * neq];
+      }
+    }
+  }
+
+  /* correction theta^m (e0 + e1 s + e2 s^2 + e3 s^3), s = 2 theta, that
+     fits states and derivatives at theta = -1/2 and 1/2                 */
+  sg = (m % 2) ? -1.0 : 1.0;
+  um = pow(0.5, m);
+  for (i = 0; i < neq; i++) {
+    qp = dens[i + mu * neq];
+    qm = qp;
+    dqp = 0;
+    dqm = 0;
+    for (k = mu - 1; k >= 0; k--) {
+      dqp = dqp * 0.5 + qp;
+      qp  = qp  * 0.5 + dens[i + k * neq];
+      dqm = dqm * -0.5 + qm;
+      qm  = qm  * -0.5 + dens[i + k * neq];
+    }
+    r1 = y1[i] - qp;
+    r0 = y0[i] - qm;
+    d1 = h * f1[i] - dqp;
+    d0 = h * f0[i] - dqm;
+    A = (r1 + sg * r0) / (2.0 * um);
+    B = (r1 - sg * r0) / (2.0 * um);
+    C = (d1 - sg * d0) / (4.0 * um);
+    E = (d1 + sg * d0) / (4.0 * um);
+    e2 = 0.5 * (C - m * A);
+    e3 = 0.5 * (E - (m + 1) * B);
+    dens[i + (m    ) * neq] = A - e2;
+    dens[i + (m + 1) * neq] = B - e3;
+    dens[i + (m + 2) * neq] = e2;
+    dens[i + (m + 3) * neq] = e3;
+  }
+  g->mu = mu;
+}
+
+/* value of the dense output polynomial of the step (t, t + h) at tout */
+static void gbs_densevalue(gbs_work *g, int neq, double t, double h,
+  double tout, double *y) {
+
+  int i, k, mu = g->mu, m = mu + 1;
+  double th = (tout - t) / h - 0.5, s = 2.0 * th, thm = pow(th, m);
+  double q, *dens = g->dens;
+
+  for (i = 0; i < neq; i++) {
+    q = dens[i + mu * neq];
+    for (k = mu - 1; k >= 0; k--) q = q * th + dens[i + k * neq];
+    y[i] = q + thm * (dens[i + m * neq] + s * (dens[i + (m + 1) * neq] +
+      s * (dens[i + (m + 2) * neq] + s * dens[i + (m + 3) * neq])));
+  }
+}
+
+void rk_extrapol(
+       /* integers */
+       int neq, int isDll, int isForcing, int verbose,
+       int maxsteps, int nt, int isEvent,
+       /* int pointers */
+       int* _it, int* _it_tot, int* _it_rej, int* istate, int* ipar,
+       /* double */
+       double t, double tmax, double hmin, double hmax, double* _dt,
+       gbs_work* g,
+       /* arrays */
+       double* tt, double* y0, double* y1, double* f0, double* f1,
+       double* wt, double* ytmp, double* out,
+       double* atol, double* rtol, double* yout,
+       /* SEXPs */
+       SEXP Func, SEXP Parms, SEXP Rho
+  )
+{
+  int i, j, k, kc = 0, kopt, km = g->kmax, it = *_it, it_tot = *_it_tot;
+  int nreject = *_it_rej, first = TRUE, reject = FALSE, last, ievent = 0;
+  int accept, stable, tryk, tryk1;
+  double dt = *_dt, dtnew, dtsave, tbreak, tnew, err = 0, errold, sc;
+  double *nj2 = (double*) R_alloc(km + 2, sizeof(double));
+
+  for (j = 1; j <= km; j++) nj2[j] = (double) g->nj[j];
+
+  /* number of columns from the tolerance, as in ODEX */
+  k = (int) (-log10(rtol[0] + DBL_EPSILON) * 0.6 + 1.5);
+  if (k > km - 1) k = km - 1;
+  if (k < 2) k = 2;
+
+  derivs(Func, t, y0, Parms, Rho, f0, out, 0, neq, ipar, isDll, isForcing);
+  g->nfun++;
+  /* first step size from the scaled norms of y and f(y), as in imex */
+  if (dt <= 0) {
+    double d0 = 0, d1 = 0;
+    for (i = 0; i < neq; i++) {
+      sc = atol[i] + rtol[i] * fabs(y0[i]);
+      if (sc > 0) {
+        d0 += (y0[i] / sc) * (y0[i] / sc);
+        d1 += (f0[i] / sc) * (f0[i] / sc);
+      }
+    }
+    dt = (d0 < 1e-10 || d1 < 1e-10) ? 1e-6 : 0.01 * sqrt(d0 / d1);
+  }
+  dt = fmin(dt, hmax);
+
+  /*------------------------------------------------------------------------*/
+  /* Main Loop                                                              */
+  /*------------------------------------------------------------------------*/
+  while (it < nt && t < tmax) {
+    /* the step ends exactly at tmax or at the next event */
+    tbreak = tmax;
+    if (isEvent && iEvent < nEvent && tEvent > t && tEvent < tbreak)
+      tbreak = tEvent;
+    dtsave = dt;
+    last = (t + dt >= tbreak - 100.0 * DBL_EPSILON * fabs(tbreak));
+    if (last) dt = tbreak - t;
+
+    if (!reject) timesteps[0] = timesteps[1];
+    timesteps[1] = dt;
+
+    for (i = 0; i < neq; i++) {
+      sc = atol[i] + rtol[i] * fabs(y0[i]);
+      wt[i] = (sc > 0) ? 1.0 / sc : 0;
+    }
+    for (j = 1; j <= km; j++) g->done[j] = FALSE;
+    if (g->nthreads > 1)
+      gbs_parallel(g, k, neq, t, dt, y0, f0, wt, out, ipar, Func, Parms, Rho);
+    it_tot++; /* count total number of time steps */
+
+    /*----------------------------------------------------------------------*/
+    /* columns 1 .. k - 1, then k and k + 1 if the error is not yet small;  */
+    /* the first and the last step stop at the first small error            */
+    /*----------------------------------------------------------------------*/
+    errold = 1e10;
+    accept = FALSE;
+    stable = TRUE;
+    tryk1  = FALSE;
+    if (first || last) {
+      for (j = 1; j <= k && stable && !accept; j++) {
+        kc = j;
+        stable = gbs_column(g, j, neq, t, dt, hmax, &err, &errold, y0, f0,
+          wt, atol, rtol, out, ipar, isDll, isForcing, Func, Parms, Rho);
+        if (stable && j > 1 && err <= 1.0) accept = TRUE;
+      }
+      tryk1 = stable && !accept;
+    } else {
+      for (j = 1; j < k && stable; j++) {
+        kc = j;
+        stable = gbs_column(g, j, neq, t, dt, hmax, &err, &errold, y0, f0,
+          wt, atol, rtol, out, ipar, isDll, isForcing, Func, Parms, Rho);
+      }
+      if (stable) {
+        tryk = TRUE;
+        if (k > 2 && !reject) {
+          if (err <= 1.0)
+            accept = TRUE;
+          if (accept || err > pow(nj2[k + 1] * nj2[k] / 4.0, 2))
+            tryk = FALSE;
+        }
+        if (tryk) {
+          kc = k;
+          stable = gbs_column(g, k, neq, t, dt, hmax, &err, &errold, y0, f0,
+            wt, atol, rtol, out, ipar, isDll, isForcing, Func, Parms, Rho);
+          if (stable && err <= 1.0) accept = TRUE;
+          tryk1 = stable && !accept;
+        }
+      }
+    }
+    /* hope for convergence in column k + 1 */
+    if (tryk1 && err <= pow(nj2[k + 1] / 2.0, 2)) {
+      kc = k + 1;
+      stable = gbs_column(g, kc, neq, t, dt, hmax, &err, &errold, y0, f0,
+        wt, atol, rtol, out, ipar, isDll, isForcing, Func, Parms, Rho);
+      if (stable && err <= 1.0) accept = TRUE;
+    }
+
+    /*----------------------------------------------------------------------*/
+    /* rejected: half the step size if the internal steps are not stable,   */
+    /* otherwise the optimal step size of the reduced number of columns     */
+    /*----------------------------------------------------------------------*/
+    if (!accept) {
+      nreject++;  /* count total number of rejected steps */
+      if (!stable) {
+        dt *= 0.5;
+      } else {
+        if (k > kc) k = kc;
+        if (k > km - 1) k = km - 1;
+        if (k > 2 && g->w[k - 1] < g->w[k] * GBS_FAC3) k--;
+        dt = g->hh[k];
+      }
+      reject = TRUE;
+      if (dt < hmin || t + dt == t) {
+        if (verbose) Rprintf("warning, h < Hmin\n");
+        istate[0] = -2;
+        break;
+      }
+      if (it_tot > maxsteps) {
+        if (verbose) Rprintf("Max. number of steps exceeded\n");
+        istate[0] = -1;
+        break;
+      }
+      continue;
+    }
+
+    /*----------------------------------------------------------------------*/
+    /* accepted: new state and its derivative, the first of the next step   */
+    /*----------------------------------------------------------------------*/
+    tnew = last ? tbreak : t + dt;
+    for (i = 0; i < neq; i++) y1[i] = g->T[i];
+    derivs(Func, tnew, y1, Parms, Rho, f1, out, 0, neq, ipar, isDll,
+           isForcing);
+    g->nfun++;
+
+    /* outputs up to, but not at the end of the step */
+    if (it < nt && tt[it] < tnew) {
+      gbs_dense(g, kc, neq, dt, y0, y1, f0, f1);
+      while (it < nt && tt[it] < tnew) {
+        yout[it] = tt[it];
+        gbs_densevalue(g, neq, t, dt, tt[it], ytmp);
+        for (i = 0; i < neq; i++) yout[it + nt * (1 + i)] = ytmp[i];
+        it++;
+      }
+    }
+
+    /* optimal number of columns and step size, as in ODEX */
+    if (kc == 2) {
+      kopt = (km - 1 < 3) ? km - 1 : 3;
+      if (reject) kopt = 2;
+    } else if (kc <= k) {
+      kopt = kc;
+      if (g->w[kc - 1] < g->w[kc] * GBS_FAC3) kopt = kc - 1;
+      if (g->w[kc] < g->w[kc - 1] * GBS_FAC4)
+        kopt = (kc + 1 < km - 1) ? kc + 1 : km - 1;
+    } else {
+      kopt = kc - 1;
+      if (kc > 3 && g->w[kc - 2] < g->w[kc - 1] * GBS_FAC3) kopt = kc - 2;
+      if (g->w[kc] < g->w[kopt] * GBS_FAC4)
+        kopt = (kc < km - 1) ? kc : km - 1;
+    }
+    if (reject) {
+      k = (kopt < kc) ? kopt : kc;
+      dtnew = fmin(dt, g->hh[k]);
+    } else {
+      if (kopt <= kc)
+        dtnew = g->hh[kopt];
+      else if (kc < k && g->w[kc] < g->w[kc - 1] * GBS_FAC4)
+        dtnew = g->hh[kc] * g->aw[kopt + 1] / g->aw[kc];
+      else
+        dtnew = g->hh[kc] * g->aw[kopt] / g->aw[kc];
+      k = kopt;
+    }
+    dtnew = fmin(dtnew, hmax);
+    /* a step shortened to hit a break is no reason to shrink the next */
+    if (last) dtnew = fmax(dtnew, fmin(dtsave, hmax));
+    g->kc = kc;
+    reject = FALSE;
+    first  = FALSE;
+
+    t  = tnew;
+    dt = dtnew;
+    for (i = 0; i < neq; i++) {
+      y0[i] = y1[i];
+      f0[i] = f1[i];
+    }
+
+    /* events change the state: restart with a new derivative */
+    if (isEvent && t == tEvent) {
+      updateevent(&t, y0, &ievent);
+      derivs(Func, t, y0, Parms, Rho, f0, out, 0, neq, ipar, isDll,
+             isForcing);
+      g->nfun++;
+      first = TRUE;
+    }
+
+    /* output exactly at the end of the step, after the events */
+    if (it < nt && tt[it] == t) {
+      yout[it] = t;
+      for (i = 0; i < neq; i++) yout[it + nt * (1 + i)] = y0[i];
+      it++;
+    }
+
+    if (it_tot > maxsteps) {
+      if (verbose) Rprintf("Max. number of steps exceeded\n");
+      istate[0] = -1;
+      break;
+    }
+  }
+
+  /* return reference values */
+  *_it = it; *_it_tot = it_tot; *_it_rej = nreject; *_dt = dt;
+}
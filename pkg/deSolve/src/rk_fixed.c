@@ -10,7 +10,7 @@ void rk_fixed(
        /* integers */
        int fsal, int neq, int stage,
        int isDll, int isForcing, int verbose,
-       int nknots, int interpolate, int maxsteps, int nt,
+       int nknots, int interpolate, int maxsteps, int nt, int kernel,
        /* int pointers */
        int* _iknots, int* _it, int* _it_ext, int* _it_tot, 
        int* istate,  int* ipar,
@@ -67,13 +67,16 @@ void rk_fixed(
     /* Estimation of new values                                           */
     /*====================================================================*/
 
-    /* use BLAS with reduced error checking */
-    blas_matprod1(FF, neq, stage, bb1, stage, one, dy1);
-
-    it_tot++; /* count total number of time steps */
-    for (i = 0; i < neq; i++) {
-      y1[i] = y0[i] +  dt * dy1[i];
+    if (kernel) {
+      rk_kernelfixed(kernel, neq, dt, y0, FF, y1);
+    } else {
+      /* use BLAS with reduced error checking */
+      blas_matprod1(FF, neq, stage, bb1, stage, one, dy1);
+      for (i = 0; i < neq; i++) {
+        y1[i] = y0[i] +  dt * dy1[i];
+      }
     }
+    it_tot++; /* count total number of time steps */
 
     /*====================================================================*/
     /*      Interpolation and Data Storage                                */
@@ -0,0 +1,396 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >= 2                 */
+/* Additive implicit-explicit (IMEX) Runge-Kutta methods                    */
+/* -- main loop == core function --                                         */
+/*==========================================================================*/
+/*
+  dy/dt = fE(t, y) + fI(t, y) with a non-stiff part fE (e.g. transport)
+  integrated explicitly and a stiff part fI (e.g. reactions) integrated
+  with an ESDIRK method (Kennedy and Carpenter 2003). Stage k solves
+
+    z_k = base_k + gamma h fI(t + c_k h, z_k)
+    base_k = y0 + h sum_{j<k} (ae_kj fE_j + ai_kj fI_j)
+
+  by a simplified Newton iteration with the matrix I - gamma h J, where J
+  is the Jacobian of fI. If fI couples only the states within one cell,
+  J consists of ncell blocks of size nspec x nspec; they are estimated
+  with nspec evaluations of fI (one species of all cells perturbed at
+  once) and decomposed block by block. J is kept for several steps and
+  renewed when the Newton iteration fails; the blocks are decomposed
+  again whenever gamma h changes.
+
+  Outputs are interpolated with cubic Hermite polynomials; the steps end
+  exactly at the events.
+*/
+
+#include "rk_util.h"
+#include <string.h>
+
+void F77_NAME(dgefa)(double*, int*, int*, int*, int*);
+void F77_NAME(dgesl)(double*, int*, int*, int*, double*, int*);
+
+#define IMEX_MAXIT 5    /* maximum number of Newton iterations per stage */
+#define IMEX_MAXAGE 20  /* maximum number of steps with the same Jacobian */
+
+/*==========================================================================*/
+/* coefficients                                                             */
+/*==========================================================================*/
+
+/* ARK3(2)4L[2]SA of Kennedy and Carpenter (2003), order 3(2) */
+#define ARK3_G (1767732205903.0/4055673282236.0)
+#define ARK3_B 1471266399579.0/7840856788654.0, \
+  -4482444167858.0/7529755066697.0, 11266239266428.0/11593286722821.0, ARK3_G
+static const double ark3_ae[] = {
+  0, 0, 0, 0,
+  1767732205903.0/2027836641118.0, 0, 0, 0,
+  5535828885825.0/10492691773637.0, 788022342437.0/10882634858940.0, 0, 0,
+  6485989280629.0/16251701735622.0, -4246266847089.0/9704473918619.0,
+  10755448449292.0/10357097424841.0, 0};
+static const double ark3_ai[] = {
+  0, 0, 0, 0,
+  ARK3_G, ARK3_G, 0, 0,
+  2746238789719.0/10658868560708.0, -640167445237.0/6845629431997.0,
+  ARK3_G, 0,
+  ARK3_B};
+static const double ark3_b[]  = {ARK3_B};
+static const double ark3_bh[] = {2756255671327.0/12835298489170.0,
+  -10771552573575.0/22201958757719.0, 9247589265047.0/10645013368117.0,
+  2193209047091.0/5459859503100.0};
+static const double ark3_c[]  = {0, 1767732205903.0/2027836641118.0, 0.6, 1};
+
+static const imex_table ark324 = {4, 2, ARK3_G,
+  ark3_ae, ark3_ai, ark3_b, ark3_bh, ark3_c};
+
+/* ARK4(3)6L[2]SA of Kennedy and Carpenter (2003), order 4(3) */
+#define ARK4_B 82889.0/524892.0, 0, 15625.0/83664.0, 69875.0/102672.0, \
+  -2260.0/8211.0, 0.25
+static const double ark4_ae[] = {
+  0, 0, 0, 0, 0, 0,
+  0.5, 0, 0, 0, 0, 0,
+  13861.0/62500.0, 6889.0/62500.0, 0, 0, 0, 0,
+  -116923316275.0/2393684061468.0, -2731218467317.0/15368042101831.0,
+  9408046702089.0/11113171139209.0, 0, 0, 0,
+  -451086348788.0/2902428689909.0, -2682348792572.0/7519795681897.0,
+  12662868775082.0/11960479115383.0, 3355817975965.0/11060851509271.0, 0, 0,
+  647845179188.0/3216320057751.0, 73281519250.0/8382639484533.0,
+  552539513391.0/3454668386233.0, 3354512671639.0/8306763924573.0,
+  4040.0/17871.0, 0};
+static const double ark4_ai[] = {
+  0, 0, 0, 0, 0, 0,
+  0.25, 0.25, 0, 0, 0, 0,
+  8611.0/62500.0, -1743.0/31250.0, 0.25, 0, 0, 0,
+  5012029.0/34652500.0, -654441.0/2922500.0, 174375.0/388108.0, 0.25, 0, 0,
+  15267082809.0/155376265600.0, -71443401.0/120774400.0,
+  730878875.0/902184768.0, 2285395.0/8070912.0, 0.25, 0,
+  ARK4_B};
+static const double ark4_b[]  = {ARK4_B};
+static const double ark4_bh[] = {4586570599.0/29645900160.0, 0,
+  178811875.0/945068544.0, 814220225.0/1159782912.0,
+  -3700637.0/11593932.0, 61727.0/225920.0};
+static const double ark4_c[]  = {0, 0.5, 83.0/250.0, 31.0/50.0, 17.0/20.0, 1};
+
+static const imex_table ark436 = {6, 3, 0.25,
+  ark4_ae, ark4_ai, ark4_b, ark4_bh, ark4_c};
+
+/* table by name, for imex() */
+const imex_table *imextable(const char *name) {
+  if (strcmp(name, "ark324l2sa") == 0) return(&ark324);
+  if (strcmp(name, "ark436l2sa") == 0) return(&ark436);
+  error("unknown IMEX method '%s'", name);
+  return(NULL);
+}
+
+/*==========================================================================*/
+/* block Jacobian of the implicit part and the linear systems               */
+/*==========================================================================*/
+
+/* forward differences, perturbing species k in all cells at once;
+   block of cell c is J[c * nspec^2 + i + nspec * k]                    */
+static void imexjac(imex_blocks *blk, SEXP Funcimp, SEXP Parms, SEXP Rho,
+  double t, double *y, double *fI, double *ytmp, double *ftmp, double *out,
+  int neq, int *ipar, int isDll, int isForcing) {
+  int c, i, k, ns = blk->nspec, nc = blk->ncell, ns2 = ns * ns;
+  double delta;
+
+  for (i = 0; i < neq; i++) ytmp[i] = y[i];
+  for (k = 0; k < ns; k++) {
+    for (c = 0; c < nc; c++)
+      ytmp[c + nc * k] += sqrt(DBL_EPSILON * fmax(1e-5, fabs(y[c + nc * k])));
+    derivs(Funcimp, t, ytmp, Parms, Rho, ftmp, out, 0, neq, ipar, isDll,
+           isForcing);
+    blk->nfun++;
+    for (c = 0; c < nc; c++) {
+      delta = ytmp[c + nc * k] - y[c + nc * k];
+      for (i = 0; i < ns; i++)
+        blk->J[c * ns2 + i + ns * k] = (ftmp[c + nc * i] - fI[c + nc * i]) / delta;
+      ytmp[c + nc * k] = y[c + nc * k];
+    }
+  }
+  blk->njac++;
+  blk->jcur = TRUE;
+  blk->jage = 0;
+  blk->hg = 0;      /* the blocks need a new decomposition */
+}
+
+/* decompose I - gamma h J block by block; returns FALSE if singular */
+static int imexlu(imex_blocks *blk, double hg) {
+  int c, i, info = 0, ns = blk->nspec, ns2 = ns * ns;
+  double *M;
+
+  for (c = 0; c < blk->ncell; c++) {
+    M = blk->M + c * ns2;
+    for (i = 0; i < ns2; i++) M[i] = -hg * blk->J[c * ns2 + i];
+    for (i = 0; i < ns; i++) M[i + ns * i] += 1.0;
+    F77_CALL(dgefa)(M, &ns, &ns, blk->ipvt + c * ns, &info);
+    if (info != 0) {
+      blk->hg = 0;
+      return(FALSE);
+    }
+  }
+  blk->hg = hg;
+  blk->nlu++;
+  return(TRUE);
+}
+
+/* solve (I - gamma h J) x = r in place, cell by cell */
+static void imexsolve(imex_blocks *blk, double *r, double *v) {
+  int c, i, job = 0, ns = blk->nspec, nc = blk->ncell;
+
+  for (c = 0; c < nc; c++) {
+    for (i = 0; i < ns; i++) v[i] = r[c + nc * i];
+    F77_CALL(dgesl)(blk->M + c * ns * ns, &ns, &ns, blk->ipvt + c * ns, v, &job);
+    for (i = 0; i < ns; i++) r[c + nc * i] = v[i];
+  }
+}
+
+/*==========================================================================*/
+/* main loop                                                                */
+/*==========================================================================*/
+
+void rk_imex(
+       /* integers */
+       int neq, int isDll, int isForcing, int verbose,
+       int maxsteps, int nt, int isEvent,
+       /* int pointers */
+       int* _it, int* _it_tot, int* _it_rej, int* istate, int* ipar,
+       /* double */
+       double t, double tmax, double hmin, double hmax, double* _dt,
+       rk_control* ctl, imex_blocks* blk,
+       /* arrays */
+       double* tt, double* y0, double* y1, double* z, double* base,
+       double* FE, double* FI, double* f0, double* f1, double* err,
+       double* ytmp, double* ftmp, double* out,
+       double* atol, double* rtol, double* yout,
+       /* SEXPs */
+       SEXP Func, SEXP Funcimp, SEXP Parms, SEXP Rho
+  )
+{
+  const imex_table *ark = blk->ark;
+  int i, j, k, m, ns = ark->stage, it = *_it, it_tot = *_it_tot;
+  int nreject = *_it_rej, accept = FALSE, clipped, conv = TRUE, ievent = 0;
+  double dt = *_dt, dtnew, dtsave, tbreak, tnew, hg, serr, scal, errnorm;
+  double dn, dnold, rate, aE, aI, *v = ftmp + neq;
+
+  /* both parts at the initial state, they are the first stage */
+  derivs(Func, t, y0, Parms, Rho, FE, out, 0, neq, ipar, isDll, isForcing);
+  derivs(Funcimp, t, y0, Parms, Rho, FI, out, 0, neq, ipar, isDll, isForcing);
+  blk->nfun += 2;
+  for (i = 0; i < neq; i++) f0[i] = FE[i] + FI[i];
+
+  /*------------------------------------------------------------------------*/
+  /* Main Loop                                                              */
+  /*------------------------------------------------------------------------*/
+  while (it < nt && t < tmax) {
+    /* the step ends exactly at tmax or at the next event */
+    tbreak = tmax;
+    if (isEvent && iEvent < nEvent && tEvent > t && tEvent < tbreak)
+      tbreak = tEvent;
+    dtsave = dt;
+    clipped = (t + dt >= tbreak - 100.0 * DBL_EPSILON * fabs(tbreak));
+    if (clipped) dt = tbreak - t;
+
+    if (accept) timesteps[0] = timesteps[1];
+    timesteps[1] = dt;
+
+    /* Jacobian of the implicit part (kept for several steps) and the
+       iteration matrix (whenever gamma h changes)                         */
+    if (!blk->jcur && (blk->jage < 0 || blk->jage >= IMEX_MAXAGE || !conv))
+      imexjac(blk, Funcimp, Parms, Rho, t, y0, FI, ytmp, ftmp, out, neq,
+              ipar, isDll, isForcing);
+    hg = ark->gamma * dt;
+    if (hg != blk->hg && !imexlu(blk, hg)) {
+      conv = FALSE;
+    } else {
+      /******  stages 2 .. ns: explicit in fE, diagonally implicit in fI *****/
+      rate = 1.0;
+      for (k = 1; k < ns; k++) {
+        for (i = 0; i < neq; i++) base[i] = y0[i];
+        for (j = 0; j < k; j++) {
+          aE = dt * ark->ae[k * ns + j];
+          aI = dt * ark->ai[k * ns + j];
+          for (i = 0; i < neq; i++)
+            base[i] += aE * FE[i + neq * j] + aI * FI[i + neq * j];
+        }
+        /* simplified Newton iteration, starting from base */
+        for (i = 0; i < neq; i++) z[i] = base[i];
+        conv = FALSE;
+        dnold = 0;
+        for (m = 0; m < IMEX_MAXIT; m++) {
+          derivs(Funcimp, t + ark->c[k] * dt, z, Parms, Rho, ftmp, out, 0,
+                 neq, ipar, isDll, isForcing);
+          blk->nfun++;
+          blk->nnewt++;
+          for (i = 0; i < neq; i++) ytmp[i] = base[i] + hg * ftmp[i] - z[i];
+          imexsolve(blk, ytmp, v);
+          serr = 0;
+          for (i = 0; i < neq; i++) {
+            z[i] += ytmp[i];
+            scal = atol[i] + fabs(z[i]) * rtol[i];
+            if (scal > 0) serr += (ytmp[i]/scal) * (ytmp[i]/scal);
+          }
+          dn = sqrt(serr/neq);
+          if (m > 0) {
+            if (dn > 2.0 * dnold) break;    /* diverges */
+            rate = fmax(0.3 * rate, dn / dnold);
+          }
+          if (dn * fmin(1.0, rate) <= 0.1) {
+            conv = TRUE;
+            break;
+          }
+          dnold = dn;
+        }
+        if (!conv) break;
+        /* stage derivatives; fI from the stage equation, which does not
+           amplify the remaining error of the iteration in stiff components */
+        for (i = 0; i < neq; i++) FI[i + neq * k] = (z[i] - base[i]) / hg;
+        derivs(Func, t + ark->c[k] * dt, z, Parms, Rho, FE + neq * k, out, 0,
+               neq, ipar, isDll, isForcing);
+        blk->nfun++;
+      }
+    }
+    it_tot++; /* count total number of time steps */
+
+    /*----------------------------------------------------------------------*/
+    /* Newton iteration failed: new Jacobian or smaller step                */
+    /*----------------------------------------------------------------------*/
+    if (!conv) {
+      blk->nfail++;
+      if (blk->jcur) dt = 0.25 * dt;
+      accept = FALSE;
+      if (dt < hmin || t + dt == t) {
+        if (verbose) Rprintf("warning, Newton iteration fails with h < Hmin\n");
+        istate[0] = -5;   /* as in lsoda: repeated convergence failures */
+        break;
+      }
+      if (it_tot > maxsteps) {
+        if (verbose) Rprintf("Max. number of steps exceeded\n");
+        istate[0] = -1;
+        break;
+      }
+      continue;
+    }
+
+    /*======================================================================*/
+    /* new state, error estimate and step size adjustment                   */
+    /*======================================================================*/
+    for (i = 0; i < neq; i++) {
+      y1[i]  = y0[i];
+      err[i] = 0;
+    }
+    for (j = 0; j < ns; j++) {
+      double b = dt * ark->b[j], e = dt * (ark->b[j] - ark->bh[j]), fj;
+      for (i = 0; i < neq; i++) {
+        fj = FE[i + neq * j] + FI[i + neq * j];
+        y1[i]  += b * fj;
+        err[i] += e * fj;
+      }
+    }
+    serr = 0;
+    for (i = 0; i < neq; i++) {
+      scal = atol[i] + fmax(fabs(y0[i]), fabs(y1[i])) * rtol[i];
+      if (scal > 0) serr += (err[i]/scal) * (err[i]/scal);
+    }
+    errnorm = sqrt(serr/neq);
+
+    dtnew = dt * rkcontrol(ctl, errnorm, accept);
+    if (errnorm < 1.0) {
+      dtnew  = fmin(dtnew, hmax);
+      accept = TRUE;
+    } else if (errnorm > 1.0) {
+      nreject++;    /* count total number of rejected steps */
+      accept = FALSE;
+    }
+    if (dtnew < hmin) {
+      accept = TRUE;
+      if (verbose) Rprintf("warning, h < Hmin\n");
+      istate[0] = -2;
+      dtnew = hmin;
+    }
+    rkcontrol_update(ctl, dt, dtnew, accept);
+    /* a step shortened to hit a break is no reason to shrink the next */
+    if (accept && clipped) dtnew = fmax(dtnew, fmin(dtsave, hmax));
+
+    if (!accept) {
+      dt = dtnew;
+      if (it_tot > maxsteps) break;
+      continue;
+    }
+
+    /*----------------------------------------------------------------------*/
+    /* accepted: both parts at the new state are the first stage of the     */
+    /* next step and the end point of the Hermite interpolation             */
+    /*----------------------------------------------------------------------*/
+    tnew = clipped ? tbreak : t + dt;
+    derivs(Func, tnew, y1, Parms, Rho, FE, out, 0, neq, ipar, isDll,
+           isForcing);
+    derivs(Funcimp, tnew, y1, Parms, Rho, FI, out, 0, neq, ipar, isDll,
+           isForcing);
+    blk->nfun += 2;
+    for (i = 0; i < neq; i++) f1[i] = FE[i] + FI[i];
+
+    /* outputs up to, but not at the end of the step */
+    while (it < nt && tt[it] < tnew) {
+      yout[it] = tt[it];
+      densevalue(3, t, tt[it], tnew - t, NULL, 0, y0, y1, f0, f1, ytmp, neq);
+      for (i = 0; i < neq; i++) yout[it + nt * (1 + i)] = ytmp[i];
+      it++;
+    }
+
+    t  = tnew;
+    dt = dtnew;
+    for (i = 0; i < neq; i++) {
+      y0[i] = y1[i];
+      f0[i] = f1[i];
+    }
+    blk->jcur = FALSE;
+    blk->jage++;
+
+    /* output exactly at the end of the step, before the events, as in rk_auto */
+    if (it < nt && tt[it] == t) {
+      yout[it] = t;
+      for (i = 0; i < neq; i++) yout[it + nt * (1 + i)] = y0[i];
+      it++;
+    }
+
+    /* events change the state: restart with new derivatives and Jacobian */
+    if (isEvent && t == tEvent) {
+      updateevent(&t, y0, &ievent);
+      derivs(Func, t, y0, Parms, Rho, FE, out, 0, neq, ipar, isDll,
+             isForcing);
+      derivs(Funcimp, t, y0, Parms, Rho, FI, out, 0, neq, ipar, isDll,
+             isForcing);
+      blk->nfun += 2;
+      for (i = 0; i < neq; i++) f0[i] = FE[i] + FI[i];
+      blk->jage = -1;
+    }
+
+    if (it_tot > maxsteps) {
+      if (verbose) Rprintf("Max. number of steps exceeded\n");
+      istate[0] = -1;
+      break;
+    }
+  }
+
+  /* return reference values */
+  *_it = it; *_it_tot = it_tot; *_it_rej = nreject; *_dt = dt;
+}
@@ -92,7 +92,7 @@ void rk_implicit( double * alfa,  /* neq*stage * neq*stage */
        int* _iknots, int* _it, int* _it_ext, int* _it_tot, 
        int* istate,  int* ipar,
        /* double */
-        double t, double tmax, double hini,
+        double t, double tmax, double hini, double tol,
        /* double pointers */
        double* _dt,
        /* arrays */
@@ -111,7 +111,7 @@ void rk_implicit( double * alfa,  /* neq*stage * neq*stage */
   double t_ext;
   double dt = *_dt;
   int iter, maxit = 100;
-  double errf, errx;
+  double errf, errx, errx_old = 0;
   int nroot = neq * stage;
 
   /*------------------------------------------------------------------------*/
@@ -135,7 +135,7 @@ void rk_implicit( double * alfa,  /* neq*stage * neq*stage */
       it_tot++; /* count total number of time steps */
       errf = 0.;   
       for ( i = 0; i < nroot; i++) errf = errf + fabs(tmp[i]);
-      if (errf < 1e-8) break; 
+      if (errf < tol) break; 
       dkfunc(stage, neq, t, dt, FF, Fj, A, cc, y0, Func, Parms, Rho, 
         tmp, tmp2, tmp3, out, ipar, isDll, isForcing, alfa);
       it_tot = it_tot + nroot + 1;
@@ -146,7 +146,10 @@ void rk_implicit( double * alfa,  /* neq*stage * neq*stage */
         FF[i] = FF[i] - tmp[i];
       }  
       //  Rprintf("iter %i errf %g errx %g\n",iter, errf, errx);
-      if (errx < 1e-8) break; 
+      if (errx < tol) break; 
+      /* below 1e-8, stop if round-off prevents further convergence */
+      if (errx < 1e-8 && iter > 0 && errx >= errx_old) break;
+      errx_old = errx;
     }
 
     /*====================================================================*/
@@ -0,0 +1,533 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >= 2                 */
+/* Specialized kernels for the built-in Butcher tables                      */
+/*                                                                          */
+/* The generic solvers read A, b1, b2 and c at run time and loop over the   */
+/* full stage matrix. For the methods below the stage combinations are      */
+/* unrolled with the zero coefficients left out, and y1, y2 and the error   */
+/* norm of a variable step method are computed in one pass.                 */
+/* A kernel is only used if the tableau passed from R is identical to the   */
+/* built-in one, modified or user-defined methods use the generic code.     */
+/*==========================================================================*/
+
+#include <string.h>
+#include "rk_util.h"
+
+/* derivative of stage k for state variable i */
+#define K(k) FF[i + neq * (k)]
+
+/*--------------------------------------------------------------------------*/
+/* Euler method                                                             */
+/*--------------------------------------------------------------------------*/
+static const double euler_a[1] = {
+  0
+};
+static const double euler_b1[1] = {
+  1.0
+};
+static const double euler_c[1] = {
+  0
+};
+
+static void fixed_euler(int neq, double dt, double *y0, double *FF,
+  double *y1) {
+  int i;
+  for (i = 0; i < neq; i++)
+    y1[i] = y0[i] + dt * (euler_b1[0] * K(0));
+}
+
+/*--------------------------------------------------------------------------*/
+/* Heun's method                                                            */
+/*--------------------------------------------------------------------------*/
+static const double rk2_a[2] = {
+  0, 1.0
+};
+static const double rk2_b1[2] = {
+  0.5, 0.5
+};
+static const double rk2_c[2] = {
+  0, 1.0
+};
+
+static void fixed_rk2(int neq, double dt, double *y0, double *FF,
+  double *y1) {
+  int i;
+  for (i = 0; i < neq; i++)
+    y1[i] = y0[i] + dt * (rk2_b1[0] * K(0) + rk2_b1[1] * K(1));
+}
+
+/*--------------------------------------------------------------------------*/
+/* Classical Runge-Kutta 4th order method                                   */
+/*--------------------------------------------------------------------------*/
+static const double rk4_a[4] = {
+  0, 0.5, 0.5, 1.0
+};
+static const double rk4_b1[4] = {
+  1.0/6.0, 1.0/3.0, 1.0/3.0, 1.0/6.0
+};
+static const double rk4_c[4] = {
+  0, 0.5, 0.5, 1.0
+};
+
+static void fixed_rk4(int neq, double dt, double *y0, double *FF,
+  double *y1) {
+  int i;
+  for (i = 0; i < neq; i++)
+    y1[i] = y0[i] + dt * (rk4_b1[0] * K(0) + rk4_b1[1] * K(1) +
+      rk4_b1[2] * K(2) + rk4_b1[3] * K(3));
+}
+
+/*--------------------------------------------------------------------------*/
+/* Bogacki-Shampine 3(2) ("rk23bs", "ode23")                                */
+/*--------------------------------------------------------------------------*/
+static const double bs23_a[4][3] = {
+  {0, 0, 0},
+  {1.0/2.0, 0, 0},
+  {0, 3.0/4.0, 0},
+  {2.0/9.0, 1.0/3.0, 4.0/9.0}
+};
+static const double bs23_b1[4] = {
+  7.0/24.0, 1.0/4.0, 1.0/3.0, 1.0/8.0
+};
+static const double bs23_b2[4] = {
+  2.0/9.0, 1.0/3.0, 4.0/9.0, 0
+};
+static const double bs23_c[4] = {
+  0, 1.0/2.0, 3.0/4.0, 1.0
+};
+
+static void stage_bs23(int j, int neq, double dt, double *y0, double *FF,
+  double *tmp) {
+  int i;
+  switch (j) {
+  case 1:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (bs23_a[1][0] * K(0));
+    break;
+  case 2:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (bs23_a[2][1] * K(1));
+    break;
+  case 3:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (bs23_a[3][0] * K(0) + bs23_a[3][1] * K(1) +
+        bs23_a[3][2] * K(2));
+    break;
+  default:
+    for (i = 0; i < neq; i++) tmp[i] = y0[i];
+  }
+}
+
+static double step_bs23(int neq, double dt, double *y0, double *FF,
+  double *y1, double *y2, double *atol, double *rtol) {
+  int i;
+  double d1, d2, scal, delta, serr = 0;
+  for (i = 0; i < neq; i++) {
+    d1 = bs23_b1[0] * K(0) + bs23_b1[1] * K(1) + bs23_b1[2] * K(2) +
+      bs23_b1[3] * K(3);
+    d2 = bs23_b2[0] * K(0) + bs23_b2[1] * K(1) + bs23_b2[2] * K(2);
+    y1[i] = y0[i] + dt * d1;
+    y2[i] = y0[i] + dt * d2;
+    scal  = atol[i] + fmax(fabs(y0[i]), fabs(y2[i])) * rtol[i];
+    delta = fabs(y2[i] - y1[i]);
+    if (scal > 0) serr += (delta/scal) * (delta/scal);
+  }
+  return(sqrt(serr/neq));
+}
+
+/*--------------------------------------------------------------------------*/
+/* Cash-Karp 4(5) ("rk45ck")                                                */
+/*--------------------------------------------------------------------------*/
+static const double ck45_a[6][5] = {
+  {0, 0, 0, 0, 0},
+  {1.0/5.0, 0, 0, 0, 0},
+  {3.0/40.0, 9.0/40.0, 0, 0, 0},
+  {3.0/10.0, -9.0/10.0, 6.0/5.0, 0, 0},
+  {-11.0/54.0, 5.0/2.0, -70.0/27.0, 35.0/27.0, 0},
+  {1631.0/55296.0, 175.0/512.0, 575.0/13824.0, 44275.0/110592.0,
+   253.0/4096.0}
+};
+static const double ck45_b1[6] = {
+  2825.0/27648.0, 0, 18575.0/48384.0, 13525.0/55296.0, 277.0/14336.0,
+  1.0/4.0
+};
+static const double ck45_b2[6] = {
+  37.0/378.0, 0, 250.0/621.0, 125.0/594.0, 0, 512.0/1771.0
+};
+static const double ck45_c[6] = {
+  0, 1.0/5.0, 3.0/10.0, 3.0/5.0, 1.0, 7.0/8.0
+};
+
+static void stage_ck45(int j, int neq, double dt, double *y0, double *FF,
+  double *tmp) {
+  int i;
+  switch (j) {
+  case 1:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (ck45_a[1][0] * K(0));
+    break;
+  case 2:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (ck45_a[2][0] * K(0) + ck45_a[2][1] * K(1));
+    break;
+  case 3:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (ck45_a[3][0] * K(0) + ck45_a[3][1] * K(1) +
+        ck45_a[3][2] * K(2));
+    break;
+  case 4:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (ck45_a[4][0] * K(0) + ck45_a[4][1] * K(1) +
+        ck45_a[4][2] * K(2) + ck45_a[4][3] * K(3));
+    break;
+  case 5:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (ck45_a[5][0] * K(0) + ck45_a[5][1] * K(1) +
+        ck45_a[5][2] * K(2) + ck45_a[5][3] * K(3) + ck45_a[5][4] * K(4));
+    break;
+  default:
+    for (i = 0; i < neq; i++) tmp[i] = y0[i];
+  }
+}
+
+static double step_ck45(int neq, double dt, double *y0, double *FF,
+  double *y1, double *y2, double *atol, double *rtol) {
+  int i;
+  double d1, d2, scal, delta, serr = 0;
+  for (i = 0; i < neq; i++) {
+    d1 = ck45_b1[0] * K(0) + ck45_b1[2] * K(2) + ck45_b1[3] * K(3) +
+      ck45_b1[4] * K(4) + ck45_b1[5] * K(5);
+    d2 = ck45_b2[0] * K(0) + ck45_b2[2] * K(2) + ck45_b2[3] * K(3) +
+      ck45_b2[5] * K(5);
+    y1[i] = y0[i] + dt * d1;
+    y2[i] = y0[i] + dt * d2;
+    scal  = atol[i] + fmax(fabs(y0[i]), fabs(y2[i])) * rtol[i];
+    delta = fabs(y2[i] - y1[i]);
+    if (scal > 0) serr += (delta/scal) * (delta/scal);
+  }
+  return(sqrt(serr/neq));
+}
+
+/*--------------------------------------------------------------------------*/
+/* Dormand-Prince 5(4)7m ("rk45dp7", "ode45")                               */
+/*--------------------------------------------------------------------------*/
+static const double dp7_a[7][6] = {
+  {0, 0, 0, 0, 0, 0},
+  {1.0/5.0, 0, 0, 0, 0, 0},
+  {3.0/40.0, 9.0/40.0, 0, 0, 0, 0},
+  {44.0/45.0, -56.0/15.0, 32.0/9.0, 0, 0, 0},
+  {19372.0/6561.0, -25360.0/2187.0, 64448.0/6561.0, -212.0/729.0, 0, 0},
+  {9017.0/3168.0, -355.0/33.0, 46732.0/5247.0, 49.0/176.0, -5103.0/18656.0,
+   0},
+  {35.0/384.0, 0, 500.0/1113.0, 125.0/192.0, -2187.0/6784.0, 11.0/84.0}
+};
+static const double dp7_b1[7] = {
+  5179.0/57600.0, 0, 7571.0/16695.0, 393.0/640.0, -92097.0/339200.0,
+  187.0/2100.0, 1.0/40.0
+};
+static const double dp7_b2[7] = {
+  35.0/384.0, 0, 500.0/1113.0, 125.0/192.0, -2187.0/6784.0, 11.0/84.0, 0
+};
+static const double dp7_c[7] = {
+  0, 1.0/5.0, 3.0/10.0, 4.0/5.0, 8.0/9.0, 1.0, 1.0
+};
+
+static void stage_dp7(int j, int neq, double dt, double *y0, double *FF,
+  double *tmp) {
+  int i;
+  switch (j) {
+  case 1:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp7_a[1][0] * K(0));
+    break;
+  case 2:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp7_a[2][0] * K(0) + dp7_a[2][1] * K(1));
+    break;
+  case 3:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp7_a[3][0] * K(0) + dp7_a[3][1] * K(1) +
+        dp7_a[3][2] * K(2));
+    break;
+  case 4:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp7_a[4][0] * K(0) + dp7_a[4][1] * K(1) +
+        dp7_a[4][2] * K(2) + dp7_a[4][3] * K(3));
+    break;
+  case 5:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp7_a[5][0] * K(0) + dp7_a[5][1] * K(1) +
+        dp7_a[5][2] * K(2) + dp7_a[5][3] * K(3) + dp7_a[5][4] * K(4));
+    break;
+  case 6:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp7_a[6][0] * K(0) + dp7_a[6][2] * K(2) +
+        dp7_a[6][3] * K(3) + dp7_a[6][4] * K(4) + dp7_a[6][5] * K(5));
+    break;
+  default:
+    for (i = 0; i < neq; i++) tmp[i] = y0[i];
+  }
+}
+
+static double step_dp7(int neq, double dt, double *y0, double *FF,
+  double *y1, double *y2, double *atol, double *rtol) {
+  int i;
+  double d1, d2, scal, delta, serr = 0;
+  for (i = 0; i < neq; i++) {
+    d1 = dp7_b1[0] * K(0) + dp7_b1[2] * K(2) + dp7_b1[3] * K(3) +
+      dp7_b1[4] * K(4) + dp7_b1[5] * K(5) + dp7_b1[6] * K(6);
+    d2 = dp7_b2[0] * K(0) + dp7_b2[2] * K(2) + dp7_b2[3] * K(3) +
+      dp7_b2[4] * K(4) + dp7_b2[5] * K(5);
+    y1[i] = y0[i] + dt * d1;
+    y2[i] = y0[i] + dt * d2;
+    scal  = atol[i] + fmax(fabs(y0[i]), fabs(y2[i])) * rtol[i];
+    delta = fabs(y2[i] - y1[i]);
+    if (scal > 0) serr += (delta/scal) * (delta/scal);
+  }
+  return(sqrt(serr/neq));
+}
+
+/*--------------------------------------------------------------------------*/
+/* Dormand-Prince 8(7) ("rk78dp")                                           */
+/*--------------------------------------------------------------------------*/
+static const double dp78_a[13][12] = {
+  {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+  {1.0/18.0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+  {1.0/48.0, 1.0/16.0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+  {1.0/32.0, 0, 3.0/32.0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+  {5.0/16.0, 0, -75.0/64.0, 75.0/64.0, 0, 0, 0, 0, 0, 0, 0, 0},
+  {3.0/80.0, 0, 0, 3.0/16.0, 3.0/20.0, 0, 0, 0, 0, 0, 0, 0},
+  {29443841.0/614563906.0, 0, 0, 77736538.0/692538347.0,
+   -28693883.0/1125000000.0, 23124283.0/1800000000.0, 0, 0, 0, 0, 0, 0},
+  {16016141.0/946692911.0, 0, 0, 61564180.0/158732637.0,
+   22789713.0/633445777.0, 545815736.0/2771057229.0,
+   -180193667.0/1043307555.0, 0, 0, 0, 0, 0},
+  {39632708.0/573591083.0, 0, 0, -433636366.0/683701615.0,
+   -421739975.0/2616292301.0, 100302831.0/723423059.0,
+   790204164.0/839813087.0, 800635310.0/3783071287.0, 0, 0, 0, 0},
+  {246121993.0/1340847787.0, 0, 0, -37695042795.0/15268766246.0,
+   -309121744.0/1061227803.0, -12992083.0/490766935.0,
+   6005943493.0/2108947869.0, 393006217.0/1396673457.0,
+   123872331.0/1001029789.0, 0, 0, 0},
+  {-1028468189.0/846180014.0, 0, 0, 8478235783.0/508512852.0,
+   1311729495.0/1432422823.0, -10304129995.0/1701304382.0,
+   -48777925059.0/3047939560.0, 15336726248.0/1032824649.0,
+   -45442868181.0/3398467696.0, 3065993473.0/597172653.0, 0, 0},
+  {185892177.0/718116043.0, 0, 0, -3185094517.0/667107341.0,
+   -477755414.0/1098053517.0, -703635378.0/230739211.0,
+   5731566787.0/1027545527.0, 5232866602.0/850066563.0,
+   -4093664535.0/808688257.0, 3962137247.0/1805957418.0,
+   65686358.0/487910083.0, 0},
+  {403863854.0/491063109.0, 0, 0, -5068492393.0/434740067.0,
+   -411421997.0/543043805.0, 652783627.0/914296604.0,
+   11173962825.0/925320556.0, -13158990841.0/6184727034.0,
+   3936647629.0/1978049680.0, -160528059.0/685178525.0,
+   248638103.0/1413531060.0, 0}
+};
+static const double dp78_b1[13] = {
+  13451932.0/455176623.0, 0, 0, 0, 0, -808719846.0/976000145.0,
+  1757004468.0/5645159321.0, 656045339.0/265891186.0,
+  -3867574721.0/1518517206.0, 465885868.0/322736535.0,
+  53011238.0/667516719.0, 2.0/45.0, 0
+};
+static const double dp78_b2[13] = {
+  14005451.0/335480064.0, 0, 0, 0, 0, -59238493.0/1068277825.0,
+  181606767.0/758867731.0, 561292985.0/797845732.0,
+  -1041891430.0/1371343529.0, 760417239.0/1151165299.0,
+  118820643.0/751138087.0, -528747749.0/2220607170.0, 1.0/4.0
+};
+static const double dp78_c[13] = {
+  0, 1.0/18.0, 1.0/12.0, 1.0/8.0, 5.0/16.0, 3.0/8.0, 59.0/400.0, 93.0/200.0,
+  5490023248.0/9719169821.0, 13.0/20.0, 1201146811.0/1299019798.0, 1.0, 1.0
+};
+
+static void stage_dp78(int j, int neq, double dt, double *y0, double *FF,
+  double *tmp) {
+  int i;
+  switch (j) {
+  case 1:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[1][0] * K(0));
+    break;
+  case 2:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[2][0] * K(0) + dp78_a[2][1] * K(1));
+    break;
+  case 3:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[3][0] * K(0) + dp78_a[3][2] * K(2));
+    break;
+  case 4:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[4][0] * K(0) + dp78_a[4][2] * K(2) +
+        dp78_a[4][3] * K(3));
+    break;
+  case 5:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[5][0] * K(0) + dp78_a[5][3] * K(3) +
+        dp78_a[5][4] * K(4));
+    break;
+  case 6:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[6][0] * K(0) + dp78_a[6][3] * K(3) +
+        dp78_a[6][4] * K(4) + dp78_a[6][5] * K(5));
+    break;
+  case 7:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[7][0] * K(0) + dp78_a[7][3] * K(3) +
+        dp78_a[7][4] * K(4) + dp78_a[7][5] * K(5) + dp78_a[7][6] * K(6));
+    break;
+  case 8:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[8][0] * K(0) + dp78_a[8][3] * K(3) +
+        dp78_a[8][4] * K(4) + dp78_a[8][5] * K(5) + dp78_a[8][6] * K(6) +
+        dp78_a[8][7] * K(7));
+    break;
+  case 9:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[9][0] * K(0) + dp78_a[9][3] * K(3) +
+        dp78_a[9][4] * K(4) + dp78_a[9][5] * K(5) + dp78_a[9][6] * K(6) +
+        dp78_a[9][7] * K(7) + dp78_a[9][8] * K(8));
+    break;
+  case 10:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[10][0] * K(0) + dp78_a[10][3] * K(3) +
+        dp78_a[10][4] * K(4) + dp78_a[10][5] * K(5) + dp78_a[10][6] * K(6) +
+        dp78_a[10][7] * K(7) + dp78_a[10][8] * K(8) + dp78_a[10][9] * K(9));
+    break;
+  case 11:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[11][0] * K(0) + dp78_a[11][3] * K(3) +
+        dp78_a[11][4] * K(4) + dp78_a[11][5] * K(5) + dp78_a[11][6] * K(6) +
+        dp78_a[11][7] * K(7) + dp78_a[11][8] * K(8) + dp78_a[11][9] * K(9) +
+        dp78_a[11][10] * K(10));
+    break;
+  case 12:
+    for (i = 0; i < neq; i++)
+      tmp[i] = y0[i] + dt * (dp78_a[12][0] * K(0) + dp78_a[12][3] * K(3) +
+        dp78_a[12][4] * K(4) + dp78_a[12][5] * K(5) + dp78_a[12][6] * K(6) +
+        dp78_a[12][7] * K(7) + dp78_a[12][8] * K(8) + dp78_a[12][9] * K(9) +
+        dp78_a[12][10] * K(10));
+    break;
+  default:
+    for (i = 0; i < neq; i++) tmp[i] = y0[i];
+  }
+}
+
+static double step_dp78(int neq, double dt, double *y0, double *FF,
+  double *y1, double *y2, double *atol, double *rtol) {
+  int i;
+  double d1, d2, scal, delta, serr = 0;
+  for (i = 0; i < neq; i++) {
+    d1 = dp78_b1[0] * K(0) + dp78_b1[5] * K(5) + dp78_b1[6] * K(6) +
+      dp78_b1[7] * K(7) + dp78_b1[8] * K(8) + dp78_b1[9] * K(9) +
+      dp78_b1[10] * K(10) + dp78_b1[11] * K(11);
+    d2 = dp78_b2[0] * K(0) + dp78_b2[5] * K(5) + dp78_b2[6] * K(6) +
+      dp78_b2[7] * K(7) + dp78_b2[8] * K(8) + dp78_b2[9] * K(9) +
+      dp78_b2[10] * K(10) + dp78_b2[11] * K(11) + dp78_b2[12] * K(12);
+    y1[i] = y0[i] + dt * d1;
+    y2[i] = y0[i] + dt * d2;
+    scal  = atol[i] + fmax(fabs(y0[i]), fabs(y2[i])) * rtol[i];
+    delta = fabs(y2[i] - y1[i]);
+    if (scal > 0) serr += (delta/scal) * (delta/scal);
+  }
+  return(sqrt(serr/neq));
+}
+#undef K
+
+/*==========================================================================*/
+/* table of kernels                                                         */
+/*==========================================================================*/
+
+typedef void rk_stage_type(int, int, double, double *, double *, double *);
+typedef double rk_step_type(int, double, double *, double *, double *,
+  double *, double *, double *);
+typedef void rk_fixed_type(int, double, double *, double *, double *);
+
+typedef struct {
+  const char *id;
+  int stage;
+  int varstep;
+  const double *a, *b1, *b2, *c;
+  rk_stage_type *stagefun;
+  rk_step_type  *stepfun;
+  rk_fixed_type *fixedfun;
+} rk_kernel_type;
+
+static const rk_kernel_type rkkernels[] = {
+  {"euler",   1,  FALSE, euler_a, euler_b1, NULL, euler_c,
+    NULL, NULL, fixed_euler},
+  {"rk2",     2,  FALSE, rk2_a, rk2_b1, NULL, rk2_c,
+    NULL, NULL, fixed_rk2},
+  {"rk4",     4,  FALSE, rk4_a, rk4_b1, NULL, rk4_c,
+    NULL, NULL, fixed_rk4},
+  {"rk23bs",  4,  TRUE, bs23_a[0], bs23_b1, bs23_b2, bs23_c,
+    stage_bs23, step_bs23, NULL},
+  {"rk45ck",  6,  TRUE, ck45_a[0], ck45_b1, ck45_b2, ck45_c,
+    stage_ck45, step_ck45, NULL},
+  {"rk45dp7", 7,  TRUE, dp7_a[0], dp7_b1, dp7_b2, dp7_c,
+    stage_dp7, step_dp7, NULL},
+  {"rk78dp",  13, TRUE, dp78_a[0], dp78_b1, dp78_b2, dp78_c,
+    stage_dp78, step_dp78, NULL}
+};
+
+static const int nrkkernels = sizeof(rkkernels) / sizeof(rk_kernel_type);
+
+static int samecoef(const double *x, double *y, int n) {
+  for (int i = 0; i < n; i++)
+    if (fabs(x[i] - y[i]) > 4 * DBL_EPSILON * fabs(x[i])) return(FALSE);
+  return(TRUE);
+}
+
+/*--------------------------------------------------------------------------*/
+/* select the kernel for method "Method"; A is a vector for fixed step      */
+/* methods and a stage x (stage - 1) or stage x stage matrix otherwise.     */
+/* Returns 0 (generic code) if no kernel matches the tableau.               */
+/*--------------------------------------------------------------------------*/
+int rk_kernelid(SEXP Method, int varstep, int stage, double *A, double *bb1,
+  double *bb2, double *cc) {
+  SEXP ID = getListElement(Method, "ID");
+  const char *id;
+  int j, k, m;
+
+  if (!isString(ID) || LENGTH(ID) < 1 || cc == NULL) return(0);
+  id = CHAR(STRING_ELT(ID, 0));
+
+  for (m = 0; m < nrkkernels; m++) {
+    const rk_kernel_type *kern = &rkkernels[m];
+    if (strcmp(id, kern->id) != 0) continue;
+    if (kern->varstep != varstep || kern->stage != stage) return(0);
+    if (!samecoef(kern->b1, bb1, stage) || !samecoef(kern->c, cc, stage))
+      return(0);
+    if (varstep) {
+      if (bb2 == NULL || !samecoef(kern->b2, bb2, stage)) return(0);
+      /* strictly lower triangle, kernel table is stored by rows */
+      for (j = 1; j < stage; j++)
+        for (k = 0; k < j; k++)
+          if (!samecoef(&kern->a[j * (stage - 1) + k], &A[j + stage * k], 1))
+            return(0);
+    } else {
+      if (!samecoef(kern->a, A, stage)) return(0);
+    }
+    return(m + 1);
+  }
+  return(0);
+}
+
+/* argument of stage j: tmp = y0 + dt * sum_k a[j, k] * FF[, k] */
+void rk_kernelstage(int kernel, int j, int neq, double dt, double *y0,
+  double *FF, double *tmp) {
+  rkkernels[kernel - 1].stagefun(j, neq, dt, y0, FF, tmp);
+}
+
+/* new values y1, y2 and error norm of a variable step method */
+double rk_kernelstep(int kernel, int neq, double dt, double *y0, double *FF,
+  double *y1, double *y2, double *atol, double *rtol) {
+  return(rkkernels[kernel - 1].stepfun(neq, dt, y0, FF, y1, y2, atol, rtol));
+}
+
+/* new values y1 of a fixed step method */
+void rk_kernelfixed(int kernel, int neq, double dt, double *y0, double *FF,
+  double *y1) {
+  rkkernels[kernel - 1].fixedfun(neq, dt, y0, FF, y1);
+}
@@ -0,0 +1,156 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >= 2                 */
+/* Low-storage (2N) Runge-Kutta methods in the form of Williamson (1980)    */
+/* -- main loop == core function --                                         */
+/*==========================================================================*/
+/*
+  One step with stages j = 0 .. stage - 1 is
+
+    dq = A[j] * dq + dt * f(t + c[j] * dt, y)
+    y  = y + B[j] * dq
+
+  so that only the state y, the register dq and the derivative f are
+  needed. With error control, the error estimate err = sum_j w[j] * dq_j
+  is the only additional register, where w is derived from the embedded
+  weights. The state at the begin of a rejected step is not kept, but
+  recovered by running the stages backwards (A[j] != 0 for j > 0):
+
+    y  = y - B[j] * dq
+    dq = (dq - dt * f(t + c[j] * dt, y)) / A[j]
+
+  which costs stage - 1 evaluations of f per rejected step.
+  The solver steps exactly to the output times and the events,
+  no interpolation is done.
+*/
+
+#include "rk_util.h"
+
+void rk_lowstorage(
+       /* integers */
+       int neq, int stage, int isDll, int isForcing, int verbose,
+       int varstep, int maxsteps, int nt, int isEvent,
+       /* int pointers */
+       int* _it, int* _it_tot, int* _it_rej, int* istate, int* ipar,
+       /* double */
+       double t, double tmax, double hmin, double hmax, double hini,
+       rk_control* ctl,
+       /* arrays */
+       double* tt, double* y, double* dq, double* f, double* err,
+       double* A, double* B, double* cc, double* ww, double* out,
+       double* atol, double* rtol, double* yout,
+       /* SEXPs */
+       SEXP Func, SEXP Parms, SEXP Rho
+  )
+{
+  int i, j, it = *_it, it_tot = *_it_tot, nreject = *_it_rej;
+  int accept = FALSE, clipped, ievent = 0;
+  double dt, dtnew, dtsave, tbreak, serr, scal, errnorm;
+
+  dt = (hini > 0) ? hini : tt[1] - tt[0];
+  if (varstep) dt = fmin(dt, hmax);
+
+  /*------------------------------------------------------------------------*/
+  /* Main Loop: one output interval after the other                         */
+  /*------------------------------------------------------------------------*/
+  while (it < nt && tt[it] <= tmax) {
+    while (t < tt[it]) {
+      /* the step ends exactly at the next output time or event */
+      tbreak = tt[it];
+      if (isEvent && iEvent < nEvent && tEvent > t && tEvent < tbreak)
+        tbreak = tEvent;
+      if (!varstep && hini <= 0) dt = tbreak - t;
+      dtsave = dt;
+      clipped = (t + dt >= tbreak - 100.0 * DBL_EPSILON * fabs(tbreak));
+      if (clipped) dt = tbreak - t;
+
+      if (accept) timesteps[0] = timesteps[1];
+      timesteps[1] = dt;
+
+      /******  stages in 2N form ******/
+      for (j = 0; j < stage; j++) {
+        derivs(Func, t + cc[j] * dt, y, Parms, Rho, f, out, 0, neq,
+               ipar, isDll, isForcing);
+        if (varstep) {
+          for (i = 0; i < neq; i++) {
+            dq[i]  = A[j] * dq[i] + dt * f[i];
+            y[i]  += B[j] * dq[i];
+            err[i] = (j == 0) ? ww[0] * dq[i] : err[i] + ww[j] * dq[i];
+          }
+        } else {
+          for (i = 0; i < neq; i++) {
+            dq[i]  = A[j] * dq[i] + dt * f[i];
+            y[i]  += B[j] * dq[i];
+          }
+        }
+      }
+      it_tot++; /* count total number of time steps */
+
+      /*==================================================================*/
+      /*      stepsize adjustment                                         */
+      /*==================================================================*/
+      if (varstep) {
+        serr = 0;
+        for (i = 0; i < neq; i++) {
+          scal = atol[i] + fabs(y[i]) * rtol[i];
+          if (scal > 0) serr += (err[i]/scal) * (err[i]/scal);
+        }
+        errnorm = sqrt(serr/neq);
+
+        dtnew = dt * rkcontrol(ctl, errnorm, accept);
+        if (errnorm < 1.0) {
+          dtnew  = fmin(dtnew, hmax);
+          accept = TRUE;
+        } else if (errnorm > 1.0) {
+          nreject++;    /* count total number of rejected steps */
+          accept = FALSE;
+        }
+        if (dtnew < hmin) {
+          accept = TRUE;
+          if (verbose) Rprintf("warning, h < Hmin\n");
+          istate[0] = -2;
+          dtnew = hmin;
+        }
+        rkcontrol_update(ctl, dt, dtnew, accept);
+        /* a step shortened to hit a break is no reason to shrink the next */
+        if (accept && clipped) dtnew = fmax(dtnew, fmin(dtsave, hmax));
+
+        if (!accept) {
+          /* back to the begin of the step, stage by stage */
+          for (j = stage - 1; j >= 0; j--) {
+            for (i = 0; i < neq; i++) y[i] -= B[j] * dq[i];
+            if (j == 0) break;
+            derivs(Func, t + cc[j] * dt, y, Parms, Rho, f, out, 0, neq,
+                   ipar, isDll, isForcing);
+            for (i = 0; i < neq; i++) dq[i] = (dq[i] - dt * f[i]) / A[j];
+          }
+          dt = dtnew;
+          if (it_tot > maxsteps) break;
+          continue;
+        }
+      } else {
+        dtnew = dtsave;
+      }
+
+      /*------------------------------------------------------------------*/
+      /* next time step                                                   */
+      /*------------------------------------------------------------------*/
+      t = clipped ? tbreak : t + dt;
+      dt = dtnew;
+      if (isEvent && t == tEvent) updateevent(&t, y, &ievent);
+
+      if (it_tot > maxsteps) break;
+    }
+    if (it_tot > maxsteps) {
+      if (verbose) Rprintf("Max. number of steps exceeded\n");
+      istate[0] = -1;
+      break;
+    }
+    /* store outputs */
+    yout[it] = t;
+    for (i = 0; i < neq; i++) yout[it + nt * (1 + i)] = y[i];
+    it++;
+  }
+
+  /* return reference values */
+  *_it = it; *_it_tot = it_tot; *_it_rej = nreject;
+}
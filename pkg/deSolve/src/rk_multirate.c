@@ -0,0 +1,178 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >= 2                 */
+/* Multirate infinitesimal GARK (MRI-GARK) methods                          */
+/* -- main loop == core function --                                         */
+/*==========================================================================*/
+/*
+  dy/dt = fS(t, y) + fF(t, y) with a slow part fS, evaluated once per
+  stage of the outer method with the large step H, and a fast part fF,
+  integrated with the small step hfast. Stage i (Sandu 2019) solves the
+  fast problem
+
+    v' = dc_i fF(T_i + dc_i theta, v) + sum_{j<=i} (g0_ij + g1_ij theta/H) fS_j
+
+  for theta in [0, H], from v(0) = Y_i to Y_{i+1} = v(H), where
+  dc_i = c_{i+1} - c_i, T_i = t + c_i H and fS_j = fS(T_j, Y_j). The fast
+  problems are integrated with the classical Runge-Kutta method, with
+  steps of (at most) hfast in physical time. The last stage is the new
+  solution; the steps end exactly at the output times.
+*/
+
+#include "rk_util.h"
+#include <string.h>
+
+/*==========================================================================*/
+/* coefficients                                                             */
+/*==========================================================================*/
+
+/* MRI-GARK-ERK22a and ERK22b, order 2 */
+static const double erk22a_c[]  = {0, 0.5, 1};
+static const double erk22a_g0[] = {0.5, 0, 0,  -0.5, 1, 0};
+static const double erk22b_c[]  = {0, 1, 1};
+static const double erk22b_g0[] = {1, 0, 0,  -0.5, 0.5, 0};
+static const double erk22_g1[]  = {0, 0, 0,  0, 0, 0};
+
+/* MRI-GARK-ERK33a, order 3 */
+static const double erk33a_c[]  = {0, 1.0/3.0, 2.0/3.0, 1};
+static const double erk33a_g0[] = {
+  1.0/3.0, 0, 0, 0,
+  -1.0/3.0, 2.0/3.0, 0, 0,
+  0, -2.0/3.0, 1, 0};
+static const double erk33a_g1[] = {
+  0, 0, 0, 0,
+  0, 0, 0, 0,
+  0.5, 0, -0.5, 0};
+
+/* MRI-GARK-ERK45a, order 4 */
+static const double erk45a_c[]  = {0, 0.2, 0.4, 0.6, 0.8, 1};
+static const double erk45a_g0[] = {
+  0.2, 0, 0, 0, 0, 0,
+  -53.0/16.0, 281.0/80.0, 0, 0, 0, 0,
+  -36562993.0/71394880.0, 34903117.0/17848720.0, -88770499.0/71394880.0,
+  0, 0, 0,
+  -7631593.0/71394880.0, -166232021.0/35697440.0, 6068517.0/1519040.0,
+  8644289.0/8924360.0, 0, 0,
+  277061.0/303808.0, -209323.0/1139280.0, -1360217.0/1139280.0,
+  -148789.0/56964.0, 147889.0/45120.0, 0};
+static const double erk45a_g1[] = {
+  0, 0, 0, 0, 0, 0,
+  503.0/80.0, -503.0/80.0, 0, 0, 0, 0,
+  -1365537.0/35697440.0, 4963773.0/7139488.0, -1465833.0/2231090.0,
+  0, 0, 0,
+  66974357.0/35697440.0, 21445367.0/7139488.0, -3,
+  -8388609.0/4462180.0, 0, 0,
+  -18227.0/7520.0, 2, 1, 5, -41933.0/7520.0, 0};
+
+static const mri_table erk22a = {3, 2, erk22a_c, erk22a_g0, erk22_g1};
+static const mri_table erk22b = {3, 2, erk22b_c, erk22b_g0, erk22_g1};
+static const mri_table erk33a = {4, 3, erk33a_c, erk33a_g0, erk33a_g1};
+static const mri_table erk45a = {6, 4, erk45a_c, erk45a_g0, erk45a_g1};
+
+/* table by name, for multirate() */
+const mri_table *mritable(const char *name) {
+  if (strcmp(name, "erk22a") == 0) return(&erk22a);
+  if (strcmp(name, "erk22b") == 0) return(&erk22b);
+  if (strcmp(name, "erk33a") == 0) return(&erk33a);
+  if (strcmp(name, "erk45a") == 0) return(&erk45a);
+  error("unknown multirate method '%s'", name);
+  return(NULL);
+}
+
+/*==========================================================================*/
+/* the fast problem of one stage, m steps of the classical RK method;     */
+/* ga and gb are the constant and linear part of the slow forcing          */
+/*==========================================================================*/
+static void mrifast(int neq, int m, double T, double dc, double H,
+  double *y, double *ga, double *gb, double *ytmp, double *K, double *out,
+  int *ipar, int *nfast, SEXP Funcfast, SEXP Parms, SEXP Rho, int isDll,
+  int isForcing) {
+
+  static const double a[] = {0, 0.5, 0.5, 1}, b[] = {1, 2, 2, 1};
+  int i, k, n;
+  double d = H / m, th, thk, *Kk;
+
+  for (n = 0; n < m; n++) {
+    th = n * d;
+    for (k = 0; k < 4; k++) {
+      Kk = K + neq * k;
+      thk = th + a[k] * d;
+      if (k == 0)
+        for (i = 0; i < neq; i++) ytmp[i] = y[i];
+      else
+        for (i = 0; i < neq; i++) ytmp[i] = y[i] + a[k] * d * K[i + neq * (k-1)];
+      if (dc > 0) {
+        derivs(Funcfast, T + dc * thk, ytmp, Parms, Rho, K, out, k, neq,
+               ipar, isDll, isForcing);
+        (*nfast)++;
+        for (i = 0; i < neq; i++) Kk[i] = dc * Kk[i] + ga[i] + thk / H * gb[i];
+      } else {
+        /* no fast part, e.g. stages at the same time */
+        for (i = 0; i < neq; i++) Kk[i] = ga[i] + thk / H * gb[i];
+      }
+    }
+    for (i = 0; i < neq; i++)
+      y[i] += d / 6.0 * (b[0] * K[i] + b[1] * K[i + neq] +
+                         b[2] * K[i + 2 * neq] + b[3] * K[i + 3 * neq]);
+  }
+}
+
+/*==========================================================================*/
+/* main loop: nsub equal slow steps per output interval, no longer than    */
+/* hslow                                                                    */
+/*==========================================================================*/
+void rk_mri(const mri_table* mri,
+  /* integers */
+  int neq, int nt, int isDll, int isDllfast, int isForcing,
+  /* int pointers */
+  int* _it_tot, int* nslow, int* nfast, int* nfstep, int* ipar,
+  /* double */
+  double hslow, double hfast,
+  /* arrays */
+  double* tt, double* y, double* FS, double* ga, double* gb,
+  double* ytmp, double* K, double* out, double* yout,
+  /* SEXPs */
+  SEXP Func, SEXP Funcfast, SEXP Parms, SEXP Rho) {
+
+  int i, j, l, it, n, nsub, m, s = mri->stage;
+  double t, H, dc, g0, g1;
+
+  for (it = 1; it < nt; it++) {
+    nsub = (int) ceil((tt[it] - tt[it-1]) / hslow * (1 - 1e-10));
+    if (nsub < 1) nsub = 1;
+    H = (tt[it] - tt[it-1]) / nsub;
+
+    for (n = 0; n < nsub; n++) {
+      t = tt[it-1] + n * H;
+      for (i = 0; i < s - 1; i++) {
+        /* slow part at stage i, the only evaluation of fS at this stage */
+        derivs(Func, t + mri->c[i] * H, y, Parms, Rho, FS, out, i, neq,
+               ipar, isDll, isForcing);
+        (*nslow)++;
+
+        for (l = 0; l < neq; l++) {
+          ga[l] = 0;
+          gb[l] = 0;
+        }
+        for (j = 0; j <= i; j++) {
+          g0 = mri->g0[i * s + j];
+          g1 = mri->g1[i * s + j];
+          if (g0 != 0)
+            for (l = 0; l < neq; l++) ga[l] += g0 * FS[l + neq * j];
+          if (g1 != 0)
+            for (l = 0; l < neq; l++) gb[l] += g1 * FS[l + neq * j];
+        }
+
+        /* fast steps of at most hfast (in physical time) */
+        dc = mri->c[i+1] - mri->c[i];
+        m = (dc > 0) ? (int) ceil(dc * H / hfast * (1 - 1e-10)) : 1;
+        if (m < 1) m = 1;
+        mrifast(neq, m, t + mri->c[i] * H, dc, H, y, ga, gb, ytmp, K, out,
+          ipar, nfast, Funcfast, Parms, Rho, isDllfast, isForcing);
+        *nfstep += m;
+      }
+      (*_it_tot)++;
+    }
+    yout[it] = tt[it];
+    for (i = 0; i < neq; i++) yout[it + nt * (1 + i)] = y[i];
+  }
+}
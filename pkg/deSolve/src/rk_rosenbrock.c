@@ -0,0 +1,370 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >= 2                 */
+/* Linearly implicit (Rosenbrock) steps and stiffness detection             */
+/*==========================================================================*/
+/*
+  Rosenbrock methods in the transformed form of Hairer and Wanner (1996),
+  section IV.7; stage i solves
+
+    (I/(gamma h) - J) U_i = f(t + alpha_i h, y0 + sum_j a_ij U_j)
+                            + sum_j c_ij/h U_j + d_i h df/dt
+
+  and y1 = y0 + sum_i m_i U_i with the error estimate sum_i e_i U_i.
+  J is given by the user or approximated by forward differences, df/dt
+  always by forward differences. The matrix is decomposed with LINPACK
+  dgefa (as in rk_implicit.c) or, for banded Jacobians, dgbfa.
+*/
+
+#include <string.h>
+#include "rk_util.h"
+
+void F77_NAME(dgefa)(double*, int*, int*, int*, int*);
+void F77_NAME(dgesl)(double*, int*, int*, int*, double*, int*);
+void F77_NAME(dgbfa)(double*, int*, int*, int*, int*, int*, int*);
+void F77_NAME(dgbsl)(double*, int*, int*, int*, int*, int*, double*, int*);
+
+/*==========================================================================*/
+/* coefficients                                                             */
+/*==========================================================================*/
+
+/* ROS2 of Verwer et al. (1999), L-stable, order 2(1), gamma = 1 + 1/sqrt(2) */
+#define ROS2_G 1.7071067811865475244
+static const double ros2_a[]     = {0, 0,
+                                    1/ROS2_G, 0};
+static const double ros2_c[]     = {0, 0,
+                                    -2/ROS2_G, 0};
+static const double ros2_m[]     = {1.5/ROS2_G, 0.5/ROS2_G};
+static const double ros2_e[]     = {0.5/ROS2_G, 0.5/ROS2_G};
+static const double ros2_alpha[] = {0, 1};
+static const double ros2_d[]     = {ROS2_G, -ROS2_G};
+
+const ros_table ros2 = {2, 2, ROS2_G,
+  ros2_a, ros2_c, ros2_m, ros2_e, ros2_alpha, ros2_d};
+
+/* ROS3P of Lang and Verwer (2001), order 3(2), no order reduction for
+   parabolic problems, gamma = 1/2 + sqrt(3)/6 */
+#define ROS3P_G 0.78867513459481288225
+static const double ros3p_a[]     = {0, 0, 0,
+                                     1/ROS3P_G, 0, 0,
+                                     1/ROS3P_G, 0, 0};
+static const double ros3p_c[]     = {0, 0, 0,
+                                     -1.607695154586736, 0, 0,
+                                     -3.464101615137755, -1.732050807568877, 0};
+static const double ros3p_m[]     = {2.0, 0.5773502691896258, 0.4226497308103742};
+static const double ros3p_e[]     = {0.1132486540518713, 0.4226497308103742, 0};
+static const double ros3p_alpha[] = {0, 1, 1};
+static const double ros3p_d[]     = {0.7886751345948129, -0.2113248654051871,
+                                     -1.077350269189626};
+
+const ros_table ros3p = {3, 3, ROS3P_G,
+  ros3p_a, ros3p_c, ros3p_m, ros3p_e, ros3p_alpha, ros3p_d};
+
+/* RODAS4 of Hairer and Wanner (1996), order 4(3), stiffly accurate */
+static const double rodas4_a[] = {
+  0, 0, 0, 0, 0, 0,
+  1.544, 0, 0, 0, 0, 0,
+  0.9466785280815826, 0.2557011698983284, 0, 0, 0, 0,
+  3.314825187068521, 2.896124015972201, 0.9986419139977817, 0, 0, 0,
+  1.221224509226641, 6.019134481288629, 12.53708332932087,
+  -0.6878860361058950, 0, 0,
+  1.221224509226641, 6.019134481288629, 12.53708332932087,
+  -0.6878860361058950, 1, 0};
+static const double rodas4_c[] = {
+  0, 0, 0, 0, 0, 0,
+  -5.6688, 0, 0, 0, 0, 0,
+  -2.430093356833875, -0.2063599157091915, 0, 0, 0, 0,
+  -0.1073529058151375, -9.594562251023355, -20.47028614809616, 0, 0, 0,
+  7.496443313967647, -10.24680431464352, -33.99990352819905,
+  11.70890893206160, 0, 0,
+  8.083246795921522, -7.981132988064893, -31.52159432874371,
+  16.31930543123136, -6.058818238834054, 0};
+static const double rodas4_m[]     = {1.221224509226641, 6.019134481288629,
+  12.53708332932087, -0.6878860361058950, 1, 1};
+static const double rodas4_e[]     = {0, 0, 0, 0, 0, 1};
+static const double rodas4_alpha[] = {0, 0.386, 0.21, 0.63, 1, 1};
+static const double rodas4_d[]     = {0.25, -0.1043, 0.1035, -0.0362, 0, 0};
+
+const ros_table rodas4 = {6, 4, 0.25,
+  rodas4_a, rodas4_c, rodas4_m, rodas4_e, rodas4_alpha, rodas4_d};
+
+/* Rodas5P of Steinebach (2023), order 5(4), stiffly accurate */
+#define RODAS5P_A6 -7.502846399306121, 2.561846144803919, \
+  -11.627539656261098, -0.18268767659942256, 0.030198172008377946
+static const double rodas5p_a[] = {
+  0, 0, 0, 0, 0, 0, 0, 0,
+  3.0, 0, 0, 0, 0, 0, 0, 0,
+  2.849394379747939, 0.45842242204463923, 0, 0, 0, 0, 0, 0,
+  -6.954028509809101, 2.489845061869568, -10.358996098473584, 0, 0, 0, 0, 0,
+  2.8029986275628964, 0.5072464736228206, -0.3988312541770524,
+  -0.04721187230404641, 0, 0, 0, 0,
+  RODAS5P_A6, 0, 0, 0,
+  RODAS5P_A6, 1, 0, 0,
+  RODAS5P_A6, 1, 1, 0};
+static const double rodas5p_c[] = {
+  0, 0, 0, 0, 0, 0, 0, 0,
+  -14.155112264123755, 0, 0, 0, 0, 0, 0, 0,
+  -17.97296035885952, -2.859693295451294, 0, 0, 0, 0, 0, 0,
+  147.12150275711716, -1.41221402718213, 71.68940251302358, 0, 0, 0, 0, 0,
+  165.43517024871676, -0.4592823456491126, 42.90938336958603,
+  -5.961986721573306, 0, 0, 0, 0,
+  24.854864614690072, -3.0009227002832186, 47.4931110020768,
+  5.5814197821558125, -0.6610691825249471, 0, 0, 0,
+  30.91273214028599, -3.1208243349937974, 77.79954646070892,
+  34.28646028294783, -19.097331116725623, -28.087943162872662, 0, 0,
+  37.80277123390563, -3.2571969029072276, 112.26918849496327,
+  66.9347231244047, -40.06618937091002, -54.66780262877968,
+  -9.48861652309627, 0};
+static const double rodas5p_m[]     = {RODAS5P_A6, 1, 1, 1};
+static const double rodas5p_e[]     = {0, 0, 0, 0, 0, 0, 0, 1};
+static const double rodas5p_alpha[] = {0, 0.6358126895828704,
+  0.4095798393397535, 0.9769306725060716, 0.42884036095586647, 1, 1, 1};
+static const double rodas5p_d[]     = {0.21193756319429014,
+  -0.42387512638858027, -0.3384627126235924, 1.8046452872882734,
+  2.325825639765069, 0, 0, 0};
+
+const ros_table rodas5p = {8, 5, 0.21193756319429014,
+  rodas5p_a, rodas5p_c, rodas5p_m, rodas5p_e, rodas5p_alpha, rodas5p_d};
+
+/* table by name, for rosenbrock() */
+const ros_table *rostable(const char *name) {
+  if (strcmp(name, "ros3p") == 0)   return(&ros3p);
+  if (strcmp(name, "rodas4") == 0)  return(&rodas4);
+  if (strcmp(name, "rodas5p") == 0) return(&rodas5p);
+  error("unknown Rosenbrock method '%s'", name);
+  return(NULL);
+}
+
+/*==========================================================================*/
+/* Jacobian and time derivative                                             */
+/*==========================================================================*/
+
+/* Jacobian from the user function (R or DLL); banded Jacobians are
+   stored as in lsode and radau, J(i,j) in row mu + i - j (0-based)      */
+static void rosjacusr(rk_switch *sw, SEXP Parms, SEXP Rho, double t,
+  double *y, double *out, int neq, int *ipar, int isDll, int isForcing) {
+  int i, nrowpd = (sw->banded) ? sw->ml + sw->mu + 1 : neq;
+  SEXP R_t, R_y, R_fcall, Val;
+
+  for (i = 0; i < nrowpd * neq; i++) sw->J[i] = 0;
+  if (isDll) {
+    C_jac_func_type *cjac = (C_jac_func_type *) R_ExternalPtrAddr(sw->Jacfunc);
+    if (isForcing) updatedeforc(&t);
+    cjac(&neq, &t, y, &sw->ml, &sw->mu, sw->J, &nrowpd, out, ipar);
+  } else {
+    PROTECT(R_t = ScalarReal(t)); incr_N_Protect();
+    PROTECT(R_y = allocVector(REALSXP, neq)); incr_N_Protect();
+    for (i = 0; i < neq; i++) REAL(R_y)[i] = y[i];
+    PROTECT(R_fcall = lang4(sw->Jacfunc, R_t, R_y, Parms)); incr_N_Protect();
+    PROTECT(Val = coerceVector(eval(R_fcall, Rho), REALSXP)); incr_N_Protect();
+    if (LENGTH(Val) != nrowpd * neq)
+      error("Jacobian function 'jacfunc' must return a %d x %d matrix",
+            nrowpd, neq);
+    for (i = 0; i < nrowpd * neq; i++) sw->J[i] = REAL(Val)[i];
+    my_unprotect(4);
+  }
+}
+
+/* J (from the user function or by forward differences) and df/dt by a
+   forward difference; banded Jacobians need only ml + mu + 1 evaluations
+   of f, perturbing every (ml + mu + 1)th column at once                */
+void rosjac(rk_switch *sw, SEXP Func, SEXP Parms, SEXP Rho, double t,
+  double *y0, double *f0, double *ytmp, double *out, int neq, int *ipar,
+  int isDll, int isForcing) {
+  int i, j, k, ng, ldj, ml, mu;
+  double delta, *J = sw->J, *ftmp = sw->ftmp;
+
+  if (!isNull(sw->Jacfunc)) {
+    rosjacusr(sw, Parms, Rho, t, y0, out, neq, ipar, isDll, isForcing);
+  } else {
+    ml  = (sw->banded) ? sw->ml : neq - 1;
+    mu  = (sw->banded) ? sw->mu : neq - 1;
+    ldj = (sw->banded) ? ml + mu + 1 : neq;
+    ng  = (ml + mu + 1 < neq) ? ml + mu + 1 : neq;
+    if (sw->banded) for (i = 0; i < ldj * neq; i++) J[i] = 0;
+    for (i = 0; i < neq; i++) ytmp[i] = y0[i];
+    for (k = 0; k < ng; k++) {
+      for (j = k; j < neq; j += ng)
+        ytmp[j] = y0[j] + sqrt(DBL_EPSILON * fmax(1e-5, fabs(y0[j])));
+      derivs(Func, t, ytmp, Parms, Rho, ftmp, out, 0, neq, ipar, isDll, 
+             isForcing);
+      sw->nfun++;
+      for (j = k; j < neq; j += ng) {
+        delta = ytmp[j] - y0[j];  /* exactly representable increment */
+        for (i = (j > mu) ? j - mu : 0; i < neq && i <= j + ml; i++)
+          J[((sw->banded) ? mu + i - j : i) + ldj * j] = (ftmp[i] - f0[i]) / delta;
+        ytmp[j] = y0[j];
+      }
+    }
+  }
+  delta = sqrt(DBL_EPSILON * fmax(1e-5, fabs(t)));
+  derivs(Func, t + delta, y0, Parms, Rho, ftmp, out, 0, neq, ipar, isDll, 
+         isForcing);
+  sw->nfun++;
+  for (i = 0; i < neq; i++) sw->ft[i] = (ftmp[i] - f0[i]) / delta;
+}
+
+/*==========================================================================*/
+/* one Rosenbrock step from y0 to y2, returns the error norm                */
+/* or -1 if the matrix is singular; f0 = f(t, y0)                           */
+/*==========================================================================*/
+
+double rosstep(rk_switch *sw, int neq, double t, double dt,
+  double *y0, double *f0, double *ytmp, double *y2,
+  double *atol, double *rtol, double *out,
+  SEXP Func, SEXP Parms, SEXP Rho, int *ipar, int isDll, int isForcing) {
+
+  const ros_table *ros = sw->ros;
+  int i, j, k, info = 0, job = 0, ns = ros->stage;
+  int ml = sw->ml, mu = sw->mu, ldj = ml + mu + 1, lda = 2 * ml + mu + 1;
+  double fac = 1.0 / (ros->gamma * dt), serr = 0, scal, delta, *Ui;
+  double *M = sw->M, *U = sw->U, *ftmp = sw->ftmp;
+
+  /* iteration matrix I/(gamma h) - J, banded in LINPACK storage */
+  if (sw->banded) {
+    for (j = 0; j < neq; j++) {
+      for (i = 0; i < ml; i++) M[i + lda * j] = 0;
+      for (i = 0; i < ldj; i++) M[ml + i + lda * j] = -sw->J[i + ldj * j];
+      M[ml + mu + lda * j] += fac;
+    }
+    F77_CALL(dgbfa)(M, &lda, &neq, &ml, &mu, sw->ipvt, &info);
+  } else {
+    for (i = 0; i < neq * neq; i++) M[i] = -sw->J[i];
+    for (i = 0; i < neq; i++) M[i + neq * i] += fac;
+    F77_CALL(dgefa)(M, &neq, &neq, sw->ipvt, &info);
+  }
+  if (info != 0) return(-1);
+
+  for (k = 0; k < ns; k++) {
+    Ui = U + neq * k;
+    if (k == 0) {
+      for (i = 0; i < neq; i++) ftmp[i] = f0[i];
+    } else {
+      for (i = 0; i < neq; i++) ytmp[i] = y0[i];
+      for (j = 0; j < k; j++) {
+        double a = ros->a[k * ns + j];
+        if (a != 0) for (i = 0; i < neq; i++) ytmp[i] += a * U[i + neq * j];
+      }
+      derivs(Func, t + ros->alpha[k] * dt, ytmp, Parms, Rho, ftmp, out, 0,
+             neq, ipar, isDll, isForcing);
+    }
+    for (i = 0; i < neq; i++) Ui[i] = ftmp[i] + ros->d[k] * dt * sw->ft[i];
+    for (j = 0; j < k; j++) {
+      double c = ros->c[k * ns + j] / dt;
+      if (c != 0) for (i = 0; i < neq; i++) Ui[i] += c * U[i + neq * j];
+    }
+    if (sw->banded)
+      F77_CALL(dgbsl)(M, &lda, &neq, &ml, &mu, sw->ipvt, Ui, &job);
+    else
+      F77_CALL(dgesl)(M, &neq, &neq, sw->ipvt, Ui, &job);
+  }
+
+  /* new state and error norm, as in rkstep */
+  for (i = 0; i < neq; i++) {
+    y2[i] = y0[i];
+    ytmp[i] = 0;
+  }
+  for (k = 0; k < ns; k++) {
+    double m = ros->m[k], e = ros->e[k];
+    Ui = U + neq * k;
+    for (i = 0; i < neq; i++) {
+      y2[i]   += m * Ui[i];
+      ytmp[i] += e * Ui[i];
+    }
+  }
+  for (i = 0; i < neq; i++) {
+    scal  = atol[i] + fmax(fabs(y0[i]), fabs(y2[i])) * rtol[i];
+    delta = fabs(ytmp[i]);
+    if (scal > 0) serr += (delta/scal) * (delta/scal);
+  }
+  return(sqrt(serr/neq));
+}
+
+/*==========================================================================*/
+/* stiffness detection                                                      */
+/*==========================================================================*/
+
+/* stability boundary of an explicit method on the negative real axis,
+   A is stored by columns, bb are the weights of the propagated solution */
+double rk_stabbound(int stage, double *A, double *bb) {
+  int j, k;
+  double x, z, R, *Y = (double *) R_alloc(stage, sizeof(double));
+
+  for (x = 0.01; x < 100; x += 0.01) {
+    z = -x;
+    R = 1;
+    for (j = 0; j < stage; j++) {
+      Y[j] = 1;
+      for (k = 0; k < j; k++) Y[j] += z * A[j + stage * k] * Y[k];
+      R += z * bb[j] * Y[j];
+    }
+    if (fabs(R) > 1) return(x - 0.01);
+  }
+  return(100);
+}
+
+/* two stages at the same time point, the last ones preferred; the
+   quotient of the differences of their derivatives and arguments
+   estimates the dominant eigenvalue (Hairer and Wanner, 1996, IV.2) */
+int rk_stiffstages(int stage, double *cc, int *ist1, int *ist2) {
+  for (int j = stage - 1; j > 0; j--)
+    for (int k = j - 1; k > 0; k--)
+      if (cc[j] == cc[k]) {
+        *ist1 = k; *ist2 = j;
+        return(TRUE);
+      }
+  return(FALSE);
+}
+
+/* spectral radius of J by power iteration */
+double rosradius(int neq, double *J, double *v, double *w) {
+  int i, j, it;
+  double nrm = 0;
+
+  for (i = 0; i < neq; i++) v[i] = 1.0 / sqrt((double) neq);
+  for (it = 0; it < 20; it++) {
+    for (i = 0; i < neq; i++) w[i] = 0;
+    for (j = 0; j < neq; j++)
+      for (i = 0; i < neq; i++) w[i] += J[i + neq * j] * v[j];
+    nrm = 0;
+    for (i = 0; i < neq; i++) nrm += w[i] * w[i];
+    nrm = sqrt(nrm);
+    if (nrm == 0) break;
+    for (i = 0; i < neq; i++) v[i] = w[i] / nrm;
+  }
+  return(nrm);
+}
+
+/* decision after an accepted step; hlamb = dt * |lambda| was estimated
+   during the step. The explicit method is left when its step size is
+   limited by stability for 15 steps (as in DOPRI5), and taken up again
+   when it would be stable with twice the step size for 15 steps */
+void rkswitch(rk_switch *sw, double t, int verbose) {
+  if (!sw->stiff) {
+    if (sw->hlamb > 0.98 * sw->bound) {
+      sw->nonstiff = 0;
+      if (++sw->nstiff >= 15) {
+        sw->stiff = TRUE;
+        sw->nstiff = 0;
+        sw->nswitch++;
+        sw->tswitch = t;
+        sw->jacok = FALSE;
+        if (verbose) Rprintf("problem seems to become stiff at t = %g\n", t);
+      }
+    } else if (++sw->nonstiff >= 6) {
+      sw->nstiff = 0;
+    }
+  } else {
+    if (sw->hlamb < 0.5 * sw->bound) {
+      if (++sw->nonstiff >= 15) {
+        sw->stiff = FALSE;
+        sw->nstiff = 0;
+        sw->nonstiff = 0;
+        sw->nswitch++;
+        sw->tswitch = t;
+        if (verbose) Rprintf("problem seems to become non-stiff at t = %g\n", t);
+      }
+    } else {
+      sw->nonstiff = 0;
+    }
+  }
+}
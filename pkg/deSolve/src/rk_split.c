@@ -0,0 +1,148 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >=2                  */
+/* Reaction step of operator splitting: independent Rosenbrock solutions    */
+/* of the local chemistry in all grid cells                                 */
+/*==========================================================================*/
+/*
+  The states of cell c are y[c + ncell * i], i = 0 .. nspec - 1, as in
+  ode.1D, ode.2D and ode.3D. Each cell is integrated over [t, tend] with
+  its own step size by a Rosenbrock method with a dense nspec x nspec
+  Jacobian. The cells do not interact, so with compiled reaction functions
+  they are distributed over OpenMP threads; every thread works in its own
+  small workspace. R functions are always evaluated in the main thread.
+*/
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "rk_util.h"
+
+/* one cell; returns 0 on success, -1 if maxsteps were exceeded and -2 if
+   the step size became too small (e.g. singular iteration matrices)      */
+static int rk_cell(rk_switch *sw, int ns, int maxsteps, double t,
+  double tend, double *h, double *y, double *f0, double *ytmp, double *y2,
+  double *atol, double *rtol, double *out, int *nrej,
+  SEXP Func, SEXP Parms, SEXP Rho, int *ipar, int isDll) {
+
+  int i, last = FALSE, nstep = 0;
+  double err, fac = 1, dt, dtlast = 0, q = 1.0 / sw->ros->qerr;
+
+  dt = *h;
+  while (t < tend) {
+    derivs(Func, t, y, Parms, Rho, f0, out, 0, ns, ipar, isDll, FALSE);
+    sw->nfun++;
+    /* first step size from the scaled norms of y and f(y), as in imex */
+    if (dt <= 0) {
+      double d0 = 0, d1 = 0, sc;
+      for (i = 0; i < ns; i++) {
+        sc = atol[i] + rtol[i] * fabs(y[i]);
+        d0 += (y[i] / sc) * (y[i] / sc);
+        d1 += (f0[i] / sc) * (f0[i] / sc);
+      }
+      dt = (d0 < 1e-10 || d1 < 1e-10) ? 1e-6 : 0.01 * sqrt(d0 / d1);
+    }
+    last = (t + dt >= tend - 100.0 * DBL_EPSILON * fabs(tend));
+    if (last) {
+      dtlast = dt;
+      dt = tend - t;
+    }
+    rosjac(sw, Func, Parms, Rho, t, y, f0, ytmp, out, ns, ipar, isDll, FALSE);
+    sw->njac++;
+    /* J and df/dt are kept for rejected steps */
+    for (;;) {
+      if (++nstep > maxsteps) return(-1);
+      err = rosstep(sw, ns, t, dt, y, f0, ytmp, y2, atol, rtol, out,
+        Func, Parms, Rho, ipar, isDll, FALSE);
+      sw->nlu++;
+      sw->nstep++;
+      sw->nfun += sw->ros->stage - 1;
+      /* singular matrix or overflow: reduce step size */
+      if (!(err >= 0)) err = 1e10;
+      fac = fmin(5.0, fmax(0.2, 0.9 * pow(fmax(err, 1e-10), -q)));
+      if (err <= 1.0) break;
+      (*nrej)++;
+      dt *= fac;
+      last = FALSE;
+      if (t + dt == t) return(-2);
+    }
+    t = (last) ? tend : t + dt;
+    for (i = 0; i < ns; i++) y[i] = y2[i];
+    dt *= fac;
+  }
+  /* a final step clipped to tend says little about the next step size */
+  *h = (last) ? fmax(dt, dtlast) : dt;
+  return(0);
+}
+
+/*==========================================================================*/
+/* all cells from t to tend; hcell holds the step sizes per cell (0: not  */
+/* yet known), code the return values of rk_cell, stat the sums of steps, */
+/* rejected steps, function evaluations, Jacobians and LU decompositions  */
+/*==========================================================================*/
+void rk_split(int nspec, int ncell, int nthreads, int maxsteps,
+  const ros_table *ros, double t, double tend, double *y, double *hcell,
+  double *atol, double *rtol, int *code, int *stat, double *out, int lrpar,
+  SEXP Func, SEXP Parms, SEXP Rho, int *ipar, int isDll) {
+
+  int nt, k, stage = ros->stage;
+  rk_switch *sw;
+  int *nrej;
+  double *work;
+
+  /* R functions must not be called from several threads */
+  if (!isDll || nthreads < 1) nthreads = 1;
+#ifndef _OPENMP
+  nthreads = 1;
+#endif
+
+  /* workspace of each thread: cell states, stage vectors, Jacobian,
+     iteration matrix, stages of the method and a copy of out/rpar      */
+  int lwork = 6 * nspec + 2 * nspec * nspec + stage * nspec + lrpar;
+  sw   = (rk_switch*) R_alloc(nthreads, sizeof(rk_switch));
+  nrej = (int*)       R_alloc(nthreads, sizeof(int));
+  work = (double*)    R_alloc(nthreads * lwork, sizeof(double));
+  for (k = 0; k < nthreads; k++) {
+    double *w = work + k * lwork;
+    sw[k].ros = ros;
+    sw[k].Jacfunc = R_NilValue;
+    sw[k].banded = FALSE; sw[k].ml = nspec - 1; sw[k].mu = nspec - 1;
+    sw[k].J    = w + 6 * nspec;
+    sw[k].M    = sw[k].J + nspec * nspec;
+    sw[k].U    = sw[k].M + nspec * nspec;
+    sw[k].ft   = w + 4 * nspec;
+    sw[k].ftmp = w + 5 * nspec;
+    sw[k].ysti = NULL;
+    sw[k].ipvt = (int*) R_alloc(nspec, sizeof(int));
+    sw[k].nfun = 0; sw[k].njac = 0; sw[k].nlu = 0; sw[k].nstep = 0;
+    for (int i = 0; i < lrpar; i++) sw[k].U[stage * nspec + i] = out[i];
+    nrej[k] = 0;
+  }
+
+  /* atol and rtol are given per species */
+  nt = nthreads;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nt) schedule(dynamic, 16)
+#endif
+  for (int c = 0; c < ncell; c++) {
+    int i, id = 0;
+#ifdef _OPENMP
+    id = omp_get_thread_num();
+#endif
+    double *w = work + id * lwork, *yc = w, *f0 = w + nspec,
+      *ytmp = w + 2 * nspec, *y2 = w + 3 * nspec,
+      *outc = sw[id].U + stage * nspec;
+
+    for (i = 0; i < nspec; i++) yc[i] = y[c + ncell * i];
+    code[c] = rk_cell(&sw[id], nspec, maxsteps, t, tend, &hcell[c], yc, f0,
+      ytmp, y2, atol, rtol, outc, &nrej[id], Func, Parms, Rho, ipar, isDll);
+    for (i = 0; i < nspec; i++) y[c + ncell * i] = yc[i];
+  }
+
+  for (k = 0; k < nthreads; k++) {
+    stat[0] += sw[k].nstep;
+    stat[1] += nrej[k];
+    stat[2] += sw[k].nfun;
+    stat[3] += sw[k].njac;
+    stat[4] += sw[k].nlu;
+  }
+}
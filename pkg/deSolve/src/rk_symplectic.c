@@ -0,0 +1,91 @@
+/*==========================================================================*/
+/* Runge-Kutta Solvers, (C) Th. Petzoldt, License: GPL >= 2                 */
+/* Symplectic splitting (composition) methods with fixed step size          */
+/* -- main loop == core function --                                         */
+/*==========================================================================*/
+/*
+  The state vector is split in positions q (first half) and velocities or
+  momenta p (second half) of a separable system
+
+    dq/dt = G(t, p),  dp/dt = F(t, q),
+
+  e.g. a Hamiltonian H = T(p) + V(q). func returns c(G, F) as usual. A
+  step is a composition of "kicks" and "drifts",
+
+    p += b[0] h F(q); q += a[0] h G(p); p += b[1] h F(q); ...
+    q += a[s-1] h G(p); p += b[s] h F(q),
+
+  each of which is the exact flow of one part, so the step is a
+  symplectic and (for symmetric coefficients) time-reversible map. The
+  energy error stays bounded over long times instead of drifting.
+
+  As F only depends on q and G only on p, the derivatives of the last
+  evaluation are reused for the next kick; with velocity = TRUE (G(p) = p)
+  the drifts need no evaluation at all and a step costs s evaluations.
+*/
+
+#include "rk_util.h"
+
+double rk_symplectic(
+  /* integers */
+  int neq, int nstage, int velocity, int isDll, int isForcing,
+  int verbose, int maxsteps,
+  /* int pointers */
+  int* _it_tot, int* _nfun, int* istate, int* ipar,
+  /* double */
+  double t, double tmax, double hini,
+  /* arrays */
+  double* y0, double* f, double* sa, double* sb, double* out,
+  /* SEXPs */
+  SEXP Func, SEXP Parms, SEXP Rho
+  ) {
+
+  int i, k, n, nsteps = 1, half = neq / 2, it_tot = *_it_tot, nfun = *_nfun;
+  double dt, tq, t0 = t, *q = y0, *p = y0 + half;
+
+  /* F(q) at the start; events may have changed the state */
+  derivs(Func, t, y0, Parms, Rho, f, out, 0, neq, ipar, isDll, isForcing);
+  nfun++;
+
+  /* constant steps hini, the last one of the interval ends exactly at
+     tmax; the times are counted from t0 to avoid accumulated round-off */
+  if (fabs(hini) > (DBL_EPSILON * 100.0))
+    nsteps = (int) fmax(1.0, ceil(fabs(tmax - t0) / fabs(hini) - 1e-8));
+
+  for (n = 1; n <= nsteps; n++) {
+    dt = ((n == nsteps) ? tmax : t0 + n * fabs(hini) * sign(tmax - t0)) - t;
+    timesteps[0] = timesteps[1];
+    timesteps[1] = dt;
+
+    tq = t;
+    for (k = 0; k < nstage; k++) {
+      /* kick with F(q) of the last evaluation */
+      if (sb[k] != 0)
+        for (i = 0; i < half; i++) p[i] += sb[k] * dt * f[half + i];
+      /* drift */
+      if (velocity) {
+        for (i = 0; i < half; i++) q[i] += sa[k] * dt * p[i];
+      } else {
+        derivs(Func, tq, y0, Parms, Rho, f, out, 0, neq, ipar, isDll,
+               isForcing);
+        nfun++;
+        for (i = 0; i < half; i++) q[i] += sa[k] * dt * f[i];
+      }
+      tq += sa[k] * dt;
+      derivs(Func, tq, y0, Parms, Rho, f, out, 0, neq, ipar, isDll,
+             isForcing);
+      nfun++;
+    }
+    for (i = 0; i < half; i++) p[i] += sb[nstage] * dt * f[half + i];
+
+    t += dt;
+    it_tot++;
+    if (it_tot > maxsteps) {
+      if (verbose) Rprintf("Max. number of steps exceeded\n");
+      istate[0] = -1;
+      break;
+    }
+  }
+  *_it_tot = it_tot; *_nfun = nfun;
+  return(t);  /* time reached, tmax unless maxsteps was exceeded */
+}
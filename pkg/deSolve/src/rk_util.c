@@ -3,22 +3,7 @@
 /* Definitions and Utilities needed by Runge-Kutta Solvers                  */
 /*==========================================================================*/
 
-/* Load headers needed by the R interface */
-#include <R.h>
-#include <Rinternals.h>
-#include <R_ext/Rdynload.h>
-#include <Rdefines.h>     /* AS_NUMERIC ... */
-
-#include <R_ext/Applic.h> /* for dgemm */
-#include <R_ext/Boolean.h>
-
-#ifdef HAVE_LONG_DOUBLE
-# define LDOUBLE long double
-#else
-# define LDOUBLE double
-#endif
-
-#include "deSolve.h"
+#include "rk_util.h"
 
 /*============================================================================*/
 /*   DLL specific functions                                                   */
@@ -104,11 +89,66 @@ double maxerr(double *y0, double *y1, double *y2, double *Atol, double *Rtol, in
     /* y2 is used to estimate next y-value */
     scal  = Atol[i] + fmax(fabs(y0[i]), fabs(y2[i])) * Rtol[i];
     delta = fabs(y2[i] - y1[i]);
-    if (scal > 0) serr += pow(delta/scal, 2.0);
+    if (scal > 0) serr += (delta/scal) * (delta/scal);
   }
   return(sqrt(serr/n)); /* Euclidean norm */
 }
 
+/*----------------------------------------------------------------------------*/
+/* Fused stage accumulation and error norm for general Butcher tables         */
+/* The state is processed in blocks of RKBLOCK elements, so that one block    */
+/* of all stage derivatives is summed up while it is in the cache; the inner  */
+/* loops are simple enough to be vectorized by the compiler.                  */
+/*----------------------------------------------------------------------------*/
+#define RKBLOCK 256
+
+/* argument of stage j: tmp = y0 + dt * sum_k A[j, k] * FF[, k] */
+void rkstage(int j, int stage, int neq, double dt, double *A, double *FF,
+  double *y0, double *tmp) {
+  int i, i0, i1, k;
+  double a;
+  for (i0 = 0; i0 < neq; i0 += RKBLOCK) {
+    i1 = (i0 + RKBLOCK < neq) ? i0 + RKBLOCK : neq;
+    for (i = i0; i < i1; i++) tmp[i] = 0;
+    for (k = 0; k < j; k++) {
+      a = A[j + stage * k];
+      if (a == 0) continue;
+      for (i = i0; i < i1; i++) tmp[i] += a * FF[i + neq * k];
+    }
+    for (i = i0; i < i1; i++) tmp[i] = y0[i] + dt * tmp[i];
+  }
+}
+
+/* new values y1 (weights bb1), y2 (weights bb2) and error norm as in maxerr */
+double rkstep(int stage, int neq, double dt, double *bb1, double *bb2,
+  double *FF, double *y0, double *y1, double *y2, double *Atol, double *Rtol) {
+  int i, i0, i1, k;
+  double serr = 0, scal, delta;
+  for (i0 = 0; i0 < neq; i0 += RKBLOCK) {
+    i1 = (i0 + RKBLOCK < neq) ? i0 + RKBLOCK : neq;
+    for (i = i0; i < i1; i++) {
+      y1[i] = 0;
+      y2[i] = 0;
+    }
+    for (k = 0; k < stage; k++) {
+      double b1 = bb1[k], b2 = bb2[k], *Fk = FF + neq * k;
+      if (b1 == 0 && b2 == 0) continue;
+      for (i = i0; i < i1; i++) {
+        y1[i] += b1 * Fk[i];
+        y2[i] += b2 * Fk[i];
+      }
+    }
+    for (i = i0; i < i1; i++) {
+      y1[i] = y0[i] + dt * y1[i];
+      y2[i] = y0[i] + dt * y2[i];
+      scal  = Atol[i] + fmax(fabs(y0[i]), fabs(y2[i])) * Rtol[i];
+      delta = fabs(y2[i] - y1[i]);
+      if (scal > 0) serr += (delta/scal) * (delta/scal);
+    }
+  }
+  return(sqrt(serr/neq));
+}
+
 /*==========================================================================*/
 /*   CALL TO THE MODEL FUNCTION                                             */
 /*==========================================================================*/
@@ -121,18 +161,27 @@ void derivs(SEXP Func, double t, double* y, SEXP Parms, SEXP Rho,
   int i = 0;
   int nout = ipar[0];
   double *yy;
-  double ytmp[neq];
+  /* scratch vector for output-only calls (j < 0), on the heap because
+     of very large systems; it only grows */
+  static double *ytmp = NULL;
+  static int ntmp = 0;
 
   if (isDll) {
     /*------------------------------------------------------------------------*/
-    /*   Function is a DLL function                                           */
+    /*   Function is a DLL function; derivatives go directly to column j    */
     /*------------------------------------------------------------------------*/
     C_deriv_func_type *cderivs;
     if (isForcing) updatedeforc(&t); 
     cderivs = (C_deriv_func_type *) R_ExternalPtrAddr(Func);
-    cderivs(&neq, &t, y, ytmp, yout, ipar);
-    if (j >= 0)
-      for (i = 0; i < neq; i++)  ydot[i + neq * j] = ytmp[i];
+    if (j >= 0) {
+      cderivs(&neq, &t, y, ydot + neq * j, yout, ipar);
+    } else {
+      if (neq > ntmp) {
+        ytmp = Realloc(ytmp, neq, double);
+        ntmp = neq;
+      }
+      cderivs(&neq, &t, y, ytmp, yout, ipar);
+    }
   } else {
     /*------------------------------------------------------------------------*/
     /* Function is an R function                                              */
@@ -176,32 +225,66 @@ void derivs(SEXP Func, double t, double* y, SEXP Parms, SEXP Rho,
 
 /*----------------------------------------------------------------------------*/
 /* "dense output"                                                             */
-/* is a specific polynomial interpolation that uses intermediate rk steps     */
+/* is a specific polynomial interpolation that uses intermediate rk steps:    */
+/* r[0..3] form the cubic Hermite polynomial from y0, y1, FF[0] and f1,       */
+/* r[4..nr-1] = dt * sum_j d[j, k] * FF[j] are the terms of higher order      */
 /*----------------------------------------------------------------------------*/
-void denspar(double *FF, double *y0, double *y1, double dt, double *d,
-  int neq, int stage, double *r) {
-  double ydiff, bspl;
-  int i, j;
+void denspar(double *FF, double *y0, double *y1, double *f1, double dt,
+  rk_dense *dn, int neq, double *r) {
+  double ydiff, bspl, rk;
+  int i, j, k;
   for (i = 0; i < neq; i++) {
    r[i]           = y0[i];
    ydiff          = y1[i] - y0[i];
    r[i + neq]     = ydiff;
    bspl           = dt * FF[i] - ydiff;
    r[i + 2 * neq] = bspl;
-   r[i + 3 * neq] = ydiff - dt * FF[i + (stage - 1) * neq] - bspl;
-   r[i + 4 * neq] = 0;
-   for (j = 0; j < stage; j++)
-     r[i + 4 * neq] = r[i + 4 * neq] + d[j] * FF[i + j * neq];
-     r[i + 4 * neq] = r[i + 4 * neq] * dt;
+   r[i + 3 * neq] = ydiff - dt * f1[i] - bspl;
+   for (k = 0; k < dn->nr - 4; k++) {
+     rk = 0;
+     for (j = 0; j < dn->ndense; j++)
+       rk = rk + dn->d[j + dn->ndense * k] * FF[i + j * neq];
+     r[i + (4 + k) * neq] = rk * dt;
+   }
+  }
+}
+
+/* stages of the continuous extension that are not stages of the method:
+   f1 = f(t + dt, y1) and the additional stages                              */
+void densstages(rk_dense *dn, SEXP Func, SEXP Parms, SEXP Rho, double t,
+  double dt, double *y0, double *FF, double *f1, double *tmp, double *out,
+  int neq, int stage, int *ipar, int isDll, int isForcing) {
+  int i, j, k, e;
+  double a;
+  if (dn->ndense <= stage) return;
+  for (i = 0; i < neq; i++) FF[i + neq * stage] = f1[i];
+  for (j = stage + 1; j < dn->ndense; j++) {
+    e = j - stage - 1;
+    for (i = 0; i < neq; i++) tmp[i] = 0;
+    for (k = 0; k < j; k++) {
+      a = dn->Ad[e + dn->nextra * k];
+      if (a == 0) continue;
+      for (i = 0; i < neq; i++) tmp[i] += a * FF[i + neq * k];
+    }
+    for (i = 0; i < neq; i++) tmp[i] = y0[i] + dt * tmp[i];
+    derivs(Func, t + dt * dn->cd[e], tmp, Parms, Rho, FF, out, j, neq,
+           ipar, isDll, isForcing);
+    dn->nfun++;
   }
 }
 
-void densout(double *r, double t0, double t, double dt, double* res, int neq) {
+/* r[0] + s (r[1] + (1-s) (r[2] + s (r[3] + (1-s) (r[4] + s (...))))) */
+void densout(double *r, int nr, double t0, double t, double dt, double* res,
+  int neq) {
   double s  = (t - t0) / dt;
   double s1 = 1.0 - s;
-  for (int i = 0; i < neq; i++)
-    res[i] = r[i] + s * (r[i +     neq] + s1 * (r[i + 2 * neq]
-                  + s * (r[i + 3 * neq] + s1 * (r[i + 4 * neq]))));
+  double v;
+  for (int i = 0; i < neq; i++) {
+    v = r[i + (nr - 1) * neq];
+    for (int k = nr - 2; k >= 0; k--)
+      v = r[i + k * neq] + ((k % 2) ? s1 : s) * v;
+    res[i] = v;
+  }
 }
 
 /*----------------------------------------------------------------------------*/
@@ -257,6 +340,137 @@ void neville(double *xx, double *y, double tnew, double *ynew, int n, int ksig)
   }
 }
 
+/*----------------------------------------------------------------------------*/
+/* value of the continuous extension of the last step at time t:              */
+/*   densetype 1: dense output polynomial, nr coefficient vectors rr          */
+/*   densetype 2: dense output of the Cash-Karp method, f1 = f(t0 + dt, y2)   */
+/*   otherwise (densetype 3): cubic Hermite polynomial from y0, y2, FF[0], f1 */
+/*----------------------------------------------------------------------------*/
+void densevalue(int densetype, double t0, double t, double dt, double *rr,
+  int nr, double *y0, double *y2, double *FF, double *f1, double *res, int neq) {
+  if (densetype == 1) {
+    densout(rr, nr, t0, t, dt, res, neq);
+  } else if (densetype == 2) {
+    densoutck(t0, t, dt, y0, FF, f1, res, neq);
+  } else {
+    for (int i = 0; i < neq; i++)
+      res[i] = Hermite(t0, t0 + dt, y0[i], y2[i], FF[i], f1[i], t);
+  }
+}
+
+/*----------------------------------------------------------------------------*/
+/* Polynomial interpolation of all outputs up to tend from the first iknots   */
+/* knots of a (not yet filled) knot buffer, before the buffer is restarted    */
+/*----------------------------------------------------------------------------*/
+void knotsout(double *yknots, int nknots, int iknots, int neq, double tend,
+  double *tt, int *_it_ext, int nt, double *yout, double *tmp) {
+  int i, k, n = iknots, it_ext = *_it_ext;
+  double t_ext, x[nknots], yy[nknots * neq];
+
+  if (n < 1) return;
+  for (k = 0; k < n; k++) {
+    x[k] = yknots[k];
+    for (i = 0; i < neq; i++) yy[k + n * i] = yknots[k + nknots * (1 + i)];
+  }
+  t_ext = tt[it_ext];
+  while (t_ext <= tend) {
+    if (n > 1)
+      neville(x, yy, t_ext, tmp, n, neq);
+    else
+      for (i = 0; i < neq; i++) tmp[i] = yy[n * i];
+    if (it_ext < nt) {
+      yout[it_ext] = t_ext;
+      for (i = 0; i < neq; i++) yout[it_ext + nt * (1 + i)] = tmp[i];
+    }
+    if(it_ext < nt-1) t_ext = tt[++it_ext]; else break;
+  }
+  *_it_ext = it_ext;
+}
+
+/*============================================================================*/
+/*   Root finding                                                             */
+/*============================================================================*/
+
+/*----------------------------------------------------------------------------*/
+/* call the root function, either in a DLL or in R                            */
+/*----------------------------------------------------------------------------*/
+void rootvalue(SEXP Rootfunc, SEXP Rho, double t, double *y, double *gout,
+  int neq, int nroot, int isDll) {
+  SEXP R_fcall, R_t, R_y, ans;
+  int i;
+  if (isDll) {
+    C_root_func_type *croot;
+    croot = (C_root_func_type *) R_ExternalPtrAddr(Rootfunc);
+    croot(&neq, &t, y, &nroot, gout);
+  } else {
+    PROTECT(R_t = ScalarReal(t)); incr_N_Protect();
+    PROTECT(R_y = allocVector(REALSXP, neq)); incr_N_Protect();
+    for (i = 0; i < neq; i++) REAL(R_y)[i] = y[i];
+    PROTECT(R_fcall = lang3(Rootfunc, R_t, R_y)); incr_N_Protect();
+    PROTECT(ans = coerceVector(eval(R_fcall, Rho), REALSXP)); incr_N_Protect();
+    for (i = 0; i < nroot; i++) gout[i] = REAL(ans)[i];
+    my_unprotect(4);
+  }
+}
+
+/* sign change of at least one root function between gold and gnew? */
+int rootchange(double *gold, double *gnew, int nroot) {
+  for (int i = 0; i < nroot; i++)
+    if (gold[i] != 0 && (gnew[i] == 0 || gold[i] * gnew[i] < 0)) return(TRUE);
+  return(FALSE);
+}
+
+/* the state of the step, needed by the function passed to brent */
+static int     rt_densetype, rt_nr, rt_neq, rt_nroot, rt_isDll;
+static double  rt_t0, rt_dt, *rt_rr, *rt_y0, *rt_y2, *rt_FF, *rt_f1;
+static double *rt_ytmp, *rt_gtmp;
+static SEXP    rt_Rootfunc, rt_Rho;
+
+static double rootfun(double t, double *rw, int *iw) {
+  densevalue(rt_densetype, rt_t0, t, rt_dt, rt_rr, rt_nr, rt_y0, rt_y2, rt_FF,
+             rt_f1, rt_ytmp, rt_neq);
+  rootvalue(rt_Rootfunc, rt_Rho, t, rt_ytmp, rt_gtmp, rt_neq, rt_nroot,
+            rt_isDll);
+  return(rt_gtmp[iw[0]]);
+}
+
+/*----------------------------------------------------------------------------*/
+/* locate the first root within the step [t0, t0 + dt] on the continuous      */
+/* extension; returns the time of the root, jroot flags all roots found there */
+/*----------------------------------------------------------------------------*/
+double rootlocate(int densetype, int neq, int nroot, int isDll,
+  double t0, double dt, double *rr, int nr, double *y0, double *y2, double *FF,
+  double *f1, double *gold, double *gnew, int *jroot, double *ytmp,
+  SEXP Rootfunc, SEXP Rho) {
+
+  int i, iw;
+  double tr, tmin = t0 + dt, gtmp[nroot];
+  double tol = 1e-9;  /* as in radau */
+  int maxit = 100;
+
+  rt_densetype = densetype; rt_nr = nr; rt_neq = neq; rt_nroot = nroot; rt_isDll = isDll;
+  rt_t0 = t0; rt_dt = dt; rt_rr = rr; rt_y0 = y0; rt_y2 = y2; rt_FF = FF;
+  rt_f1 = f1; rt_ytmp = ytmp; rt_gtmp = gtmp;
+  rt_Rootfunc = Rootfunc; rt_Rho = Rho;
+
+  for (i = 0; i < nroot; i++) {
+    jroot[i] = 0;
+    if (gold[i] == 0) continue;
+    if (gnew[i] == 0) {
+      tr = t0 + dt;
+    } else if (gold[i] * gnew[i] < 0) {
+      iw = i;
+      tr = brent(t0, t0 + dt, gold[i], gnew[i], rootfun, NULL, &iw, tol, maxit);
+    } else continue;
+    if (tr < tmin - tol) {
+      for (int k = 0; k < i; k++) jroot[k] = 0;
+      tmin = tr;
+    }
+    if (tr <= tmin + tol) jroot[i] = 1;
+  }
+  return(tmin);
+}
+
 /*============================================================================*/
 /*   Specific utility functions                                               */
 /*============================================================================*/
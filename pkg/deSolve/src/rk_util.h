@@ -44,22 +44,250 @@ double maxdiff(double *x, double *y, int n);
 
 double maxerr(double *y0, double *y1, double *y2, double* Atol, double* Rtol, int n);
 
+void rkstage(int j, int stage, int neq, double dt, double *A, double *FF,
+  double *y0, double *tmp);
+
+double rkstep(int stage, int neq, double dt, double *bb1, double *bb2,
+  double *FF, double *y0, double *y1, double *y2, double *Atol, double *Rtol);
+
 void derivs(SEXP Func, double t, double* y, SEXP Parms, SEXP Rho,
 	    double *ydot, double *yout, int j, int neq, int *ipar, 
             int isDll, int isForcing);
 	    
-void denspar(double *FF, double *y0, double *y1, double dt, double *d,
-  int neq, int stage, double *r);
+/* continuous extension (dense output, densetype 1) of a Runge-Kutta method:
+   the stages of the method, f(t + dt, y1) unless the method is FSAL, and
+   nextra additional stages that are only computed when needed             */
+typedef struct {
+  int ndense;                 /* number of stages used                   */
+  int nextra;                 /* additional stages                       */
+  int nr;                     /* coefficient vectors of the polynomial   */
+  int nfun;                   /* evaluations of the additional stages    */
+  double *d;                  /* weights, ndense x (nr - 4)              */
+  double *Ad, *cd;            /* additional stages, nextra x (ndense - 1)*/
+} rk_dense;
+
+void denspar(double *FF, double *y0, double *y1, double *f1, double dt,
+  rk_dense *dn, int neq, double *r);
+
+void densstages(rk_dense *dn, SEXP Func, SEXP Parms, SEXP Rho, double t,
+  double dt, double *y0, double *FF, double *f1, double *tmp, double *out,
+  int neq, int stage, int *ipar, int isDll, int isForcing);
 
-void densout(double *r, double t0, double t, double dt, double* res, int neq);
+void densout(double *r, int nr, double t0, double t, double dt, double* res,
+  int neq);
 
 void densoutck(double t0, double t, double dt, double * y0,   
   double* FF, double* dy, double* res, int neq);
 
+void densevalue(int densetype, double t0, double t, double dt, double *rr,
+  int nr, double *y0, double *y2, double *FF, double *f1, double *res, int neq);
+
 void neville(double *xx, double *y, double tnew, double *ynew, int n, int ksig);
 
 void shiftBuffer (double *x, int n, int k);
 
+void knotsout(double *yknots, int nknots, int iknots, int neq, double tend,
+  double *tt, int *_it_ext, int nt, double *yout, double *tmp);
+
+/*==========================================================================*/
+/* specialized kernels for built-in Butcher tables                          */
+/*==========================================================================*/
+
+int rk_kernelid(SEXP Method, int varstep, int stage, double *A, double *bb1,
+  double *bb2, double *cc);
+
+void rk_kernelstage(int kernel, int j, int neq, double dt, double *y0,
+  double *FF, double *tmp);
+
+double rk_kernelstep(int kernel, int neq, double dt, double *y0, double *FF,
+  double *y1, double *y2, double *atol, double *rtol);
+
+void rk_kernelfixed(int kernel, int neq, double dt, double *y0, double *FF,
+  double *y1);
+
+/*==========================================================================*/
+/* step size controller (rk_control.c)                                      */
+/*==========================================================================*/
+
+typedef struct {
+  double k1, k2, k3, a2, a3;  /* exponents of the digital filter          */
+  double krej;                /* exponent after a rejected step           */
+  double safe, minscale, maxscale, limiter;
+  int filter;                 /* digital filter instead of the PI default */
+  double err1, err2;          /* error norms of previous accepted steps   */
+  double rho1, rho2;          /* previous step size ratios                */
+  int naccept, nreject;       /* statistics ...                           */
+  int nclust, maxclust, run;  /* ... clusters of rejected steps           */
+  double hsum, hmin, hmax, hlast;
+} rk_control;
+
+void rkcontrol_init(rk_control *ctl, SEXP Method, double qerr);
+
+double rkcontrol(rk_control *ctl, double err, int accept);
+
+void rkcontrol_update(rk_control *ctl, double dt, double dtnew, int accept);
+
+void rkcontrol_rstate(SEXP R_yout, rk_control *ctl, double dtnext, double t0,
+  double tswitch);
+
+/*==========================================================================*/
+/* Rosenbrock steps and stiffness detection (rk_rosenbrock.c)               */
+/*==========================================================================*/
+
+typedef struct {
+  int stage, qerr;
+  double gamma;
+  const double *a, *c;        /* by rows, lower triangular               */
+  const double *m, *e;        /* weights of solution and error estimate  */
+  const double *alpha, *d;    /* stage times and weights of df/dt        */
+} ros_table;
+
+extern const ros_table ros2, ros3p, rodas4, rodas5p;
+
+const ros_table *rostable(const char *name);
+
+/* DLL Jacobian, same interface as for lsoda and radau */
+typedef void C_jac_func_type (int *, double *, double *, int *, int *,
+  double *, int *, double *, int *);
+
+typedef struct {
+  int on, stiff, fstiff, jacok;
+  int pure;                   /* Rosenbrock method only, no switching    */
+  int ist1, ist2;             /* stages with equal c for the estimate    */
+  int nstiff, nonstiff;       /* consecutive steps with (no) stiffness   */
+  int nswitch, njac, nlu, nfun, nstep;
+  double qerr, bound, hlamb, tswitch;
+  const ros_table *ros;
+  SEXP Jacfunc;               /* user Jacobian or R_NilValue             */
+  int banded, ml, mu;         /* band structure of the Jacobian          */
+  double *J, *M, *U, *ft, *ysti, *ftmp;
+  int *ipvt;
+} rk_switch;
+
+void rosjac(rk_switch *sw, SEXP Func, SEXP Parms, SEXP Rho, double t,
+  double *y0, double *f0, double *ytmp, double *out, int neq, int *ipar,
+  int isDll, int isForcing);
+
+double rosstep(rk_switch *sw, int neq, double t, double dt,
+  double *y0, double *f0, double *ytmp, double *y2,
+  double *atol, double *rtol, double *out,
+  SEXP Func, SEXP Parms, SEXP Rho, int *ipar, int isDll, int isForcing);
+
+double rk_stabbound(int stage, double *A, double *bb);
+
+int rk_stiffstages(int stage, double *cc, int *ist1, int *ist2);
+
+double rosradius(int neq, double *J, double *v, double *w);
+
+void rkswitch(rk_switch *sw, double t, int verbose);
+
+/*==========================================================================*/
+/* additive (IMEX) Runge-Kutta methods (rk_imex.c)                          */
+/*==========================================================================*/
+
+typedef struct {
+  int stage, qerr;
+  double gamma;               /* diagonal of the implicit (ESDIRK) part  */
+  const double *ae, *ai;      /* explicit and implicit part, by rows     */
+  const double *b, *bh, *c;   /* weights, embedded weights, stage times  */
+} imex_table;
+
+const imex_table *imextable(const char *name);
+
+/* implicit part with nspec x nspec blocks, one per cell; state i of
+   cell k is y[k + ncell * i] as in ode.1D, ode.2D and ode.3D           */
+typedef struct {
+  const imex_table *ark;
+  int nspec, ncell;
+  int nfun, njac, nlu, nnewt, nfail;
+  int jcur, jage;             /* Jacobian at the current step, its age   */
+  double hg;                  /* gamma h of the decomposed matrices      */
+  double *J, *M;              /* Jacobian blocks and their LU factors    */
+  int *ipvt;
+} imex_blocks;
+
+/*==========================================================================*/
+/* multirate infinitesimal GARK methods (rk_multirate.c)                    */
+/*==========================================================================*/
+
+typedef struct {
+  int stage, order;
+  const double *c;            /* stage times                             */
+  const double *g0, *g1;      /* coupling to the slow stages, by rows    */
+} mri_table;
+
+const mri_table *mritable(const char *name);
+
+/*==========================================================================*/
+/* extrapolation method of Gragg, Bulirsch and Stoer (rk_extrapol.c)        */
+/*==========================================================================*/
+
+/* columns j = 1 .. kmax (index 0 unused); row j - 1 of T, ysafe and the   */
+/* nj[j] + 1 derivatives from fsafe + ipt[j] * neq belong to column j      */
+typedef struct {
+  int kmax, nthreads;         /* maximal number of columns, threads      */
+  int kc, mu, nfun;           /* last column and degree, evaluations     */
+  int *nj, *ipt;              /* step numbers 2, 6, 10, ..., f positions */
+  int *ncol, *done, *stable;  /* evaluations and state of each column    */
+  double *aw, *hh, *w;        /* work, optimal step size, work per step  */
+  double *T;                  /* extrapolation table                     */
+  double *ysafe, *fsafe;      /* midpoint values and derivatives f of    */
+                              /* the internal steps for dense output     */
+  double *dens;               /* coefficients of the dense output        */
+  double *work;               /* work space of the threads               */
+  int lwork;
+} gbs_work;
+
+/*==========================================================================*/
+/* exponential Rosenbrock methods with Krylov phi-functions (rk_expint.c)   */
+/*==========================================================================*/
+
+/* the model is dy/dt = L y + N(t, y) with an optional linear operator L
+   (Linfunc returns L v) or dy/dt = N(t, y); the Krylov space of the
+   Jacobian, augmented by p rows, has at most mmax + p dimensions          */
+typedef struct {
+  int order, mmax;            /* method (3 or 4), Krylov dimension       */
+  int neq, isDll, isForcing, islin, *ipar;
+  int nfun, nmv, nkry, nksub; /* evaluations, products, projections,   */
+                              /* additional substeps                     */
+  double *fn, *fv;            /* N at the current state, time derivative */
+  double *V, *H, *x;          /* Krylov basis, Hessenberg matrix and the */
+                              /* augmented vector of the substeps        */
+  double *E, *ework;          /* exponential of the small matrix, work   */
+  int *ipvt;
+  double *ytmp, *ftmp, *out;
+  SEXP Func, Linfunc, Parms, Rho;
+} expint_work;
+
+/*==========================================================================*/
+/* reaction step of operator splitting, cell by cell (rk_split.c)           */
+/*==========================================================================*/
+
+void rk_split(int nspec, int ncell, int nthreads, int maxsteps,
+  const ros_table *ros, double t, double tend, double *y, double *hcell,
+  double *atol, double *rtol, int *code, int *stat, double *out, int lrpar,
+  SEXP Func, SEXP Parms, SEXP Rho, int *ipar, int isDll);
+
+/*==========================================================================*/
+/* root finding                                                             */
+/*==========================================================================*/
+
+typedef void C_root_func_type (int *, double *, double *, int *, double *);
+
+double brent(double ax, double bx, double fa, double fb,
+  double f (double x, double *rw, int *iw), double *rw, int *iw,
+  double tol, int maxit);
+
+void rootvalue(SEXP Rootfunc, SEXP Rho, double t, double *y, double *gout,
+  int neq, int nroot, int isDll);
+
+int rootchange(double *gold, double *gnew, int nroot);
+
+double rootlocate(int densetype, int neq, int nroot, int isDll,
+  double t0, double dt, double *rr, int nr, double *y0, double *y2, double *FF,
+  double *f1, double *gold, double *gnew, int *jroot, double *ytmp,
+  SEXP Rootfunc, SEXP Rho);
+
 void setIstate(SEXP R_yout, SEXP R_istate, int *istate,
   int it_tot, int stage, int fsal, int qerr, int nrej);
   
@@ -72,22 +300,23 @@ void rk_auto(
   int fsal, int neq, int stage,
   int isDll, int isForcing, int verbose,
   int nknots, int interpolate, int densetype, int maxsteps, int nt,
+  int nroot, int isEvent, int isLag, int kernel,
   /* int pointers */
   int* _iknots, int* _it, int* _it_ext, int* _it_tot, int *_it_rej,
-  int* istate,  int* ipar,
+  int* istate,  int* ipar, int* _iroot, int* jroot,
   /* double */
   double t, double tmax, double hmin, double hmax, 
-  double alpha, double beta,
-  /* double pointers */
-  double* _dt, double* _errold,
+  /* pointers */
+  double* _dt, rk_control* ctl, rk_switch* sw, rk_dense* dn,
   /* arrays */
   double* tt, double* y0, double* y1, double* y2, double* dy1, double* dy2,
   double* f, double* y, double* Fj, double* tmp,
   double* FF, double* rr, double* A, double* out, 
-  double* bb1, double* bb2, double* cc, double* dd, 
+  double* bb1, double* bb2, double* cc,
   double* atol, double* rtol, double* yknots, double* yout,
+  double* gold, double* gnew,
   /* SEXPs */
-  SEXP Func, SEXP Parms, SEXP Rho
+  SEXP Func, SEXP Parms, SEXP Rho, SEXP Rootfunc
  );
 
 
@@ -95,7 +324,7 @@ void rk_fixed(
   /* integers */
   int fsal, int neq, int stage,
   int isDll, int isForcing, int verbose,
-  int nknots, int interpolate, int maxsteps, int nt,
+  int nknots, int interpolate, int maxsteps, int nt, int kernel,
   /* int pointers */
   int* _iknots, int* _it, int* _it_ext, int* _it_tot,  
   int* istate,  int* ipar,
@@ -114,6 +343,100 @@ void rk_fixed(
 );
 
  
+double rk_symplectic(
+  /* integers */
+  int neq, int nstage, int velocity, int isDll, int isForcing,
+  int verbose, int maxsteps,
+  /* int pointers */
+  int* _it_tot, int* _nfun, int* istate, int* ipar,
+  /* double */
+  double t, double tmax, double hini,
+  /* arrays */
+  double* y0, double* f, double* sa, double* sb, double* out,
+  /* SEXPs */
+  SEXP Func, SEXP Parms, SEXP Rho
+);
+
+void rk_lowstorage(
+  /* integers */
+  int neq, int stage, int isDll, int isForcing, int verbose,
+  int varstep, int maxsteps, int nt, int isEvent,
+  /* int pointers */
+  int* _it, int* _it_tot, int* _it_rej, int* istate, int* ipar,
+  /* double */
+  double t, double tmax, double hmin, double hmax, double hini,
+  rk_control* ctl,
+  /* arrays */
+  double* tt, double* y, double* dq, double* f, double* err,
+  double* A, double* B, double* cc, double* ww, double* out,
+  double* atol, double* rtol, double* yout,
+  /* SEXPs */
+  SEXP Func, SEXP Parms, SEXP Rho
+);
+
+void rk_imex(
+  /* integers */
+  int neq, int isDll, int isForcing, int verbose,
+  int maxsteps, int nt, int isEvent,
+  /* int pointers */
+  int* _it, int* _it_tot, int* _it_rej, int* istate, int* ipar,
+  /* double */
+  double t, double tmax, double hmin, double hmax, double* _dt,
+  rk_control* ctl, imex_blocks* blk,
+  /* arrays */
+  double* tt, double* y0, double* y1, double* z, double* base,
+  double* FE, double* FI, double* f0, double* f1, double* err,
+  double* ytmp, double* ftmp, double* out,
+  double* atol, double* rtol, double* yout,
+  /* SEXPs */
+  SEXP Func, SEXP Funcimp, SEXP Parms, SEXP Rho
+);
+
+void rk_extrapol(
+  /* integers */
+  int neq, int isDll, int isForcing, int verbose,
+  int maxsteps, int nt, int isEvent,
+  /* int pointers */
+  int* _it, int* _it_tot, int* _it_rej, int* istate, int* ipar,
+  /* double */
+  double t, double tmax, double hmin, double hmax, double* _dt,
+  gbs_work* g,
+  /* arrays */
+  double* tt, double* y0, double* y1, double* f0, double* f1,
+  double* wt, double* ytmp, double* out,
+  double* atol, double* rtol, double* yout,
+  /* SEXPs */
+  SEXP Func, SEXP Parms, SEXP Rho
+);
+
+void rk_expint(
+  /* integers */
+  int verbose, int maxsteps, int nt, int isEvent,
+  /* int pointers */
+  int* _it, int* _it_tot, int* _it_rej, int* istate,
+  /* double */
+  double t, double tmax, double hmin, double hmax, double* _dt,
+  rk_control* ctl, expint_work* ew,
+  /* arrays */
+  double* tt, double* y0, double* y1, double* f0, double* f1,
+  double* U, double* D, double* W, double* err, double* sc,
+  double* atol, double* rtol, double* yout
+);
+
+void rk_mri(const mri_table* mri,
+  /* integers */
+  int neq, int nt, int isDll, int isDllfast, int isForcing,
+  /* int pointers */
+  int* _it_tot, int* nslow, int* nfast, int* nfstep, int* ipar,
+  /* double */
+  double hslow, double hfast,
+  /* arrays */
+  double* tt, double* y, double* FS, double* ga, double* gb,
+  double* ytmp, double* K, double* out, double* yout,
+  /* SEXPs */
+  SEXP Func, SEXP Funcfast, SEXP Parms, SEXP Rho
+);
+
 void rk_implicit(double * alfa, int *index, 
        /* integers */
        int fsal, int neq, int stage,
@@ -123,7 +446,7 @@ void rk_implicit(double * alfa, int *index,
        int* _iknots, int* _it, int* _it_ext, int* _it_tot, 
        int* istate,  int* ipar,
        /* double */
-        double t, double tmax, double hini,
+        double t, double tmax, double hini, double tol,
        /* double pointers */
        double* _dt,
        /* arrays */
@@ -0,0 +1,406 @@
+#include <string.h>
+#include "deSolve.h"
+
+/* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+   forward sensitivities of the states to parameters, for lsode and vode
+   (BDF methods)
+
+   The sensitivities s_k = dy/dp_k satisfy the linear equations
+
+     ds_k/dt = J s_k + df/dp_k,   s_k(t0) = 0.
+
+   They are computed with the staggered corrector method: after each step
+   of the solver, the sensitivities at the new time t_n are solved from
+   the variable-coefficient BDF formula of the order used in the step, on
+   the mesh of the solver's steps:
+
+     alpha_0 s_n + sum_j alpha_j s_(n-j) = J s_n + df/dp.
+
+   The linear systems are solved by a few iterations with the matrix
+   P = I - gamma J that the solver has already formed and decomposed for
+   the states; no Jacobian is evaluated or factorised for the sensitivities.
+   The mismatch of gamma and 1/alpha_0 is compensated as in CVODES.
+   J s_k + df/dp_k is a directional difference of the model in the
+   direction (s_k, e_k) of states and parameter, as in CVODES, or, if
+   the user provides df/dp, a directional difference in s_k plus df/dp.
+
+   The parameters are perturbed in a copy: for R-functions, the model is
+   called with the values of the sensitivity parameters; for compiled
+   models, the copy of all parameters is passed to the initialiser
+   "initfunc" before the model is called.
+
+   The sensitivities are not included in the error test of the solver; they
+   are as accurate as the steps chosen for the states allow.
+   Output times are interpolated with the polynomial through the last
+   points of the history.
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+
+/* the common block of lsode, as documented in opkdmain.f:
+   COMMON /DLS001/ RLS(218), ILS(37)                                         */
+extern struct {
+  double rls[218];
+  int    ils[37];
+} F77_NAME(dls001);
+
+#define LS_EL0   F77_NAME(dls001).rls[210]
+#define LS_H     F77_NAME(dls001).rls[211]
+#define LS_RC    F77_NAME(dls001).rls[215]
+#define LS_LWM   F77_NAME(dls001).ils[23]
+#define LS_LIWM  F77_NAME(dls001).ils[24]
+#define LS_MITER F77_NAME(dls001).ils[26]
+#define LS_NQU   F77_NAME(dls001).ils[36]
+
+/* the common blocks of vode, as declared in dvode.f:
+   COMMON /DVOD01/ ACNRM, ..., UROUND (48 doubles), ICF, ..., NYH (33 ints)
+   COMMON /DVOD02/ HU, NCFN, NETF, NFE, NJE, NLU, NNI, NQU, NST             */
+extern struct {
+  double rvod[48];
+  int    ivod[33];
+} F77_NAME(dvod01);
+
+extern struct {
+  double hu;
+  int    ivod[8];
+} F77_NAME(dvod02);
+
+#define VOD_H    F77_NAME(dvod01).rvod[20]
+#define VOD_RC   F77_NAME(dvod01).rvod[26]
+#define VOD_RL1  F77_NAME(dvod01).rvod[27]
+#define VOD_LWM  F77_NAME(dvod01).ivod[14]
+#define VOD_LIWM F77_NAME(dvod01).ivod[15]
+#define VOD_NQU  F77_NAME(dvod02).ivod[6]
+
+void F77_NAME(dsolsy)(double *, int *, double *, double *);
+void F77_NAME(dvsol)(double *, int *, double *, int *);
+
+typedef void C_dfdp_func_type(int *, double *, double *, int *, double *,
+                              double *, int *);
+
+#define MAXHIST 6      /* BDF of order 5 needs 6 points                   */
+#define MAXITER 10     /* maximal number of corrector iterations          */
+
+static int nsens, nsenshist, isenshist, sensq, senscnv, sensDll, isdfdp;
+static int senssolver;
+static int *sensidx;
+static double *senstime, *senshist, *pbar;
+static double *sf0, *sf1, *sytmp, *sres, *sdel, *stem, *shis, *sfp, *sewt;
+static double *sRtol, *sAtol, srdelta;
+static int slrtol, slatol, snfun;
+static SEXP SensParms, R_sens_func, R_dfdp_func;
+static C_deriv_func_type *sens_deriv;
+static C_dfdp_func_type  *dll_dfdp;
+static init_func_type    *sens_init;
+
+/*===========================================================================
+  initialisation; returns the number of sensitivity parameters
+  slist contains "index" (position of the parameters in "parms", 1-based),
+  "parms" (the values that are perturbed), "pbar" (their typical size),
+  "func" (R: the model with the parameters as 3rd argument) and "dfdp"
+  =========================================================================== */
+
+int initSens(SEXP slist, int solver, SEXP initfunc, int isDll,
+             C_deriv_func_type *deriv_func, double *rtol, int lrtol,
+             double *atol, int latol) {
+
+  SEXP Index, Pbar, Dfdp;
+  int j;
+
+  nsens = 0;
+  if (isNull(slist)) return(0);
+  Index = getListElement(slist, "index");
+  if (isNull(Index) || LENGTH(Index) == 0) return(0);
+  if (solver != 2 && solver != 5)
+    error("sensitivities are only available in lsode and vode");
+
+  nsens = LENGTH(Index);
+  senssolver = solver;
+  sensDll = isDll;
+  sens_deriv = deriv_func;
+
+  /* a modifiable copy of the parameters */
+  PROTECT(SensParms = duplicate(getListElement(slist, "parms")));
+  incr_N_Protect();
+
+  sensidx = (int *) R_alloc(nsens, sizeof(int));
+  pbar    = (double *) R_alloc(nsens, sizeof(double));
+  Pbar = getListElement(slist, "pbar");
+  for (j = 0; j < nsens; j++) {
+    sensidx[j] = (isDll) ? INTEGER(Index)[j] - 1 : j;
+    if (sensidx[j] < 0 || sensidx[j] >= LENGTH(SensParms))
+      error("illegal index of sensitivity parameter %i", sensidx[j] + 1);
+    pbar[j] = REAL(Pbar)[j];
+    if (pbar[j] <= 0) pbar[j] = 1.;
+  }
+
+  Dfdp = getListElement(slist, "dfdp");
+  isdfdp = !isNull(Dfdp);
+  if (isDll) {
+    if (isdfdp) dll_dfdp = (C_dfdp_func_type *) R_ExternalPtrAddr(Dfdp);
+    if (inherits(initfunc, "NativeSymbol"))
+      sens_init = (init_func_type *) R_ExternalPtrAddr(initfunc);
+    else if (!isdfdp)
+      error("sensitivities of compiled models need 'initfunc' or 'dfdp'");
+    else
+      sens_init = NULL;
+  } else {
+    R_sens_func = getListElement(slist, "func");
+    R_dfdp_func = Dfdp;
+  }
+
+  sRtol = rtol; slrtol = lrtol;
+  sAtol = atol; slatol = latol;
+  srdelta = sqrt(fmax(rtol[0], DBL_EPSILON));
+
+  senstime = (double *) R_alloc(MAXHIST, sizeof(double));
+  senshist = (double *) R_alloc(MAXHIST * n_eq * nsens, sizeof(double));
+  sf0      = (double *) R_alloc(n_eq, sizeof(double));
+  sf1      = (double *) R_alloc(n_eq, sizeof(double));
+  sytmp    = (double *) R_alloc(n_eq, sizeof(double));
+  sres     = (double *) R_alloc(n_eq, sizeof(double));
+  sdel     = (double *) R_alloc(n_eq, sizeof(double));
+  stem     = (double *) R_alloc(n_eq, sizeof(double));
+  shis     = (double *) R_alloc(n_eq, sizeof(double));
+  sewt     = (double *) R_alloc(n_eq, sizeof(double));
+  sfp      = (double *) R_alloc(n_eq * nsens, sizeof(double));
+  nsenshist = 0; isenshist = 0; sensq = 1; senscnv = 0; snfun = 0;
+  return(nsens);
+}
+
+/*===========================================================================
+  the first point of the history: s = 0 at the initial time
+  =========================================================================== */
+
+void initsenshist(double t) {
+  int i;
+  senstime[0] = t;
+  for (i = 0; i < n_eq * nsens; i++) senshist[i] = 0.;
+  nsenshist = 1; isenshist = 0;
+}
+
+/* position of the j-th newest point of the history (j = 0: newest) */
+static double *senspast(int j, double *t) {
+  int i = (isenshist - j + MAXHIST) % MAXHIST;
+  *t = senstime[i];
+  return(senshist + i * n_eq * nsens);
+}
+
+/*===========================================================================
+  the model with parameter k perturbed by dp (k < 0: not perturbed)
+  =========================================================================== */
+
+static void sensderiv(double t, double *y, int k, double dp, double *f) {
+  int i;
+  double p = 0.;
+  SEXP R_fcall, Time, ans;
+
+  if (k >= 0) {
+    p = REAL(SensParms)[sensidx[k]];
+    REAL(SensParms)[sensidx[k]] = p + dp;
+  }
+  if (sensDll) {
+    if (k >= 0) {
+      de_gparms = SensParms;
+      sens_init(Initdeparms);
+    }
+    sens_deriv(&n_eq, &t, y, f, out, ipar);
+    if (k >= 0) {
+      REAL(SensParms)[sensidx[k]] = p;
+      sens_init(Initdeparms);
+    }
+  } else {
+    for (i = 0; i < n_eq; i++) REAL(Y)[i] = y[i];
+    PROTECT(Time = ScalarReal(t));                            incr_N_Protect();
+    PROTECT(R_fcall = lang4(R_sens_func, Time, Y, SensParms)); incr_N_Protect();
+    PROTECT(ans = eval(R_fcall, R_envir));                    incr_N_Protect();
+    for (i = 0; i < n_eq; i++) f[i] = REAL(ans)[i];
+    my_unprotect(3);
+    if (k >= 0) REAL(SensParms)[sensidx[k]] = p;
+  }
+  snfun++;
+}
+
+/* df/dp of all sensitivity parameters, by the user-supplied function */
+
+static void sensdfdp(double t, double *y, double *fp) {
+  int i;
+  SEXP R_fcall, Time, ans;
+
+  if (sensDll)
+    dll_dfdp(&n_eq, &t, y, &nsens, fp, out, ipar);
+  else {
+    for (i = 0; i < n_eq; i++) REAL(Y)[i] = y[i];
+    PROTECT(Time = ScalarReal(t));                   incr_N_Protect();
+    PROTECT(R_fcall = lang3(R_dfdp_func, Time, Y));  incr_N_Protect();
+    PROTECT(ans = eval(R_fcall, R_envir));           incr_N_Protect();
+    if (LENGTH(ans) != n_eq * nsens)
+      error("'dfdp' should return a matrix with %i rows and %i columns",
+            n_eq, nsens);
+    for (i = 0; i < n_eq * nsens; i++) fp[i] = REAL(ans)[i];
+    my_unprotect(3);
+  }
+}
+
+/*===========================================================================
+  J s_k + df/dp_k, by a directional difference; step sizes as in CVODES
+  =========================================================================== */
+
+static void sensrhs(double t, double *y, int k, double *s, double *res) {
+  int i;
+  double del, dely, delp, norm = 0.;
+
+  for (i = 0; i < n_eq; i++) norm += (s[i] * sewt[i]) * (s[i] * sewt[i]);
+  norm = sqrt(norm / n_eq) * pbar[k];
+  dely = pbar[k] / fmax(norm, 1. / srdelta);
+  delp = pbar[k] * srdelta;
+
+  if (isdfdp) {
+    /* the parameters are not perturbed */
+    for (i = 0; i < n_eq; i++) sytmp[i] = y[i] + dely * s[i];
+    sensderiv(t, sytmp, -1, 0., sf1);
+    for (i = 0; i < n_eq; i++)
+      res[i] = (sf1[i] - sf0[i]) / dely + sfp[k * n_eq + i];
+  } else {
+    del = fmin(dely, delp);
+    for (i = 0; i < n_eq; i++) sytmp[i] = y[i] + del * s[i];
+    sensderiv(t, sytmp, k, del, sf1);
+    for (i = 0; i < n_eq; i++) res[i] = (sf1[i] - sf0[i]) / del;
+  }
+}
+
+/*===========================================================================
+  the sensitivities at time t, after a successful step of lsode or vode to
+  (t, y); rwork and iwork are those of the solver
+  =========================================================================== */
+
+void updatesens(double t, double *y, double *rwork, int *iwork) {
+  int i, j, k, m, q, iter, iersl;
+  double tj, tm, *sj, *sn, alpha0, c, gam, gamrat, scal, norm, nold, wt;
+  double tau[MAXHIST], alpha[MAXHIST];
+
+  /* order of the BDF, as used by the solver in the step */
+  q = (senssolver == 5) ? VOD_NQU : LS_NQU;
+  if (q > nsenshist) q = nsenshist;
+  if (q > MAXHIST - 1) q = MAXHIST - 1;
+  sensq = q;
+  for (j = 1; j <= nsenshist && j < MAXHIST; j++) senspast(j - 1, &tau[j]);
+  tau[0] = t;
+
+  /* coefficients alpha_j = l_j'(t) of the Lagrange polynomials */
+  alpha0 = 0.;
+  for (j = 1; j <= q; j++) {
+    alpha0 += 1. / (t - tau[j]);
+    c = 1. / (tau[j] - t);
+    for (m = 1; m <= q; m++)
+      if (m != j) c *= (t - tau[m]) / (tau[j] - tau[m]);
+    alpha[j] = c;
+  }
+
+  /* gamma of the iteration matrix P = I - gamma J; RC is the ratio of the
+     current gamma to the one of the last decomposition (MITER = 1, 2, 4, 5) */
+  if (senssolver == 5)
+    gam = VOD_H * VOD_RL1 / VOD_RC;
+  else {
+    gam = LS_H * LS_EL0;
+    if (LS_MITER != 3) gam = gam / LS_RC;
+  }
+  gamrat = 1. / (alpha0 * gam);
+  scal = 2. / (1. + gamrat) / alpha0;
+
+  /* the new point of the history, predicted by extrapolation */
+  isenshist = (isenshist + 1) % MAXHIST;
+  senstime[isenshist] = t;
+  if (nsenshist < MAXHIST) nsenshist++;
+  sn = senshist + isenshist * n_eq * nsens;
+  m = (q + 1 < nsenshist - 1) ? q + 1 : nsenshist - 1;  /* past points */
+  for (i = 0; i < n_eq * nsens; i++) sn[i] = 0.;
+  for (j = 1; j <= m; j++) {
+    c = 1.;
+    for (k = 1; k <= m; k++)
+      if (k != j) c *= (t - tau[k]) / (tau[j] - tau[k]);
+    sj = senspast(j, &tj);
+    for (i = 0; i < n_eq * nsens; i++) sn[i] += c * sj[i];
+  }
+
+  sensderiv(t, y, -1, 0., sf0);
+  if (isdfdp) sensdfdp(t, y, sfp);
+
+  for (i = 0; i < n_eq; i++) {
+    wt = sRtol[(slrtol > 1) ? i : 0] * fabs(y[i]) +
+         sAtol[(slatol > 1) ? i : 0];
+    sewt[i] = 1. / wt;
+  }
+
+  for (k = 0; k < nsens; k++) {
+    sn = senshist + isenshist * n_eq * nsens + k * n_eq;
+
+    /* the contribution of the past points */
+    for (i = 0; i < n_eq; i++) shis[i] = 0.;
+    for (j = 1; j <= q; j++) {
+      sj = senspast(j, &tm) + k * n_eq;
+      for (i = 0; i < n_eq; i++) shis[i] += alpha[j] * sj[i];
+    }
+
+    nold = 0.;
+    for (iter = 0; iter < MAXITER; iter++) {
+      sensrhs(t, y, k, sn, sres);
+      for (i = 0; i < n_eq; i++)
+        sdel[i] = scal * (sres[i] - alpha0 * sn[i] - shis[i]);
+      if (senssolver == 5)
+        F77_CALL(dvsol)(rwork + VOD_LWM - 1, iwork + VOD_LIWM - 1, sdel,
+                        &iersl);
+      else
+        F77_CALL(dsolsy)(rwork + LS_LWM - 1, iwork + LS_LIWM - 1, sdel,
+                         stem);
+
+      norm = 0.;
+      for (i = 0; i < n_eq; i++) {
+        sn[i] += sdel[i];
+        wt = sRtol[(slrtol > 1) ? i : 0] * fabs(sn[i]) +
+             sAtol[(slatol > 1) ? i : 0] / pbar[k];
+        norm += (sdel[i] / wt) * (sdel[i] / wt);
+      }
+      norm = sqrt(norm / n_eq);
+      /* converged, or the iteration stagnates at round-off level */
+      if (norm <= 0.1 || (iter > 0 && norm >= nold && norm <= 1.)) break;
+      /* diverges: P is no approximation of the Newton matrix */
+      if (iter > 0 && norm > 2. * nold) {
+        iter = MAXITER;
+        break;
+      }
+      nold = norm;
+    }
+    if (iter == MAXITER) senscnv++;
+  }
+}
+
+/*===========================================================================
+  interpolation of the sensitivities to time t, by the polynomial of
+  order sensq through the newest points of the history
+  =========================================================================== */
+
+void senstout(double t, double *res) {
+  int i, j, k, m;
+  double c, tj, tk, *sj;
+
+  m = (sensq + 1 < nsenshist) ? sensq + 1 : nsenshist;
+  for (i = 0; i < n_eq * nsens; i++) res[i] = 0.;
+  for (j = 0; j < m; j++) {
+    sj = senspast(j, &tj);
+    c = 1.;
+    for (k = 0; k < m; k++)
+      if (k != j) {
+        senspast(k, &tk);
+        c *= (t - tk) / (tj - tk);
+      }
+    for (i = 0; i < n_eq * nsens; i++) res[i] += c * sj[i];
+  }
+}
+
+/*===========================================================================
+  statistics: number of model evaluations and of steps without convergence
+  =========================================================================== */
+
+void sensstats(int *nfun, int *ncnv) {
+  *nfun = snfun;
+  *ncnv = senscnv;
+}